@@ -4,10 +4,13 @@
 #include <fstream>
 #include <map>
 
+#include "bounds.h"
+#include "bvh.h"
 #include "common_defines.h"
 #include "editor_layer.h"
 #include "input.h"
 #include "logger.h"
+#include "meshlets.h"
 #include "renderer.h"
 #include "resource_manager.h"
 #include "entt/entt.hpp"
@@ -95,12 +98,22 @@ int main()
 	cubemap_handles.push_back(resource_manager.load_resource_from_disk<TextureResource>("Assets/Textures/KelpDome/kelp_+y.png"));
 	cubemap_handles.push_back(resource_manager.load_resource_from_disk<TextureResource>("Assets/Textures/KelpDome/kelp_-z.png"));
 	cubemap_handles.push_back(resource_manager.load_resource_from_disk<TextureResource>("Assets/Textures/KelpDome/kelp_+z.png"));
-	renderer.curr_cubemap = renderer.upload_cubemap_to_gpu(cubemap_handles, true);
+	renderer.set_ambient_from_cubemap(cubemap_handles);
+	renderer.curr_cubemap = renderer.upload_cubemap_to_gpu(cubemap_handles, true, &renderer.curr_irradiance_map);
 
 	//Load model for testing purposes
 	ResourceHandle handle_goomboss = resource_manager.load_resource_from_disk<ModelResource>("Assets/Models/kelp.gltf");
 	ModelGPU model_gpu_goomboss = renderer.upload_mesh_to_gpu(handle_goomboss);
 
+	//Entities with models go in the scene BVH, so only the ones in view get drawn
+	Bvh scene_bvh;
+	std::vector<uint32_t> visible_entities;
+	auto kelp = entity_registry.create();
+	const TransformComponent& kelp_transform = entity_registry.emplace<TransformComponent>(kelp);
+	ModelRenderComponent& kelp_model = entity_registry.emplace<ModelRenderComponent>(kelp);
+	kelp_model.model = handle_goomboss;
+	kelp_model.bvh_object = scene_bvh.add_object(BoundingVolumes::transform_bounds(model_gpu_goomboss.bounds, kelp_transform.get_model_matrix()), static_cast<uint32_t>(kelp));
+
 	float move_speed = 2.0f;
 	float mouse_sensitivity = 0.3f;
 	printf("\n");
@@ -116,14 +129,25 @@ int main()
 
 		//Update camera position
 		update_camera(entity_registry, renderer, input, move_speed, delta_time, mouse_sensitivity);
-
-		//temporary
-		renderer.draw_model(handle_goomboss, glm::mat4(1.0f));
+		resource_manager.set_streaming_view(entity_registry.get<TransformComponent>(camera), entity_registry.get<CameraComponent>(camera));
+
+		//Draw every model in view
+		scene_bvh.update();
+		glm::vec4 frustum_planes[6];
+		Meshlets::extract_frustum_planes(camera_component.get_proj_matrix() * entity_registry.get<TransformComponent>(camera).get_view_matrix(), frustum_planes);
+		visible_entities.clear();
+		scene_bvh.query_frustum(frustum_planes, visible_entities);
+		for (const uint32_t entity_id : visible_entities)
+		{
+			const auto entity = static_cast<entt::entity>(entity_id);
+			renderer.draw_model(entity_registry.get<ModelRenderComponent>(entity).model, entity_registry.get<TransformComponent>(entity).get_model_matrix());
+		}
 		//renderer.draw_text(std::string("frametime: ").append(std::to_string(delta_time)), { 16, 16 });
 		renderer.end_frame();
 		editor_layer.update();
 		resource_manager.tick(delta_time);
 	}
 
+	LoadTelemetry::dump_json("load_telemetry.json");
 	return 0;
 }
@@ -0,0 +1,172 @@
+#include "asset_cache.h"
+
+#include <atomic>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "common_defines.h"
+#include "compression.h"
+#include "resource_manager.h"
+
+struct AssetCacheHeader
+{
+	uint32_t magic;
+	uint32_t format_version;
+	uint64_t version;
+};
+
+constexpr uint32_t cache_magic = 0x43414C46; //"FLAC"
+constexpr uint32_t cache_format_version = 1;
+
+//Different for every write in every process, so threads or instances storing the same key at once never write the same temporary file
+static std::string get_temporary_suffix()
+{
+#ifdef _WIN32
+	const int process_id = _getpid();
+#else
+	const int process_id = static_cast<int>(getpid());
+#endif
+	static std::atomic<uint32_t> n_writes{ 0 };
+	return "." + std::to_string(process_id) + "." + std::to_string(n_writes++) + ".tmp";
+}
+
+//Returns the cached data for this key, or nullptr if there is no entry or it is out of date. The data is allocated with the resource
+//manager's allocator, 16-byte aligned, and owned by the caller
+char* AssetCache::load(const std::string& key, const uint64_t version, uint32_t& size_bytes)
+{
+	size_bytes = 0;
+	if (!enabled)
+		return nullptr;
+
+	const std::string entry_path = get_entry_path(key);
+	std::error_code error;
+	if (!std::filesystem::exists(entry_path, error))
+		return nullptr;
+
+	int file_size;
+	char* file_data;
+	ResourceManager::read_file(entry_path, file_size, file_data, true);
+	if (file_data == nullptr)
+		return nullptr;
+	LoadTelemetry::set_name(ResourceManager::generate_hash_from_string(entry_path), entry_path, "cache");
+
+	//Check if the entry is still valid
+	AssetCacheHeader header{};
+	uint32_t decompressed_size = 0;
+	const char* compressed_data = file_data + sizeof(AssetCacheHeader);
+	const uint32_t compressed_size = static_cast<uint32_t>(file_size) - static_cast<uint32_t>(sizeof(AssetCacheHeader));
+	if (file_size >= static_cast<int>(sizeof(AssetCacheHeader)))
+		memcpy(&header, file_data, sizeof(AssetCacheHeader));
+	if (header.magic != cache_magic || header.format_version != cache_format_version || header.version != version || !Compression::get_decompressed_size(compressed_data, compressed_size, decompressed_size))
+	{
+		dynamic_free(file_data);
+		return nullptr;
+	}
+
+	//Decompress it
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "asset cache - " + key;
+	char* data = static_cast<char*>(dynamic_allocate(decompressed_size, 16));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	const bool success = Compression::decompress(compressed_data, compressed_size, data, decompressed_size);
+	dynamic_free(file_data);
+	if (!success)
+	{
+		Logger::logf("[ERROR] Asset cache entry '%s' is corrupt!\n", entry_path.c_str());
+		dynamic_free(data);
+		return nullptr;
+	}
+
+	size_bytes = decompressed_size;
+	return data;
+}
+
+bool AssetCache::store(const std::string& key, const uint64_t version, const char* data, const uint32_t size_bytes)
+{
+	if (!enabled)
+		return false;
+
+	std::error_code error;
+	std::filesystem::create_directories(cache_folder, error);
+
+	const std::vector<char> compressed_data = Compression::compress(data, size_bytes);
+	const AssetCacheHeader header{ cache_magic, cache_format_version, version };
+
+	//Write to a temporary file first, so a half written entry is never picked up
+	const std::string entry_path = get_entry_path(key);
+	const std::string temporary_path = entry_path + get_temporary_suffix();
+	{
+		std::ofstream file(temporary_path, std::ios::binary);
+		if (!file.is_open())
+		{
+			Logger::logf("[ERROR] Failed to write asset cache entry '%s'!\n", entry_path.c_str());
+			return false;
+		}
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(compressed_data.data(), static_cast<std::streamsize>(compressed_data.size()));
+		if (!file.good())
+		{
+			Logger::logf("[ERROR] Failed to write asset cache entry '%s'!\n", entry_path.c_str());
+			return false;
+		}
+	}
+	std::filesystem::rename(temporary_path, entry_path, error);
+	if (error)
+	{
+		std::filesystem::remove(temporary_path, error);
+		return false;
+	}
+	return true;
+}
+
+//64-bit hash, fast enough to run over whole source files to detect changes
+uint64_t AssetCache::hash_data(const char* data, const size_t size_bytes)
+{
+	uint64_t hash = 0xcbf29ce484222325ull ^ size_bytes;
+	size_t i = 0;
+	for (; i + 8 <= size_bytes; i += 8)
+	{
+		uint64_t chunk;
+		memcpy(&chunk, data + i, sizeof(chunk));
+		hash ^= chunk * 0x9e3779b97f4a7c15ull;
+		hash = ((hash << 31) | (hash >> 33)) * 0x100000001b3ull;
+	}
+	for (; i < size_bytes; i++)
+	{
+		hash ^= static_cast<uint8_t>(data[i]);
+		hash *= 0x100000001b3ull;
+	}
+
+	//Mix the bits so nearby inputs don't give nearby hashes
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+//Version for data cooked from a file that's only the file's size and last write time, so checking for a cache entry doesn't have to read
+//the file itself. 0 if the file doesn't exist
+uint64_t AssetCache::get_file_stamp(const std::string& path)
+{
+	std::error_code error;
+	const uint64_t size_bytes = std::filesystem::file_size(path, error);
+	if (error)
+		return 0;
+	const auto write_time = std::filesystem::last_write_time(path, error);
+	if (error)
+		return 0;
+	const uint64_t stamp[2]{ size_bytes, static_cast<uint64_t>(write_time.time_since_epoch().count()) };
+	return hash_data(reinterpret_cast<const char*>(stamp), sizeof(stamp));
+}
+
+std::string AssetCache::get_entry_path(const std::string& key)
+{
+	char file_name[32];
+	snprintf(file_name, sizeof(file_name), "%016llx.bin", static_cast<unsigned long long>(hash_data(key.data(), key.size())));
+	return cache_folder + file_name;
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+//On-disk cache for cooked asset data, so expensive processing only has to happen the first time a source file is loaded.
+//Entries are block compressed, and keyed by name plus a version (a hash or file stamp of the source data), so stale entries are ignored
+class AssetCache
+{
+public:
+	static char* load(const std::string& key, uint64_t version, uint32_t& size_bytes);
+	static bool store(const std::string& key, uint64_t version, const char* data, uint32_t size_bytes);
+	static uint64_t hash_data(const char* data, size_t size_bytes);
+	static uint64_t get_file_stamp(const std::string& path);
+	inline static bool enabled = true;
+	inline static std::string cache_folder = "Cache/";
+
+private:
+	static std::string get_entry_path(const std::string& key);
+};
@@ -0,0 +1,370 @@
+#include "async_file_io.h"
+
+#include "logger.h"
+#include "resource_manager.h"
+
+#ifdef __linux__
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+//glibc has no wrappers for these, and we don't want to depend on liburing just for this
+static int sys_io_uring_setup(const unsigned entries, io_uring_params* params)
+{
+	return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int sys_io_uring_enter(const int ring_fd, const unsigned to_submit, const unsigned min_complete, const unsigned flags)
+{
+	return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+//Used to wake up the completion thread on shutdown
+constexpr uint64_t shutdown_user_data = UINT64_MAX;
+#endif
+
+AsyncFileIO::AsyncFileIO(const int queue_depth, const int n_fallback_threads)
+{
+#ifdef __linux__
+	io_uring_enabled = init_io_uring(queue_depth);
+	if (!io_uring_enabled)
+		Logger::logf("io_uring is not available, falling back to threaded file reads\n");
+#endif
+	if (!io_uring_enabled)
+		fallback_threads = new JobSystem(n_fallback_threads);
+}
+
+AsyncFileIO::~AsyncFileIO()
+{
+#ifdef __linux__
+	if (io_uring_enabled)
+		shutdown_io_uring();
+#endif
+	delete fallback_threads;
+}
+
+//Starts reading every requested file. The requests are moved out of the vector
+void AsyncFileIO::submit_reads(std::vector<FileReadRequest>& requests)
+{
+#ifdef __linux__
+	if (io_uring_enabled)
+	{
+		std::vector<FileReadRequest> failed_requests;
+		{
+			std::lock_guard<std::mutex> lock(ring_mutex);
+			for (auto& request : requests)
+			{
+				//Open the file and find out how big it is, so we know how much to allocate
+				const int fd = open(request.path.c_str(), O_RDONLY | O_CLOEXEC);
+				struct stat file_stat {};
+				if (fd < 0 || fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0)
+				{
+					Logger::logf("[ERROR] Failed to open file '%s'!\n", request.path.c_str());
+					if (fd >= 0)
+						close(fd);
+					failed_requests.push_back(std::move(request));
+					continue;
+				}
+
+				if (free_slots.empty())
+				{
+					free_slots.push_back(static_cast<uint32_t>(slots.size()));
+					slots.emplace_back();
+				}
+				const uint32_t slot = free_slots.back();
+				free_slots.pop_back();
+
+				InFlightRead& read = slots[slot];
+				read.request = std::move(request);
+				read.fd = fd;
+				read.size = static_cast<uint64_t>(file_stat.st_size);
+				read.bytes_done = 0;
+				read.start = std::chrono::steady_clock::now();
+				ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "file loading - " + read.request.path;
+				read.data = static_cast<char*>(dynamic_allocate(static_cast<uint32_t>(read.size)));
+				ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+				waiting_slots.push_back(slot);
+			}
+
+			//Everything goes to the kernel in one go
+			submit_queued_locked();
+		}
+
+		//Callbacks may submit more reads, so they can't run while the ring is locked
+		for (auto& request : failed_requests)
+			request.on_complete(nullptr, 0);
+		requests.clear();
+		return;
+	}
+#endif
+
+	for (auto& request : requests)
+		submit_read_fallback(std::move(request));
+	requests.clear();
+}
+
+void AsyncFileIO::submit_read_fallback(FileReadRequest request)
+{
+	fallback_threads->schedule([request = std::move(request)]()
+	{
+		int size_bytes = 0;
+		char* data = nullptr;
+		ResourceManager::read_file(request.path, size_bytes, data);
+		request.on_complete(data, size_bytes);
+	});
+}
+
+#ifdef __linux__
+bool AsyncFileIO::init_io_uring(const int queue_depth)
+{
+	io_uring_params params{};
+	ring_fd = sys_io_uring_setup(static_cast<unsigned>(queue_depth), &params);
+	if (ring_fd < 0)
+		return false;
+
+	//IORING_OP_READ needs Linux 5.6, which is also the first version with this feature flag
+	if ((params.features & IORING_FEAT_NODROP) == 0)
+	{
+		close(ring_fd);
+		ring_fd = -1;
+		return false;
+	}
+
+	//Map the submission and completion rings, which can share one mapping on newer kernels
+	sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		sq_ring_size = std::max(sq_ring_size, cq_ring_size);
+		cq_ring_size = sq_ring_size;
+	}
+	sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+	if (sq_ring == MAP_FAILED)
+	{
+		sq_ring = nullptr;
+		shutdown_io_uring();
+		return false;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		cq_ring = sq_ring;
+	}
+	else
+	{
+		cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+		if (cq_ring == MAP_FAILED)
+		{
+			cq_ring = nullptr;
+			shutdown_io_uring();
+			return false;
+		}
+	}
+	void* sqe_memory = mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqe_memory == MAP_FAILED)
+	{
+		shutdown_io_uring();
+		return false;
+	}
+	sqes = static_cast<io_uring_sqe*>(sqe_memory);
+	sq_entries = params.sq_entries;
+
+	char* sq_base = static_cast<char*>(sq_ring);
+	char* cq_base = static_cast<char*>(cq_ring);
+	sq_head = reinterpret_cast<std::atomic<uint32_t>*>(sq_base + params.sq_off.head);
+	sq_tail = reinterpret_cast<std::atomic<uint32_t>*>(sq_base + params.sq_off.tail);
+	sq_mask = reinterpret_cast<uint32_t*>(sq_base + params.sq_off.ring_mask);
+	sq_array = reinterpret_cast<uint32_t*>(sq_base + params.sq_off.array);
+	cq_head = reinterpret_cast<std::atomic<uint32_t>*>(cq_base + params.cq_off.head);
+	cq_tail = reinterpret_cast<std::atomic<uint32_t>*>(cq_base + params.cq_off.tail);
+	cq_mask = reinterpret_cast<uint32_t*>(cq_base + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<io_uring_cqe*>(cq_base + params.cq_off.cqes);
+
+	completion_thread = std::thread(&AsyncFileIO::completion_loop, this);
+	return true;
+}
+
+void AsyncFileIO::shutdown_io_uring()
+{
+	//Wake up the completion thread with a no-op so it can see that we're shutting down
+	if (completion_thread.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(ring_mutex);
+			shutting_down = true;
+			const uint32_t tail = sq_tail->load(std::memory_order_relaxed);
+			const uint32_t index = tail & *sq_mask;
+			memset(&sqes[index], 0, sizeof(io_uring_sqe));
+			sqes[index].opcode = IORING_OP_NOP;
+			sqes[index].user_data = shutdown_user_data;
+			sq_array[index] = index;
+			sq_tail->store(tail + 1, std::memory_order_release);
+			n_unsubmitted++;
+			sys_io_uring_enter(ring_fd, n_unsubmitted, 0, 0);
+			n_unsubmitted = 0;
+		}
+		completion_thread.join();
+	}
+
+	if (sqes != nullptr)
+		munmap(sqes, sq_entries * sizeof(io_uring_sqe));
+	if (cq_ring != nullptr && cq_ring != sq_ring)
+		munmap(cq_ring, cq_ring_size);
+	if (sq_ring != nullptr)
+		munmap(sq_ring, sq_ring_size);
+	if (ring_fd >= 0)
+		close(ring_fd);
+	sqes = nullptr;
+	sq_ring = nullptr;
+	cq_ring = nullptr;
+	ring_fd = -1;
+}
+
+//Fills in a submission queue entry for the rest of a read. Doesn't submit it yet
+void AsyncFileIO::queue_read_locked(const uint32_t slot)
+{
+	const InFlightRead& read = slots[slot];
+	const uint32_t tail = sq_tail->load(std::memory_order_relaxed);
+	const uint32_t index = tail & *sq_mask;
+	io_uring_sqe& sqe = sqes[index];
+	memset(&sqe, 0, sizeof(io_uring_sqe));
+	sqe.opcode = IORING_OP_READ;
+	sqe.fd = read.fd;
+	sqe.addr = reinterpret_cast<uint64_t>(read.data + read.bytes_done);
+	sqe.len = static_cast<uint32_t>(read.size - read.bytes_done);
+	sqe.off = read.bytes_done;
+	sqe.user_data = slot;
+	sq_array[index] = index;
+	sq_tail->store(tail + 1, std::memory_order_release);
+	n_unsubmitted++;
+	n_in_kernel++;
+}
+
+//Moves as many waiting reads into the submission queue as there is room for, and hands them to the kernel.
+//The number of reads in the kernel is kept below the queue size, so completions can never overflow
+void AsyncFileIO::submit_queued_locked()
+{
+	size_t n_taken = 0;
+	while (n_taken < waiting_slots.size() && n_in_kernel + 1 < sq_entries)
+	{
+		queue_read_locked(waiting_slots[n_taken]);
+		n_taken++;
+	}
+	waiting_slots.erase(waiting_slots.begin(), waiting_slots.begin() + n_taken);
+
+	while (n_unsubmitted > 0)
+	{
+		const int n_submitted = sys_io_uring_enter(ring_fd, n_unsubmitted, 0, 0);
+		if (n_submitted < 0)
+		{
+			if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+				continue;
+			Logger::logf("[ERROR] io_uring_enter failed: %s\n", strerror(errno));
+			return;
+		}
+		n_unsubmitted -= static_cast<uint32_t>(n_submitted);
+	}
+}
+
+void AsyncFileIO::completion_loop()
+{
+	while (true)
+	{
+		//Sleep until at least one read completes
+		const int result = sys_io_uring_enter(ring_fd, 0, 1, IORING_ENTER_GETEVENTS);
+		if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			Logger::logf("[ERROR] io_uring_enter failed: %s\n", strerror(errno));
+			return;
+		}
+
+		uint32_t head = cq_head->load(std::memory_order_relaxed);
+		const uint32_t tail = cq_tail->load(std::memory_order_acquire);
+		bool should_exit = false;
+		while (head != tail)
+		{
+			const io_uring_cqe cqe = cqes[head & *cq_mask];
+			head++;
+			cq_head->store(head, std::memory_order_release);
+
+			if (cqe.user_data == shutdown_user_data)
+			{
+				should_exit = true;
+				continue;
+			}
+
+			const uint32_t slot = static_cast<uint32_t>(cqe.user_data);
+			bool finished = false;
+			bool success = false;
+			{
+				std::lock_guard<std::mutex> lock(ring_mutex);
+				n_in_kernel--;
+				InFlightRead& read = slots[slot];
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+				{
+					//Try again
+					waiting_slots.push_back(slot);
+				}
+				else if (cqe.res <= 0)
+				{
+					//An error, or the file got shorter since we checked its size
+					finished = true;
+				}
+				else
+				{
+					//Reads can come back short, in which case we ask for the rest
+					read.bytes_done += static_cast<uint64_t>(cqe.res);
+					finished = read.bytes_done >= read.size;
+					success = finished;
+					if (!finished)
+						waiting_slots.push_back(slot);
+				}
+				submit_queued_locked();
+			}
+			if (finished)
+				finish_read(slot, success);
+		}
+
+		if (should_exit)
+			return;
+	}
+}
+
+//Runs the callback for a finished read and puts its slot back up for grabs
+void AsyncFileIO::finish_read(const uint32_t slot, const bool success)
+{
+	FileReadRequest request;
+	char* data;
+	uint64_t size;
+	std::chrono::time_point<std::chrono::steady_clock> start;
+	{
+		std::lock_guard<std::mutex> lock(ring_mutex);
+		InFlightRead& read = slots[slot];
+		close(read.fd);
+		request = std::move(read.request);
+		data = read.data;
+		size = read.size;
+		start = read.start;
+		read = InFlightRead();
+		free_slots.push_back(slot);
+	}
+
+	//The file I/O time is the time from submission to completion, since nothing was blocking on it in between
+	const uint32_t hash = ResourceManager::generate_hash_from_string(request.path);
+	const std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+	LoadTelemetry::add_phase_time(hash, LoadPhase::file_io, duration.count());
+	if (!success)
+	{
+		Logger::logf("[ERROR] Failed to read file '%s'!\n", request.path.c_str());
+		dynamic_free(data);
+		request.on_complete(nullptr, 0);
+		return;
+	}
+	LoadTelemetry::add_bytes_read(hash, size);
+	request.on_complete(data, static_cast<int>(size));
+}
+#endif
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "job_system.h"
+
+struct FileReadRequest
+{
+	std::string path;
+	std::function<void(char* data, int size_bytes)> on_complete; //data is nullptr if the read failed, and is owned by the callback otherwise
+};
+
+//Reads whole files asynchronously. On Linux, reads are batched through io_uring so many of them can be in flight at once.
+//If io_uring is not available, or on other platforms, reads go to a small pool of I/O threads instead.
+//Callbacks run on the I/O backend's own threads, so they should only hand the data off
+class AsyncFileIO
+{
+public:
+	AsyncFileIO(int queue_depth = 64, int n_fallback_threads = 4);
+	~AsyncFileIO();
+	void submit_reads(std::vector<FileReadRequest>& requests);
+	bool is_using_io_uring() const { return io_uring_enabled; }
+
+private:
+	void submit_read_fallback(FileReadRequest request);
+	JobSystem* fallback_threads = nullptr;
+	bool io_uring_enabled = false;
+
+#ifdef __linux__
+	struct InFlightRead
+	{
+		FileReadRequest request;
+		int fd = -1;
+		char* data = nullptr;
+		uint64_t size = 0;
+		uint64_t bytes_done = 0;
+		std::chrono::time_point<std::chrono::steady_clock> start;
+	};
+
+	bool init_io_uring(int queue_depth);
+	void shutdown_io_uring();
+	void completion_loop();
+	void queue_read_locked(uint32_t slot);
+	void submit_queued_locked();
+	void finish_read(uint32_t slot, bool success);
+
+	int ring_fd = -1;
+	uint32_t sq_entries = 0;
+	void* sq_ring = nullptr;
+	void* cq_ring = nullptr;
+	size_t sq_ring_size = 0;
+	size_t cq_ring_size = 0;
+	struct io_uring_sqe* sqes = nullptr;
+	std::atomic<uint32_t>* sq_head = nullptr;
+	std::atomic<uint32_t>* sq_tail = nullptr;
+	uint32_t* sq_mask = nullptr;
+	uint32_t* sq_array = nullptr;
+	std::atomic<uint32_t>* cq_head = nullptr;
+	std::atomic<uint32_t>* cq_tail = nullptr;
+	uint32_t* cq_mask = nullptr;
+	struct io_uring_cqe* cqes = nullptr;
+
+	//Slots for reads in flight, and reads waiting for room in the submission queue
+	std::vector<InFlightRead> slots;
+	std::vector<uint32_t> free_slots;
+	std::vector<uint32_t> waiting_slots;
+	uint32_t n_in_kernel = 0;
+	uint32_t n_unsubmitted = 0;
+	std::mutex ring_mutex;
+	std::thread completion_thread;
+	bool shutting_down = false;
+#endif
+};
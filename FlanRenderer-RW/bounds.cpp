@@ -0,0 +1,177 @@
+#include "bounds.h"
+
+#include <cmath>
+#include <immintrin.h>
+#include <glm/geometric.hpp>
+
+#include "renderer_structs.h"
+
+//Picks the smaller of the given sphere and the sphere around the box's corners. Both contain everything the box does
+static void use_tighter_sphere(Bounds& bounds, const glm::vec3& center, const float radius)
+{
+	const float box_radius = glm::length(bounds.max - bounds.min) * 0.5f;
+	if (box_radius < radius)
+	{
+		bounds.center = (bounds.min + bounds.max) * 0.5f;
+		bounds.radius = box_radius;
+	}
+	else
+	{
+		bounds.center = center;
+		bounds.radius = radius;
+	}
+}
+
+//Finds the box with SSE, one vertex per register, then the sphere around the box's center that reaches the farthest vertex.
+//That sphere is usually a lot tighter than the one through the box's corners
+Bounds BoundingVolumes::compute_bounds(const Vertex* vertices, const int n_vertices)
+{
+	Bounds bounds{};
+	if (n_vertices <= 0)
+		return bounds;
+
+	//Loading a position as 4 floats also picks up the normal's x, which ends up in the 4th lane and is ignored.
+	//Two sets of accumulators so the min and max of consecutive vertices don't wait on each other
+	__m128 min_a = _mm_loadu_ps(&vertices[0].position.x);
+	__m128 max_a = min_a;
+	__m128 min_b = min_a;
+	__m128 max_b = min_a;
+	int i = 1;
+	for (; i + 2 <= n_vertices; i += 2)
+	{
+		const __m128 position_a = _mm_loadu_ps(&vertices[i + 0].position.x);
+		const __m128 position_b = _mm_loadu_ps(&vertices[i + 1].position.x);
+		min_a = _mm_min_ps(min_a, position_a);
+		max_a = _mm_max_ps(max_a, position_a);
+		min_b = _mm_min_ps(min_b, position_b);
+		max_b = _mm_max_ps(max_b, position_b);
+	}
+	if (i < n_vertices)
+	{
+		const __m128 position = _mm_loadu_ps(&vertices[i].position.x);
+		min_a = _mm_min_ps(min_a, position);
+		max_a = _mm_max_ps(max_a, position);
+	}
+	float min_values[4];
+	float max_values[4];
+	_mm_storeu_ps(min_values, _mm_min_ps(min_a, min_b));
+	_mm_storeu_ps(max_values, _mm_max_ps(max_a, max_b));
+	bounds.min = glm::vec3(min_values[0], min_values[1], min_values[2]);
+	bounds.max = glm::vec3(max_values[0], max_values[1], max_values[2]);
+	const glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+
+	//Squared distances of 4 vertices at a time, transposed to one register per axis
+	const __m128 center_x = _mm_set1_ps(center.x);
+	const __m128 center_y = _mm_set1_ps(center.y);
+	const __m128 center_z = _mm_set1_ps(center.z);
+	__m128 max_distance_squared = _mm_setzero_ps();
+	i = 0;
+	for (; i + 4 <= n_vertices; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&vertices[i + 0].position.x);
+		__m128 y = _mm_loadu_ps(&vertices[i + 1].position.x);
+		__m128 z = _mm_loadu_ps(&vertices[i + 2].position.x);
+		__m128 unused = _mm_loadu_ps(&vertices[i + 3].position.x);
+		_MM_TRANSPOSE4_PS(x, y, z, unused);
+		const __m128 delta_x = _mm_sub_ps(x, center_x);
+		const __m128 delta_y = _mm_sub_ps(y, center_y);
+		const __m128 delta_z = _mm_sub_ps(z, center_z);
+		const __m128 distance_squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(delta_x, delta_x), _mm_mul_ps(delta_y, delta_y)), _mm_mul_ps(delta_z, delta_z));
+		max_distance_squared = _mm_max_ps(max_distance_squared, distance_squared);
+	}
+	float distances_squared[4];
+	_mm_storeu_ps(distances_squared, max_distance_squared);
+	float radius_squared = fmaxf(fmaxf(distances_squared[0], distances_squared[1]), fmaxf(distances_squared[2], distances_squared[3]));
+	for (; i < n_vertices; i++)
+	{
+		const glm::vec3 delta = vertices[i].position - center;
+		radius_squared = fmaxf(radius_squared, glm::dot(delta, delta));
+	}
+	use_tighter_sphere(bounds, center, sqrtf(radius_squared));
+	return bounds;
+}
+
+//Box of the transformed box (Arvo's method), and the transformed sphere scaled by how far the matrix can stretch it
+Bounds BoundingVolumes::transform_bounds(const Bounds& bounds, const glm::mat4& matrix)
+{
+	if (bounds.radius < 0.0f)
+		return bounds;
+
+	Bounds transformed{};
+	transformed.min = glm::vec3(matrix[3]);
+	transformed.max = glm::vec3(matrix[3]);
+	for (int column = 0; column < 3; column++)
+	{
+		for (int row = 0; row < 3; row++)
+		{
+			const float from_min = matrix[column][row] * bounds.min[column];
+			const float from_max = matrix[column][row] * bounds.max[column];
+			transformed.min[row] += fminf(from_min, from_max);
+			transformed.max[row] += fmaxf(from_min, from_max);
+		}
+	}
+
+	//The longest axis is how far the matrix stretches anything, as long as the axes are perpendicular. With shear it can stretch further,
+	//so use the Frobenius norm instead, which is never smaller
+	const glm::vec3 axis_x = glm::vec3(matrix[0]);
+	const glm::vec3 axis_y = glm::vec3(matrix[1]);
+	const glm::vec3 axis_z = glm::vec3(matrix[2]);
+	const float length_x = glm::dot(axis_x, axis_x);
+	const float length_y = glm::dot(axis_y, axis_y);
+	const float length_z = glm::dot(axis_z, axis_z);
+	float scale_squared = fmaxf(fmaxf(length_x, length_y), length_z);
+	if (fabsf(glm::dot(axis_x, axis_y)) + fabsf(glm::dot(axis_x, axis_z)) + fabsf(glm::dot(axis_y, axis_z)) > scale_squared * 1e-4f)
+		scale_squared = length_x + length_y + length_z;
+	use_tighter_sphere(transformed, glm::vec3(matrix * glm::vec4(bounds.center, 1.0f)), bounds.radius * sqrtf(scale_squared));
+	return transformed;
+}
+
+Bounds BoundingVolumes::merge_bounds(const Bounds& lhs, const Bounds& rhs)
+{
+	if (lhs.radius < 0.0f)
+		return rhs;
+	if (rhs.radius < 0.0f)
+		return lhs;
+
+	Bounds merged{};
+	merged.min = glm::min(lhs.min, rhs.min);
+	merged.max = glm::max(lhs.max, rhs.max);
+
+	//Smallest sphere around both spheres
+	const glm::vec3 offset = rhs.center - lhs.center;
+	const float distance = glm::length(offset);
+	if (distance + rhs.radius <= lhs.radius)
+		use_tighter_sphere(merged, lhs.center, lhs.radius);
+	else if (distance + lhs.radius <= rhs.radius)
+		use_tighter_sphere(merged, rhs.center, rhs.radius);
+	else
+	{
+		const float radius = (distance + lhs.radius + rhs.radius) * 0.5f;
+		use_tighter_sphere(merged, lhs.center + offset * ((radius - lhs.radius) / distance), radius);
+	}
+	return merged;
+}
+
+//Tests the sphere first since it's cheaper, then the box corner that is farthest along each plane's normal.
+//The planes should be in the same space as the bounds, and point inwards like the ones from Meshlets::extract_frustum_planes
+bool BoundingVolumes::is_visible(const Bounds& bounds, const glm::vec4 planes[6])
+{
+	if (bounds.radius < 0.0f)
+		return false;
+
+	for (int i = 0; i < 6; i++)
+	{
+		const glm::vec3 normal = glm::vec3(planes[i]);
+		if (glm::dot(normal, bounds.center) + planes[i].w < -bounds.radius)
+			return false;
+		const glm::vec3 farthest_corner
+		{
+			normal.x >= 0.0f ? bounds.max.x : bounds.min.x,
+			normal.y >= 0.0f ? bounds.max.y : bounds.min.y,
+			normal.z >= 0.0f ? bounds.max.z : bounds.min.z,
+		};
+		if (glm::dot(normal, farthest_corner) + planes[i].w < 0.0f)
+			return false;
+	}
+	return true;
+}
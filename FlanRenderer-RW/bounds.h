@@ -0,0 +1,16 @@
+#pragma once
+#include <glm/mat4x4.hpp>
+#include <glm/vec4.hpp>
+
+struct Vertex;
+struct Bounds;
+
+//Builds and combines bounding boxes and spheres, and tests them against the view frustum
+class BoundingVolumes
+{
+public:
+	static Bounds compute_bounds(const Vertex* vertices, int n_vertices);
+	static Bounds transform_bounds(const Bounds& bounds, const glm::mat4& matrix);
+	static Bounds merge_bounds(const Bounds& lhs, const Bounds& rhs);
+	static bool is_visible(const Bounds& bounds, const glm::vec4 planes[6]);
+};
@@ -0,0 +1,622 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <immintrin.h>
+#include <glm/common.hpp>
+
+#include "renderer_structs.h"
+
+static float surface_area(const glm::vec3& min, const glm::vec3& max)
+{
+	const glm::vec3 size = glm::max(max - min, glm::vec3(0.0f));
+	return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static void clear_node(BvhNode& node)
+{
+	for (int slot = 0; slot < 4; slot++)
+	{
+		node.min_x[slot] = FLT_MAX;
+		node.min_y[slot] = FLT_MAX;
+		node.min_z[slot] = FLT_MAX;
+		node.max_x[slot] = -FLT_MAX;
+		node.max_y[slot] = -FLT_MAX;
+		node.max_z[slot] = -FLT_MAX;
+		node.children[slot] = -1;
+		node.counts[slot] = 0;
+	}
+}
+
+static void set_child_bounds(BvhNode& node, const int slot, const glm::vec3& min, const glm::vec3& max)
+{
+	node.min_x[slot] = min.x;
+	node.min_y[slot] = min.y;
+	node.min_z[slot] = min.z;
+	node.max_x[slot] = max.x;
+	node.max_y[slot] = max.y;
+	node.max_z[slot] = max.z;
+}
+
+static bool is_box_outside_frustum(const glm::vec3& min, const glm::vec3& max, const glm::vec4 planes[6])
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const glm::vec3 farthest_corner
+		{
+			planes[i].x >= 0.0f ? max.x : min.x,
+			planes[i].y >= 0.0f ? max.y : min.y,
+			planes[i].z >= 0.0f ? max.z : min.z,
+		};
+		if (planes[i].x * farthest_corner.x + planes[i].y * farthest_corner.y + planes[i].z * farthest_corner.z + planes[i].w < 0.0f)
+			return true;
+	}
+	return false;
+}
+
+//Slab test, returns the distance the ray enters the box at, or a negative value if it misses the box or hits it after max_distance
+static float intersect_ray_box(const glm::vec3& origin, const glm::vec3& inverse_direction, const float max_distance, const glm::vec3& min, const glm::vec3& max)
+{
+	const glm::vec3 t_min = (min - origin) * inverse_direction;
+	const glm::vec3 t_max = (max - origin) * inverse_direction;
+	const glm::vec3 t_near = glm::min(t_min, t_max);
+	const glm::vec3 t_far = glm::max(t_min, t_max);
+	const float enter = glm::max(glm::max(t_near.x, t_near.y), glm::max(t_near.z, 0.0f));
+	const float exit = glm::min(glm::min(t_far.x, t_far.y), glm::min(t_far.z, max_distance));
+	return enter <= exit ? enter : -1.0f;
+}
+
+int Bvh::add_object(const Bounds& bounds, const uint32_t user_data)
+{
+	int object_id;
+	if (!free_objects.empty())
+	{
+		object_id = free_objects.back();
+		free_objects.pop_back();
+	}
+	else
+	{
+		object_id = static_cast<int>(objects.size());
+		objects.emplace_back();
+	}
+	objects[object_id] = { bounds.min, bounds.max, user_data, true };
+	n_live_objects++;
+	needs_rebuild = true;
+	return object_id;
+}
+
+void Bvh::remove_object(const int object_id)
+{
+	if (object_id < 0 || object_id >= static_cast<int>(objects.size()) || !objects[object_id].is_alive)
+		return;
+	objects[object_id].is_alive = false;
+	free_objects.push_back(object_id);
+	n_live_objects--;
+	needs_rebuild = true;
+}
+
+void Bvh::move_object(const int object_id, const Bounds& bounds)
+{
+	if (object_id < 0 || object_id >= static_cast<int>(objects.size()) || !objects[object_id].is_alive)
+		return;
+	objects[object_id].min = bounds.min;
+	objects[object_id].max = bounds.max;
+	needs_refit = true;
+}
+
+//Brings the tree up to date with every change since the last update. Call this once per frame, before querying
+void Bvh::update()
+{
+	if (needs_rebuild)
+	{
+		build();
+		return;
+	}
+	if (needs_refit)
+	{
+		refit();
+		if (calculate_cost() > built_cost * rebuild_cost_ratio)
+			build();
+	}
+}
+
+void Bvh::build()
+{
+	nodes.clear();
+	leaf_objects.clear();
+	needs_rebuild = false;
+	needs_refit = false;
+	for (int i = 0; i < static_cast<int>(objects.size()); i++)
+	{
+		if (objects[i].is_alive)
+			leaf_objects.push_back(i);
+	}
+	if (leaf_objects.empty())
+	{
+		built_cost = 0.0f;
+		return;
+	}
+
+	std::vector<BuildNode> build_nodes;
+	build_nodes.reserve(leaf_objects.size() * 2 / max_leaf_size + 1);
+	build_binary(build_nodes);
+	collapse(build_nodes);
+	built_cost = calculate_cost();
+}
+
+//Splits the objects in two with binned SAH until every node is small enough to be a leaf. Uses a work list instead of recursion,
+//since badly distributed objects can make the tree very deep
+void Bvh::build_binary(std::vector<BuildNode>& build_nodes)
+{
+	struct Bin
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		int count;
+	};
+	const int bin_count = glm::clamp(n_bins, 2, 64);
+	Bin bins[64];
+	float right_costs[64];
+
+	build_nodes.push_back({ glm::vec3(0.0f), glm::vec3(0.0f), -1, -1, 0, static_cast<int>(leaf_objects.size()) });
+	std::vector<int> work_list{ 0 };
+	while (!work_list.empty())
+	{
+		const int node_index = work_list.back();
+		work_list.pop_back();
+		const int first = build_nodes[node_index].first;
+		const int count = build_nodes[node_index].count;
+
+		//Box of the objects, and box of their centers to place the bins in
+		glm::vec3 min(FLT_MAX);
+		glm::vec3 max(-FLT_MAX);
+		glm::vec3 centroid_min(FLT_MAX);
+		glm::vec3 centroid_max(-FLT_MAX);
+		for (int i = first; i < first + count; i++)
+		{
+			const Object& object = objects[leaf_objects[i]];
+			min = glm::min(min, object.min);
+			max = glm::max(max, object.max);
+			centroid_min = glm::min(centroid_min, (object.min + object.max) * 0.5f);
+			centroid_max = glm::max(centroid_max, (object.min + object.max) * 0.5f);
+		}
+		build_nodes[node_index].min = min;
+		build_nodes[node_index].max = max;
+		if (count <= max_leaf_size)
+			continue;
+
+		//Try every bin boundary on every axis, and keep the one where the halves' area times object count adds up the lowest
+		float best_cost = FLT_MAX;
+		int best_axis = -1;
+		int best_split = 0;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			const float extent = centroid_max[axis] - centroid_min[axis];
+			if (extent <= 0.0f)
+				continue;
+			const float bin_scale = static_cast<float>(bin_count) / extent;
+			for (int bin = 0; bin < bin_count; bin++)
+				bins[bin] = { glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX), 0 };
+			for (int i = first; i < first + count; i++)
+			{
+				const Object& object = objects[leaf_objects[i]];
+				const float centroid = (object.min[axis] + object.max[axis]) * 0.5f;
+				Bin& bin = bins[glm::min(static_cast<int>((centroid - centroid_min[axis]) * bin_scale), bin_count - 1)];
+				bin.min = glm::min(bin.min, object.min);
+				bin.max = glm::max(bin.max, object.max);
+				bin.count++;
+			}
+
+			glm::vec3 side_min(FLT_MAX);
+			glm::vec3 side_max(-FLT_MAX);
+			int side_count = 0;
+			for (int bin = bin_count - 1; bin > 0; bin--)
+			{
+				side_min = glm::min(side_min, bins[bin].min);
+				side_max = glm::max(side_max, bins[bin].max);
+				side_count += bins[bin].count;
+				right_costs[bin] = side_count > 0 ? surface_area(side_min, side_max) * static_cast<float>(side_count) : 0.0f;
+			}
+			side_min = glm::vec3(FLT_MAX);
+			side_max = glm::vec3(-FLT_MAX);
+			side_count = 0;
+			for (int bin = 0; bin < bin_count - 1; bin++)
+			{
+				side_min = glm::min(side_min, bins[bin].min);
+				side_max = glm::max(side_max, bins[bin].max);
+				side_count += bins[bin].count;
+				const float cost = (side_count > 0 ? surface_area(side_min, side_max) * static_cast<float>(side_count) : 0.0f) + right_costs[bin + 1];
+				if (side_count > 0 && side_count < count && cost < best_cost)
+				{
+					best_cost = cost;
+					best_axis = axis;
+					best_split = bin;
+				}
+			}
+		}
+
+		//If every object has the same center, there's nothing to split on, so just split the list in half
+		int middle = first + count / 2;
+		if (best_axis != -1)
+		{
+			const float bin_scale = static_cast<float>(bin_count) / (centroid_max[best_axis] - centroid_min[best_axis]);
+			const auto is_left = [&](const int object_index)
+			{
+				const Object& object = objects[object_index];
+				const float centroid = (object.min[best_axis] + object.max[best_axis]) * 0.5f;
+				return glm::min(static_cast<int>((centroid - centroid_min[best_axis]) * bin_scale), bin_count - 1) <= best_split;
+			};
+			middle = static_cast<int>(std::partition(leaf_objects.begin() + first, leaf_objects.begin() + first + count, is_left) - leaf_objects.begin());
+		}
+
+		const int left = static_cast<int>(build_nodes.size());
+		build_nodes.push_back({ glm::vec3(0.0f), glm::vec3(0.0f), -1, -1, first, middle - first });
+		build_nodes.push_back({ glm::vec3(0.0f), glm::vec3(0.0f), -1, -1, middle, first + count - middle });
+		build_nodes[node_index].left = left;
+		build_nodes[node_index].right = left + 1;
+		work_list.push_back(left);
+		work_list.push_back(left + 1);
+	}
+}
+
+//Turns the binary tree into one with four children per node, by repeatedly opening up the child with the largest surface area.
+//Nodes are created before their children, which is the order refit relies on
+void Bvh::collapse(const std::vector<BuildNode>& build_nodes)
+{
+	struct WorkItem
+	{
+		int build_node;
+		int parent;
+		int parent_slot;
+	};
+	std::vector<WorkItem> work_list{ { 0, -1, 0 } };
+	while (!work_list.empty())
+	{
+		const WorkItem item = work_list.back();
+		work_list.pop_back();
+
+		const int node_index = static_cast<int>(nodes.size());
+		nodes.emplace_back();
+		clear_node(nodes[node_index]);
+		if (item.parent != -1)
+			nodes[item.parent].children[item.parent_slot] = node_index;
+
+		//A root that is a leaf becomes a node with a single leaf child
+		int n_children = 1;
+		int children[4] = { item.build_node };
+		if (build_nodes[item.build_node].left != -1)
+		{
+			children[0] = build_nodes[item.build_node].left;
+			children[1] = build_nodes[item.build_node].right;
+			n_children = 2;
+		}
+		while (n_children < 4)
+		{
+			int best_child = -1;
+			float best_area = -1.0f;
+			for (int i = 0; i < n_children; i++)
+			{
+				const BuildNode& child = build_nodes[children[i]];
+				const float area = surface_area(child.min, child.max);
+				if (child.left != -1 && area > best_area)
+				{
+					best_area = area;
+					best_child = i;
+				}
+			}
+			if (best_child == -1)
+				break;
+			const BuildNode& opened = build_nodes[children[best_child]];
+			children[best_child] = opened.left;
+			children[n_children++] = opened.right;
+		}
+
+		for (int slot = 0; slot < n_children; slot++)
+		{
+			const BuildNode& child = build_nodes[children[slot]];
+			set_child_bounds(nodes[node_index], slot, child.min, child.max);
+			if (child.left == -1)
+			{
+				nodes[node_index].children[slot] = child.first;
+				nodes[node_index].counts[slot] = static_cast<uint32_t>(child.count);
+			}
+			else
+			{
+				work_list.push_back({ children[slot], node_index, slot });
+			}
+		}
+	}
+}
+
+//Recomputes every box from the objects up, without changing the tree itself
+void Bvh::refit()
+{
+	needs_refit = false;
+	for (int node_index = static_cast<int>(nodes.size()) - 1; node_index >= 0; node_index--)
+	{
+		BvhNode& node = nodes[node_index];
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.children[slot] < 0)
+				continue;
+
+			glm::vec3 min(FLT_MAX);
+			glm::vec3 max(-FLT_MAX);
+			if (node.counts[slot] > 0)
+			{
+				for (uint32_t i = 0; i < node.counts[slot]; i++)
+				{
+					const Object& object = objects[leaf_objects[node.children[slot] + i]];
+					min = glm::min(min, object.min);
+					max = glm::max(max, object.max);
+				}
+			}
+			else
+			{
+				const BvhNode& child = nodes[node.children[slot]];
+				for (int child_slot = 0; child_slot < 4; child_slot++)
+				{
+					if (child.children[child_slot] < 0)
+						continue;
+					min = glm::min(min, glm::vec3(child.min_x[child_slot], child.min_y[child_slot], child.min_z[child_slot]));
+					max = glm::max(max, glm::vec3(child.max_x[child_slot], child.max_y[child_slot], child.max_z[child_slot]));
+				}
+			}
+			set_child_bounds(node, slot, min, max);
+		}
+	}
+}
+
+//SAH cost of the whole tree relative to the root's area. Only used to notice when refitting has made the tree a lot worse
+float Bvh::calculate_cost() const
+{
+	if (nodes.empty())
+		return 0.0f;
+
+	float cost = 0.0f;
+	glm::vec3 root_min(FLT_MAX);
+	glm::vec3 root_max(-FLT_MAX);
+	for (size_t node_index = 0; node_index < nodes.size(); node_index++)
+	{
+		const BvhNode& node = nodes[node_index];
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.children[slot] < 0)
+				continue;
+			const glm::vec3 min(node.min_x[slot], node.min_y[slot], node.min_z[slot]);
+			const glm::vec3 max(node.max_x[slot], node.max_y[slot], node.max_z[slot]);
+			const float area = surface_area(min, max);
+			cost += node.counts[slot] > 0 ? area * static_cast<float>(node.counts[slot]) : area;
+			if (node_index == 0)
+			{
+				root_min = glm::min(root_min, min);
+				root_max = glm::max(root_max, max);
+			}
+		}
+	}
+	return cost / glm::max(surface_area(root_min, root_max), FLT_MIN);
+}
+
+//Finds every object whose box is at least partly inside the frustum. The planes point inwards, like the ones from
+//Meshlets::extract_frustum_planes. Children that are completely inside get added without testing anything below them
+void Bvh::query_frustum(const glm::vec4 planes[6], std::vector<uint32_t>& results_out) const
+{
+	if (nodes.empty())
+		return;
+
+	__m128 plane_x[6];
+	__m128 plane_y[6];
+	__m128 plane_z[6];
+	__m128 plane_w[6];
+	for (int i = 0; i < 6; i++)
+	{
+		plane_x[i] = _mm_set1_ps(planes[i].x);
+		plane_y[i] = _mm_set1_ps(planes[i].y);
+		plane_z[i] = _mm_set1_ps(planes[i].z);
+		plane_w[i] = _mm_set1_ps(planes[i].w);
+	}
+
+	std::vector<int> stack{ 0 };
+	while (!stack.empty())
+	{
+		const BvhNode& node = nodes[stack.back()];
+		stack.pop_back();
+		const __m128 min_x = _mm_load_ps(node.min_x);
+		const __m128 min_y = _mm_load_ps(node.min_y);
+		const __m128 min_z = _mm_load_ps(node.min_z);
+		const __m128 max_x = _mm_load_ps(node.max_x);
+		const __m128 max_y = _mm_load_ps(node.max_y);
+		const __m128 max_z = _mm_load_ps(node.max_z);
+
+		//The box corner farthest along a plane's normal being behind it means the box is outside. The nearest corner being behind it
+		//means the box crosses that plane
+		__m128 outside = _mm_setzero_ps();
+		__m128 crossing = _mm_setzero_ps();
+		for (int i = 0; i < 6; i++)
+		{
+			const __m128 x_min = _mm_mul_ps(plane_x[i], min_x);
+			const __m128 x_max = _mm_mul_ps(plane_x[i], max_x);
+			const __m128 y_min = _mm_mul_ps(plane_y[i], min_y);
+			const __m128 y_max = _mm_mul_ps(plane_y[i], max_y);
+			const __m128 z_min = _mm_mul_ps(plane_z[i], min_z);
+			const __m128 z_max = _mm_mul_ps(plane_z[i], max_z);
+			const __m128 farthest = _mm_add_ps(_mm_add_ps(_mm_max_ps(x_min, x_max), _mm_max_ps(y_min, y_max)), _mm_add_ps(_mm_max_ps(z_min, z_max), plane_w[i]));
+			const __m128 nearest = _mm_add_ps(_mm_add_ps(_mm_min_ps(x_min, x_max), _mm_min_ps(y_min, y_max)), _mm_add_ps(_mm_min_ps(z_min, z_max), plane_w[i]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(farthest, _mm_setzero_ps()));
+			crossing = _mm_or_ps(crossing, _mm_cmplt_ps(nearest, _mm_setzero_ps()));
+		}
+		const int outside_mask = _mm_movemask_ps(outside);
+		const int crossing_mask = _mm_movemask_ps(crossing);
+
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.children[slot] < 0 || (outside_mask & (1 << slot)) != 0)
+				continue;
+			const bool is_fully_inside = (crossing_mask & (1 << slot)) == 0;
+			if (node.counts[slot] > 0)
+			{
+				for (uint32_t i = 0; i < node.counts[slot]; i++)
+				{
+					const Object& object = objects[leaf_objects[node.children[slot] + i]];
+					if (is_fully_inside || !is_box_outside_frustum(object.min, object.max, planes))
+						results_out.push_back(object.user_data);
+				}
+			}
+			else if (is_fully_inside)
+				add_subtree(node.children[slot], results_out);
+			else
+				stack.push_back(node.children[slot]);
+		}
+	}
+}
+
+//Finds every object whose box overlaps the given box
+void Bvh::query_overlap(const glm::vec3& min, const glm::vec3& max, std::vector<uint32_t>& results_out) const
+{
+	if (nodes.empty())
+		return;
+
+	const __m128 query_min_x = _mm_set1_ps(min.x);
+	const __m128 query_min_y = _mm_set1_ps(min.y);
+	const __m128 query_min_z = _mm_set1_ps(min.z);
+	const __m128 query_max_x = _mm_set1_ps(max.x);
+	const __m128 query_max_y = _mm_set1_ps(max.y);
+	const __m128 query_max_z = _mm_set1_ps(max.z);
+
+	std::vector<int> stack{ 0 };
+	while (!stack.empty())
+	{
+		const BvhNode& node = nodes[stack.back()];
+		stack.pop_back();
+		__m128 overlap = _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.min_x), query_max_x), _mm_cmpge_ps(_mm_load_ps(node.max_x), query_min_x));
+		overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.min_y), query_max_y), _mm_cmpge_ps(_mm_load_ps(node.max_y), query_min_y)));
+		overlap = _mm_and_ps(overlap, _mm_and_ps(_mm_cmple_ps(_mm_load_ps(node.min_z), query_max_z), _mm_cmpge_ps(_mm_load_ps(node.max_z), query_min_z)));
+		const int overlap_mask = _mm_movemask_ps(overlap);
+
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.children[slot] < 0 || (overlap_mask & (1 << slot)) == 0)
+				continue;
+			if (node.counts[slot] == 0)
+			{
+				stack.push_back(node.children[slot]);
+				continue;
+			}
+			for (uint32_t i = 0; i < node.counts[slot]; i++)
+			{
+				const Object& object = objects[leaf_objects[node.children[slot] + i]];
+				if (glm::all(glm::lessThanEqual(object.min, max)) && glm::all(glm::greaterThanEqual(object.max, min)))
+					results_out.push_back(object.user_data);
+			}
+		}
+	}
+}
+
+//Finds the closest object along the ray. Without a hit test that's the closest box. With one, every object whose box the ray enters
+//before the closest hit so far gets passed to it along with the distance to its box, and it returns whether the ray really hits the
+//object, and can move the distance further out to where it does
+bool Bvh::raycast(const glm::vec3& origin, const glm::vec3& direction, const float max_distance, uint32_t& user_data_out, float& distance_out, const std::function<bool(uint32_t user_data, float& distance)>& hit_test) const
+{
+	if (nodes.empty())
+		return false;
+
+	//Axis aligned rays would divide by zero, so nudge them a tiny bit instead
+	glm::vec3 inverse_direction;
+	for (int axis = 0; axis < 3; axis++)
+	{
+		const float component = fabsf(direction[axis]) > 1e-20f ? direction[axis] : (direction[axis] < 0.0f ? -1e-20f : 1e-20f);
+		inverse_direction[axis] = 1.0f / component;
+	}
+	const __m128 origin_x = _mm_set1_ps(origin.x);
+	const __m128 origin_y = _mm_set1_ps(origin.y);
+	const __m128 origin_z = _mm_set1_ps(origin.z);
+	const __m128 inverse_x = _mm_set1_ps(inverse_direction.x);
+	const __m128 inverse_y = _mm_set1_ps(inverse_direction.y);
+	const __m128 inverse_z = _mm_set1_ps(inverse_direction.z);
+
+	struct StackEntry
+	{
+		int node;
+		float distance;
+	};
+	std::vector<StackEntry> stack{ { 0, 0.0f } };
+	float closest_distance = max_distance;
+	bool has_hit = false;
+	while (!stack.empty())
+	{
+		const StackEntry entry = stack.back();
+		stack.pop_back();
+		if (entry.distance > closest_distance)
+			continue;
+
+		const BvhNode& node = nodes[entry.node];
+		const __m128 t_min_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_x), origin_x), inverse_x);
+		const __m128 t_max_x = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_x), origin_x), inverse_x);
+		const __m128 t_min_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_y), origin_y), inverse_y);
+		const __m128 t_max_y = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_y), origin_y), inverse_y);
+		const __m128 t_min_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.min_z), origin_z), inverse_z);
+		const __m128 t_max_z = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.max_z), origin_z), inverse_z);
+		const __m128 enter = _mm_max_ps(_mm_max_ps(_mm_min_ps(t_min_x, t_max_x), _mm_min_ps(t_min_y, t_max_y)), _mm_max_ps(_mm_min_ps(t_min_z, t_max_z), _mm_setzero_ps()));
+		const __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t_min_x, t_max_x), _mm_max_ps(t_min_y, t_max_y)), _mm_min_ps(_mm_max_ps(t_min_z, t_max_z), _mm_set1_ps(closest_distance)));
+		const int hit_mask = _mm_movemask_ps(_mm_cmple_ps(enter, exit));
+		float enter_distances[4];
+		_mm_storeu_ps(enter_distances, enter);
+
+		//Push the children that were hit furthest first, so the nearest one gets visited next and can shorten the ray early
+		StackEntry hit_children[4];
+		int n_hit_children = 0;
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.children[slot] < 0 || (hit_mask & (1 << slot)) == 0)
+				continue;
+			if (node.counts[slot] == 0)
+			{
+				hit_children[n_hit_children++] = { node.children[slot], enter_distances[slot] };
+				continue;
+			}
+			for (uint32_t i = 0; i < node.counts[slot]; i++)
+			{
+				const Object& object = objects[leaf_objects[node.children[slot] + i]];
+				float distance = intersect_ray_box(origin, inverse_direction, closest_distance, object.min, object.max);
+				if (distance < 0.0f)
+					continue;
+				if (hit_test && !hit_test(object.user_data, distance))
+					continue;
+				if (distance <= closest_distance)
+				{
+					closest_distance = distance;
+					user_data_out = object.user_data;
+					has_hit = true;
+				}
+			}
+		}
+		std::sort(hit_children, hit_children + n_hit_children, [](const StackEntry& lhs, const StackEntry& rhs) { return lhs.distance > rhs.distance; });
+		stack.insert(stack.end(), hit_children, hit_children + n_hit_children);
+	}
+
+	if (has_hit)
+		distance_out = closest_distance;
+	return has_hit;
+}
+
+void Bvh::add_subtree(const int node_index, std::vector<uint32_t>& results_out) const
+{
+	std::vector<int> stack{ node_index };
+	while (!stack.empty())
+	{
+		const BvhNode& node = nodes[stack.back()];
+		stack.pop_back();
+		for (int slot = 0; slot < 4; slot++)
+		{
+			if (node.children[slot] < 0)
+				continue;
+			if (node.counts[slot] == 0)
+			{
+				stack.push_back(node.children[slot]);
+				continue;
+			}
+			for (uint32_t i = 0; i < node.counts[slot]; i++)
+				results_out.push_back(objects[leaf_objects[node.children[slot] + i]].user_data);
+		}
+	}
+}
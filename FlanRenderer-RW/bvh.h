@@ -0,0 +1,80 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+struct Bounds;
+
+//Four children per node, with their boxes stored per axis, so one SSE instruction tests a plane or a ray slab against all four at once.
+//A child is either another node, or a leaf holding a range of objects. Unused slots have inverted boxes, which never pass a test
+struct alignas(16) BvhNode
+{
+	float min_x[4];
+	float min_y[4];
+	float min_z[4];
+	float max_x[4];
+	float max_y[4];
+	float max_z[4];
+	int32_t children[4];	//Node index for inner children, index of the first object in the leaf list for leaves, -1 if unused
+	uint32_t counts[4];		//Number of objects for leaves, 0 for inner children and unused slots
+};
+
+//Bounding volume hierarchy over objects with boxes, like the entities in a scene. Built with binned SAH, and refit instead of rebuilt
+//when objects only move. Adding or removing objects, or moving them so far that the tree gets a lot worse, triggers a full rebuild
+class Bvh
+{
+public:
+	int add_object(const Bounds& bounds, uint32_t user_data);
+	void remove_object(int object_id);
+	void move_object(int object_id, const Bounds& bounds);
+	void update();
+	void build();
+	void refit();
+
+	void query_frustum(const glm::vec4 planes[6], std::vector<uint32_t>& results_out) const;
+	void query_overlap(const glm::vec3& min, const glm::vec3& max, std::vector<uint32_t>& results_out) const;
+	bool raycast(const glm::vec3& origin, const glm::vec3& direction, float max_distance, uint32_t& user_data_out, float& distance_out, const std::function<bool(uint32_t user_data, float& distance)>& hit_test = nullptr) const;
+
+	int get_n_objects() const { return n_live_objects; }
+	int get_n_nodes() const { return static_cast<int>(nodes.size()); }
+
+	inline static int max_leaf_size = 4;
+	inline static int n_bins = 16;
+	inline static float rebuild_cost_ratio = 1.5f;	//Rebuild instead of refitting once the tree is this much worse than right after building
+
+private:
+	struct Object
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		uint32_t user_data;
+		bool is_alive;
+	};
+
+	//Binary node, only used while building before the tree gets collapsed to four children per node
+	struct BuildNode
+	{
+		glm::vec3 min;
+		glm::vec3 max;
+		int left;
+		int right;
+		int first;
+		int count;
+	};
+
+	void build_binary(std::vector<BuildNode>& build_nodes);
+	void collapse(const std::vector<BuildNode>& build_nodes);
+	void add_subtree(int node_index, std::vector<uint32_t>& results_out) const;
+	float calculate_cost() const;
+
+	std::vector<Object> objects;
+	std::vector<int> free_objects;
+	std::vector<int> leaf_objects;	//Object indices, leaves point at ranges of this
+	std::vector<BvhNode> nodes;		//The root is the first node, and parents always come before their children, so refitting can go backwards
+	int n_live_objects = 0;
+	float built_cost = 0.0f;
+	bool needs_rebuild = false;
+	bool needs_refit = false;
+};
@@ -0,0 +1,361 @@
+#include "compression.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "resource_manager.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//Block format: a sequence of (token, literals, match) triplets. The token holds the literal length in its high 4 bits and the match length
+//minus 4 in its low 4 bits, with 15 meaning more length bytes follow. Matches are stored as a 16-bit little endian offset back into the
+//output. The last sequence only has literals
+constexpr uint32_t min_match = 4;
+constexpr uint32_t last_literals = 5;		//The last bytes of a block are always literals,
+constexpr uint32_t match_find_limit = 12;	//and matches don't start this close to the end, which keeps the decoder's bounds checks simple
+constexpr uint32_t max_offset = 65535;
+constexpr uint32_t hash_log = 14;
+
+static uint32_t read_u32(const uint8_t* pointer)
+{
+	uint32_t value;
+	memcpy(&value, pointer, sizeof(value));
+	return value;
+}
+
+static uint64_t read_u64(const uint8_t* pointer)
+{
+	uint64_t value;
+	memcpy(&value, pointer, sizeof(value));
+	return value;
+}
+
+static uint32_t hash_sequence(const uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - hash_log);
+}
+
+static uint32_t count_trailing_zeros(const uint64_t value)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward64(&index, value);
+	return static_cast<uint32_t>(index);
+#else
+	return static_cast<uint32_t>(__builtin_ctzll(value));
+#endif
+}
+
+//Length fields of 15 or more continue in extra bytes, each adding up to 255
+static uint8_t* write_length(uint8_t* output, uint32_t length)
+{
+	while (length >= 255)
+	{
+		*output++ = 255;
+		length -= 255;
+	}
+	*output++ = static_cast<uint8_t>(length);
+	return output;
+}
+
+static uint8_t* write_sequence(uint8_t* output, const uint8_t* literals, const uint32_t literal_length, const uint32_t offset, const uint32_t match_length)
+{
+	uint8_t* token = output++;
+	*token = 0;
+
+	//Literals
+	if (literal_length >= 15)
+	{
+		*token = 15 << 4;
+		output = write_length(output, literal_length - 15);
+	}
+	else
+	{
+		*token = static_cast<uint8_t>(literal_length << 4);
+	}
+	memcpy(output, literals, literal_length);
+	output += literal_length;
+
+	//Match, the last sequence doesn't have one
+	if (match_length == 0)
+		return output;
+	*output++ = static_cast<uint8_t>(offset & 0xFF);
+	*output++ = static_cast<uint8_t>(offset >> 8);
+	const uint32_t stored_length = match_length - min_match;
+	if (stored_length >= 15)
+	{
+		*token |= 15;
+		output = write_length(output, stored_length - 15);
+	}
+	else
+	{
+		*token |= static_cast<uint8_t>(stored_length);
+	}
+	return output;
+}
+
+uint32_t Compression::compress_bound(const uint32_t size)
+{
+	return size + size / 255 + 16;
+}
+
+//Greedy LZ compression with a single-entry hash table. Returns the compressed size, or 0 if the destination is too small
+uint32_t Compression::compress_block(const char* source, const uint32_t source_size, char* destination, const uint32_t destination_capacity)
+{
+	if (destination_capacity < compress_bound(source_size))
+		return 0;
+
+	const uint8_t* input = reinterpret_cast<const uint8_t*>(source);
+	uint8_t* output = reinterpret_cast<uint8_t*>(destination);
+	uint32_t anchor = 0;
+
+	if (source_size > match_find_limit)
+	{
+		thread_local uint32_t hash_table[1 << hash_log];
+		memset(hash_table, 0, sizeof(hash_table));
+
+		const uint32_t match_limit = source_size - last_literals;
+		const uint32_t find_limit = source_size - match_find_limit;
+		uint32_t position = 0;
+		uint32_t n_misses = 0;
+		while (position < find_limit)
+		{
+			//Look for an earlier occurrence of the next 4 bytes
+			const uint32_t sequence = read_u32(input + position);
+			const uint32_t hash = hash_sequence(sequence);
+			uint32_t candidate = hash_table[hash];
+			hash_table[hash] = position;
+			if (candidate >= position || position - candidate > max_offset || read_u32(input + candidate) != sequence)
+			{
+				//Skip ahead faster through data that doesn't compress
+				position += 1 + (n_misses++ >> 5);
+				continue;
+			}
+			n_misses = 0;
+
+			//Extend the match backwards over literals we haven't written yet
+			while (position > anchor && candidate > 0 && input[position - 1] == input[candidate - 1])
+			{
+				position--;
+				candidate--;
+			}
+
+			//Extend it forwards, 8 bytes at a time where possible
+			uint32_t length = min_match;
+			bool mismatch_found = false;
+			while (position + length + 8 <= match_limit)
+			{
+				const uint64_t difference = read_u64(input + position + length) ^ read_u64(input + candidate + length);
+				if (difference != 0)
+				{
+					length += count_trailing_zeros(difference) / 8;
+					mismatch_found = true;
+					break;
+				}
+				length += 8;
+			}
+			while (!mismatch_found && position + length < match_limit && input[position + length] == input[candidate + length])
+				length++;
+
+			output = write_sequence(output, input + anchor, position - anchor, position - candidate, length);
+			position += length;
+			anchor = position;
+
+			//Remember a position inside the match too, repeats often start there
+			if (position < find_limit)
+				hash_table[hash_sequence(read_u32(input + position - 2))] = position - 2;
+		}
+	}
+
+	output = write_sequence(output, input + anchor, source_size - anchor, 0, 0);
+	return static_cast<uint32_t>(output - reinterpret_cast<uint8_t*>(destination));
+}
+
+//Decompresses a block into a buffer of exactly the original size. Returns false on corrupt data, without reading or writing out of bounds
+bool Compression::decompress_block(const char* source, const uint32_t source_size, char* destination, const uint32_t destination_size)
+{
+	const uint8_t* input = reinterpret_cast<const uint8_t*>(source);
+	const uint8_t* input_end = input + source_size;
+	uint8_t* output = reinterpret_cast<uint8_t*>(destination);
+	uint8_t* output_start = output;
+	uint8_t* output_end = output + destination_size;
+
+	while (input < input_end)
+	{
+		const uint8_t token = *input++;
+
+		//Literals
+		uint32_t literal_length = token >> 4;
+		if (literal_length == 15)
+		{
+			uint8_t extra;
+			do
+			{
+				if (input >= input_end)
+					return false;
+				extra = *input++;
+				literal_length += extra;
+			} while (extra == 255);
+		}
+		if (literal_length > static_cast<uint32_t>(input_end - input) || literal_length > static_cast<uint32_t>(output_end - output))
+			return false;
+		if (literal_length <= 16 && input_end - input >= 16 && output_end - output >= 16)
+			memcpy(output, input, 16);
+		else
+			memcpy(output, input, literal_length);
+		input += literal_length;
+		output += literal_length;
+
+		//The last sequence ends after its literals
+		if (input == input_end)
+			break;
+
+		//Match
+		if (input_end - input < 2)
+			return false;
+		const uint32_t offset = input[0] | (input[1] << 8);
+		input += 2;
+		if (offset == 0 || offset > static_cast<uint32_t>(output - output_start))
+			return false;
+		uint32_t match_length = token & 15;
+		if (match_length == 15)
+		{
+			uint8_t extra;
+			do
+			{
+				if (input >= input_end)
+					return false;
+				extra = *input++;
+				match_length += extra;
+			} while (extra == 255);
+		}
+		match_length += min_match;
+		if (match_length > static_cast<uint32_t>(output_end - output))
+			return false;
+
+		//Copy in chunks when the match is far enough back that a chunk can't overlap itself, otherwise byte by byte
+		const uint8_t* match = output - offset;
+		if (offset >= 16 && static_cast<uint32_t>(output_end - output) >= match_length + 16)
+		{
+			for (uint32_t i = 0; i < match_length; i += 16)
+				memcpy(output + i, match + i, 16);
+		}
+		else if (offset >= match_length)
+		{
+			memcpy(output, match, match_length);
+		}
+		else
+		{
+			for (uint32_t i = 0; i < match_length; i++)
+				output[i] = match[i];
+		}
+		output += match_length;
+	}
+	return output == output_end;
+}
+
+//Compresses data into a block container, compressing the blocks in parallel
+std::vector<char> Compression::compress(const char* data, const uint32_t size, const uint32_t block_size)
+{
+	const uint32_t n_blocks = (size + block_size - 1) / block_size;
+	std::vector<std::vector<char>> blocks(n_blocks);
+	std::vector<uint32_t> block_sizes(n_blocks);
+	ResourceManager::get_job_system_instance()->parallel_for(static_cast<int>(n_blocks), [&](const int block)
+	{
+		const uint32_t begin = block * block_size;
+		const uint32_t length = std::min(block_size, size - begin);
+		std::vector<char>& compressed = blocks[block];
+		compressed.resize(compress_bound(length));
+		const uint32_t compressed_size = compress_block(data + begin, length, compressed.data(), static_cast<uint32_t>(compressed.size()));
+
+		//Store blocks that didn't get any smaller as-is, those are faster to load
+		if (compressed_size == 0 || compressed_size >= length)
+		{
+			compressed.assign(data + begin, data + begin + length);
+			block_sizes[block] = length | stored_block_flag;
+		}
+		else
+		{
+			compressed.resize(compressed_size);
+			block_sizes[block] = compressed_size;
+		}
+	});
+
+	//Put the container together
+	CompressedHeader header{ container_magic, size, block_size, n_blocks };
+	std::vector<char> result(sizeof(header) + n_blocks * sizeof(uint32_t));
+	memcpy(result.data(), &header, sizeof(header));
+	if (n_blocks > 0)
+		memcpy(result.data() + sizeof(header), block_sizes.data(), n_blocks * sizeof(uint32_t));
+	for (const auto& block : blocks)
+		result.insert(result.end(), block.begin(), block.end());
+	return result;
+}
+
+bool Compression::get_decompressed_size(const char* data, const uint32_t size, uint32_t& decompressed_size)
+{
+	if (size < sizeof(CompressedHeader))
+		return false;
+	CompressedHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != container_magic)
+		return false;
+	decompressed_size = header.raw_size;
+	return true;
+}
+
+//Decompresses a block container into a buffer of exactly the original size, decompressing the blocks in parallel
+bool Compression::decompress(const char* data, const uint32_t size, char* output, const uint32_t output_size)
+{
+	//Validate the header and block table before touching anything
+	if (size < sizeof(CompressedHeader))
+		return false;
+	CompressedHeader header;
+	memcpy(&header, data, sizeof(header));
+	if (header.magic != container_magic || header.raw_size != output_size || header.block_size == 0 || header.block_size >= stored_block_flag)
+		return false;
+	if (header.n_blocks != (static_cast<uint64_t>(header.raw_size) + header.block_size - 1) / header.block_size)
+		return false;
+	const uint64_t table_end = sizeof(CompressedHeader) + static_cast<uint64_t>(header.n_blocks) * sizeof(uint32_t);
+	if (table_end > size)
+		return false;
+
+	std::vector<uint32_t> block_sizes(header.n_blocks);
+	std::vector<uint64_t> block_offsets(header.n_blocks);
+	if (header.n_blocks > 0)
+		memcpy(block_sizes.data(), data + sizeof(CompressedHeader), header.n_blocks * sizeof(uint32_t));
+	uint64_t offset = table_end;
+	for (uint32_t block = 0; block < header.n_blocks; block++)
+	{
+		block_offsets[block] = offset;
+		offset += block_sizes[block] & ~stored_block_flag;
+	}
+	if (offset > size)
+		return false;
+
+	std::atomic<bool> success{ true };
+	ResourceManager::get_job_system_instance()->parallel_for(static_cast<int>(header.n_blocks), [&](const int block)
+	{
+		const uint32_t begin = block * header.block_size;
+		const uint32_t length = std::min(header.block_size, header.raw_size - begin);
+		const char* source = data + block_offsets[block];
+		const uint32_t source_size = block_sizes[block] & ~stored_block_flag;
+		if (block_sizes[block] & stored_block_flag)
+		{
+			if (source_size != length)
+			{
+				success = false;
+				return;
+			}
+			memcpy(output + begin, source, length);
+		}
+		else if (!decompress_block(source, source_size, output + begin, length))
+		{
+			success = false;
+		}
+	});
+	return success;
+}
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+//Compressed data is split into independent blocks, so both compression and decompression can be spread across the job system.
+//Container layout: CompressedHeader, then one uint32 per block with its compressed size, then the blocks themselves
+struct CompressedHeader
+{
+	uint32_t magic;
+	uint32_t raw_size;
+	uint32_t block_size;
+	uint32_t n_blocks;
+};
+
+//LZ77 block compression in the style of LZ4. It trades compression ratio for decompression speed,
+//since decompression happens during loading and compression only happens once when cooking
+class Compression
+{
+public:
+	static uint32_t compress_bound(uint32_t size);
+	static uint32_t compress_block(const char* source, uint32_t source_size, char* destination, uint32_t destination_capacity);
+	static bool decompress_block(const char* source, uint32_t source_size, char* destination, uint32_t destination_size);
+	static std::vector<char> compress(const char* data, uint32_t size, uint32_t block_size = 256 * 1024);
+	static bool get_decompressed_size(const char* data, uint32_t size, uint32_t& decompressed_size);
+	static bool decompress(const char* data, uint32_t size, char* output, uint32_t output_size);
+
+private:
+	static constexpr uint32_t container_magic = 0x315A4C46; //"FLZ1"
+	static constexpr uint32_t stored_block_flag = 0x80000000; //Set on blocks that didn't compress, these are stored as-is
+};
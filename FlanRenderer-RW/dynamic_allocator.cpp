@@ -55,6 +55,8 @@ void* DynamicAllocator::allocate(uint32_t size, uint32_t align)
 	(void)align;
 	return malloc(size);
 #else
+	std::lock_guard<std::recursive_mutex> lock(allocator_mutex);
+
 	//Alignment has to be a multiple of 4
 	while (align % 4 != 0)
 	{
@@ -173,6 +175,8 @@ void DynamicAllocator::release(void* pointer)
 	if (pointer == nullptr)
 		return;
 
+	std::lock_guard<std::recursive_mutex> lock(allocator_mutex);
+
 	if (pointer < block_start || (intptr_t)pointer >= ((intptr_t)block_start + block_size))
 	{
 		Logger::logf("[ERROR] Attempted to release pointer at 0x%08X which is outside the range of the allocator, will skip this!");
@@ -244,6 +248,8 @@ void* DynamicAllocator::reallocate(void* pointer, uint32_t size, uint32_t align)
 		return return_value;
 	}
 
+	std::lock_guard<std::recursive_mutex> lock(allocator_mutex);
+
 	//Get pointer to header using the offset right before the memory
 	uint32_t* marker_pointer = static_cast<uint32_t*>(pointer);
 	const uint32_t offset = marker_pointer[-1];
@@ -292,6 +298,7 @@ void DynamicAllocator::debug_memory()
 
 std::vector<MemoryChunk> DynamicAllocator::get_memory_chunk_list()
 {
+	std::lock_guard<std::recursive_mutex> lock(allocator_mutex);
 	std::vector<MemoryChunk> memory_chunks;
 	for (auto a : memory_labels)
 	{
@@ -1,5 +1,6 @@
 #pragma once
 #include <cstdint>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 
@@ -19,10 +20,12 @@ public:
 	void debug_memory();
 	std::vector<MemoryChunk> get_memory_chunk_list();
 
-	std::string curr_memory_chunk_label = "unknown";
+	//Resources are loaded on worker threads, so every thread keeps its own label
+	inline static thread_local std::string curr_memory_chunk_label = "unknown";
 	std::unordered_map<void*, std::string> memory_labels;
 
 private:
+	std::recursive_mutex allocator_mutex;
 	void* block_start = nullptr;
 	uint32_t block_size = 0;
 	std::unordered_map<void*, std::string> chunk_names;
@@ -2,7 +2,9 @@
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <GL/gl3w.h>
+#include <algorithm>
 
+#include "load_telemetry.h"
 #include "logger.h"
 #include "renderer.h"
 #include "resource_manager.h"
@@ -122,6 +124,7 @@ public:
 			viewport_size.y = window_size.y - (window_size.x - width_memory_debugger - width_resource_debugger) * (9.0f / 16.0f);
 			ImGui::SetWindowSize(viewport_size);
 			ImGui::BeginChild("Console Log");
+			std::lock_guard<std::mutex> lock(Logger::messages_mutex);
 			for (auto& [colour, text] : Logger::messages)
 			{
 				ImGui::TextColored({
@@ -186,6 +189,24 @@ public:
 			ImGui::BeginChild("Roughness Power slider");
 			ImGui::SliderFloat("Roughness Power", &renderer->rgh_pow, 0.0f, 3.0f);
 			ImGui::Checkbox("Flip normal green channel", &renderer->flip_normal_y);
+			ImGui::Checkbox("Texture streaming", &renderer->texture_streaming);
+			ImGui::Checkbox("Texture compression (new uploads)", &renderer->texture_compression);
+			ImGui::Checkbox("Texture packing (new uploads)", &renderer->texture_packing);
+			ImGui::Checkbox("ORM textures (new uploads)", &renderer->orm_textures);
+			ImGui::Checkbox("Packed vertices (new uploads)", &renderer->use_packed_vertices);
+			ImGui::Checkbox("Meshlet culling", &renderer->meshlet_culling);
+			ImGui::Text("Meshlets drawn: %i / %i", renderer->meshlets_visible, renderer->meshlets_total);
+			ImGui::Checkbox("Mesh LODs", &renderer->mesh_lods);
+			ImGui::SliderFloat("LOD error (pixels)", &renderer->lod_error_pixels, 0.25f, 16.0f);
+			ImGui::Checkbox("Mesh instancing", &renderer->mesh_instancing);
+			ImGui::Text("Draw calls: %i", renderer->draw_calls);
+			ImGui::Text("Texture memory: %s / %s", visualize_byte_size(renderer->texture_memory_resident).c_str(), visualize_byte_size(renderer->texture_memory_budget).c_str());
+			if (ImGui::CollapsingHeader("Load telemetry"))
+			{
+				if (ImGui::Button("Dump to load_telemetry.json"))
+					LoadTelemetry::dump_json("load_telemetry.json");
+				draw_load_telemetry_table();
+			}
 			ImGui::EndChild();
 			ImGui::EndGroup();
 		} ImGui::End();
@@ -197,6 +218,67 @@ public:
 		ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 		glfwSwapBuffers((GLFWwindow*)renderer->get_window());
 	}
+
+	//Table of per-asset load statistics, sortable by clicking a column header
+	void draw_load_telemetry_table()
+	{
+		constexpr int n_phases = static_cast<int>(LoadPhase::count);
+		constexpr ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_Resizable | ImGuiTableFlags_RowBg | ImGuiTableFlags_ScrollX | ImGuiTableFlags_ScrollY | ImGuiTableFlags_SizingFixedFit;
+		if (!ImGui::BeginTable("Load telemetry", 7 + n_phases, flags, ImVec2(0, 400)))
+			return;
+
+		ImGui::TableSetupScrollFreeze(1, 1);
+		ImGui::TableSetupColumn("Asset");
+		ImGui::TableSetupColumn("Bytes");
+		ImGui::TableSetupColumn("Total ms", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending);
+		for (int phase = 0; phase < n_phases; phase++)
+			ImGui::TableSetupColumn(LoadTelemetry::phase_name(static_cast<LoadPhase>(phase)), ImGuiTableColumnFlags_PreferSortDescending);
+		ImGui::TableSetupColumn("Thread");
+		ImGui::TableSetupColumn("Dedupes");
+		ImGui::TableSetupColumn("Cache hits");
+		ImGui::TableSetupColumn("Cache misses");
+		ImGui::TableHeadersRow();
+
+		//Sort a copy of the records by the selected column
+		std::vector<LoadRecord> records = LoadTelemetry::get_records();
+		if (const ImGuiTableSortSpecs* sort_specs = ImGui::TableGetSortSpecs(); sort_specs != nullptr && sort_specs->SpecsCount > 0)
+		{
+			const int column = sort_specs->Specs[0].ColumnIndex;
+			const bool ascending = sort_specs->Specs[0].SortDirection == ImGuiSortDirection_Ascending;
+			std::sort(records.begin(), records.end(), [column, ascending, n_phases](const LoadRecord& lhs, const LoadRecord& rhs)
+			{
+				double lhs_value = 0.0;
+				double rhs_value = 0.0;
+				if (column == 0) { return ascending ? lhs.name < rhs.name : lhs.name > rhs.name; }
+				else if (column == 1) { lhs_value = static_cast<double>(lhs.bytes_read); rhs_value = static_cast<double>(rhs.bytes_read); }
+				else if (column == 2) { lhs_value = lhs.total_ms(); rhs_value = rhs.total_ms(); }
+				else if (column < 3 + n_phases) { lhs_value = lhs.phase_ms[column - 3]; rhs_value = rhs.phase_ms[column - 3]; }
+				else if (column == 3 + n_phases) { lhs_value = lhs.phase_thread[static_cast<int>(LoadPhase::decode)]; rhs_value = rhs.phase_thread[static_cast<int>(LoadPhase::decode)]; }
+				else if (column == 4 + n_phases) { lhs_value = lhs.request_dedupes; rhs_value = rhs.request_dedupes; }
+				else if (column == 5 + n_phases) { lhs_value = lhs.asset_cache_hits; rhs_value = rhs.asset_cache_hits; }
+				else { lhs_value = lhs.asset_cache_misses; rhs_value = rhs.asset_cache_misses; }
+				return ascending ? lhs_value < rhs_value : lhs_value > rhs_value;
+			});
+		}
+
+		for (const auto& record : records)
+		{
+			ImGui::TableNextRow();
+			ImGui::TableNextColumn(); ImGui::Text("%s", record.name.c_str());
+			ImGui::TableNextColumn(); ImGui::Text("%s", visualize_byte_size(static_cast<intptr_t>(record.bytes_read)).c_str());
+			ImGui::TableNextColumn(); ImGui::Text("%.2f", record.total_ms());
+			for (int phase = 0; phase < n_phases; phase++)
+			{
+				ImGui::TableNextColumn(); ImGui::Text("%.2f", record.phase_ms[phase]);
+			}
+			ImGui::TableNextColumn(); ImGui::Text("%i", record.phase_thread[static_cast<int>(LoadPhase::decode)]);
+			ImGui::TableNextColumn(); ImGui::Text("%u", record.request_dedupes);
+			ImGui::TableNextColumn(); ImGui::Text("%u", record.asset_cache_hits);
+			ImGui::TableNextColumn(); ImGui::Text("%u", record.asset_cache_misses);
+		}
+		ImGui::EndTable();
+	}
+
 	Renderer* renderer;
 	ResourceManager* resource_manager;
 };
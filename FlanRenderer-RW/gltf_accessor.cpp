@@ -0,0 +1,205 @@
+#include "gltf_accessor.h"
+
+#include <algorithm>
+#include <cstring>
+#include <tinygltf/tiny_gltf.h>
+
+#include "logger.h"
+
+//Returns a pointer to the bytes of a buffer view, checked to hold size_bytes starting at offset, or nullptr if the file is broken
+static const unsigned char* get_buffer_view_data(const tinygltf::Model& model, const int buffer_view_index, const size_t offset, const size_t size_bytes)
+{
+	if (buffer_view_index < 0 || buffer_view_index >= static_cast<int>(model.bufferViews.size()))
+		return nullptr;
+	const tinygltf::BufferView& buffer_view = model.bufferViews[buffer_view_index];
+	if (buffer_view.buffer < 0 || buffer_view.buffer >= static_cast<int>(model.buffers.size()))
+		return nullptr;
+	const std::vector<unsigned char>& buffer = model.buffers[buffer_view.buffer].data;
+	if (offset + size_bytes > buffer_view.byteLength || buffer_view.byteOffset + buffer_view.byteLength > buffer.size())
+		return nullptr;
+	return buffer.data() + buffer_view.byteOffset + offset;
+}
+
+//Reads an unsigned integer of the given glTF component type, for indices
+static uint32_t read_unsigned_integer(const unsigned char* bytes, const int component_type)
+{
+	switch (component_type)
+	{
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			return bytes[0];
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		{
+			uint16_t value;
+			memcpy(&value, bytes, sizeof(value));
+			return value;
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		{
+			uint32_t value;
+			memcpy(&value, bytes, sizeof(value));
+			return value;
+		}
+		default:
+			return 0;
+	}
+}
+
+GltfAccessorView::GltfAccessorView(const tinygltf::Model& model, const int accessor_index)
+{
+	if (accessor_index < 0 || accessor_index >= static_cast<int>(model.accessors.size()))
+		return;
+	const tinygltf::Accessor& accessor = model.accessors[accessor_index];
+	count = static_cast<int>(accessor.count);
+	n_components = tinygltf::GetNumComponentsInType(accessor.type);
+	component_type = accessor.componentType;
+	component_size = tinygltf::GetComponentSizeInBytes(accessor.componentType);
+	normalized = accessor.normalized;
+	if (n_components <= 0 || component_size <= 0)
+	{
+		Logger::logf("[ERROR] glTF accessor %i has an unsupported type!\n", accessor_index);
+		return;
+	}
+	const size_t element_size = static_cast<size_t>(component_size) * n_components;
+
+	//Elements are tightly packed unless the buffer view says otherwise
+	if (accessor.bufferView != -1)
+	{
+		if (accessor.bufferView < 0 || accessor.bufferView >= static_cast<int>(model.bufferViews.size()))
+		{
+			Logger::logf("[ERROR] glTF accessor %i points to buffer view %i, which doesn't exist!\n", accessor_index, accessor.bufferView);
+			return;
+		}
+		//ByteStride is -1 if the view's stride isn't a multiple of the component size, and a stride shorter than an element would overlap them
+		const int byte_stride = accessor.ByteStride(model.bufferViews[accessor.bufferView]);
+		if (byte_stride < 0 || (byte_stride > 0 && static_cast<size_t>(byte_stride) < element_size))
+		{
+			Logger::logf("[ERROR] glTF accessor %i has an invalid byte stride!\n", accessor_index);
+			return;
+		}
+		stride = byte_stride > 0 ? static_cast<size_t>(byte_stride) : element_size;
+		const size_t size_bytes = count > 0 ? stride * (count - 1) + element_size : 0;
+		data = get_buffer_view_data(model, accessor.bufferView, accessor.byteOffset, size_bytes);
+		if (data == nullptr)
+		{
+			Logger::logf("[ERROR] glTF accessor %i reads outside of its buffer!\n", accessor_index);
+			return;
+		}
+	}
+
+	if (accessor.sparse.isSparse)
+	{
+		sparse_count = accessor.sparse.count;
+		sparse_index_type = accessor.sparse.indices.componentType;
+		const int sparse_index_size = tinygltf::GetComponentSizeInBytes(sparse_index_type);
+		sparse_indices = get_buffer_view_data(model, accessor.sparse.indices.bufferView, accessor.sparse.indices.byteOffset, static_cast<size_t>(sparse_index_size) * sparse_count);
+		sparse_values = get_buffer_view_data(model, accessor.sparse.values.bufferView, accessor.sparse.values.byteOffset, element_size * sparse_count);
+		if (sparse_index_size <= 0 || sparse_indices == nullptr || sparse_values == nullptr)
+		{
+			Logger::logf("[ERROR] glTF accessor %i has broken sparse data!\n", accessor_index);
+			return;
+		}
+	}
+
+	valid = true;
+}
+
+//Writes up to n_out_components floats per element, out_stride_bytes apart, so it can fill a field of an array of structs directly.
+//Components the accessor doesn't have are left alone
+void GltfAccessorView::read_floats(float* out, const size_t out_stride_bytes, const int n_out_components) const
+{
+	if (!valid)
+		return;
+	const int n_read = std::min(n_out_components, n_components);
+	char* out_bytes = reinterpret_cast<char*>(out);
+
+	for (int i = 0; i < count; i++)
+	{
+		float* out_element = reinterpret_cast<float*>(out_bytes + out_stride_bytes * i);
+		if (data == nullptr)
+		{
+			std::fill(out_element, out_element + n_read, 0.0f);
+			continue;
+		}
+		const unsigned char* element = data + stride * i;
+		if (component_type == TINYGLTF_COMPONENT_TYPE_FLOAT)
+		{
+			memcpy(out_element, element, sizeof(float) * n_read);
+			continue;
+		}
+		for (int component = 0; component < n_read; component++)
+			out_element[component] = read_component(element, component);
+	}
+
+	const size_t element_size = static_cast<size_t>(component_size) * n_components;
+	for (int i = 0; i < sparse_count; i++)
+	{
+		const uint32_t index = get_sparse_index(i);
+		if (index >= static_cast<uint32_t>(count))
+			continue;
+		float* out_element = reinterpret_cast<float*>(out_bytes + out_stride_bytes * index);
+		for (int component = 0; component < n_read; component++)
+			out_element[component] = read_component(sparse_values + element_size * i, component);
+	}
+}
+
+void GltfAccessorView::read_indices(uint32_t* out) const
+{
+	if (!valid)
+		return;
+	for (int i = 0; i < count; i++)
+		out[i] = data != nullptr ? read_unsigned_integer(data + stride * i, component_type) : 0;
+
+	for (int i = 0; i < sparse_count; i++)
+	{
+		const uint32_t index = get_sparse_index(i);
+		if (index < static_cast<uint32_t>(count))
+			out[index] = read_unsigned_integer(sparse_values + static_cast<size_t>(component_size) * i, component_type);
+	}
+}
+
+uint32_t GltfAccessorView::get_sparse_index(const int i) const
+{
+	return read_unsigned_integer(sparse_indices + static_cast<size_t>(tinygltf::GetComponentSizeInBytes(sparse_index_type)) * i, sparse_index_type);
+}
+
+//Converts one component to float. Normalized integers map to 0..1 or -1..1 as the glTF spec describes
+float GltfAccessorView::read_component(const unsigned char* element, const int component) const
+{
+	const unsigned char* bytes = element + static_cast<size_t>(component_size) * component;
+	switch (component_type)
+	{
+		case TINYGLTF_COMPONENT_TYPE_BYTE:
+		{
+			const int8_t value = static_cast<int8_t>(bytes[0]);
+			return normalized ? std::max(static_cast<float>(value) / 127.0f, -1.0f) : static_cast<float>(value);
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+			return normalized ? static_cast<float>(bytes[0]) / 255.0f : static_cast<float>(bytes[0]);
+		case TINYGLTF_COMPONENT_TYPE_SHORT:
+		{
+			int16_t value;
+			memcpy(&value, bytes, sizeof(value));
+			return normalized ? std::max(static_cast<float>(value) / 32767.0f, -1.0f) : static_cast<float>(value);
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+		{
+			uint16_t value;
+			memcpy(&value, bytes, sizeof(value));
+			return normalized ? static_cast<float>(value) / 65535.0f : static_cast<float>(value);
+		}
+		case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+		{
+			uint32_t value;
+			memcpy(&value, bytes, sizeof(value));
+			return static_cast<float>(value);
+		}
+		case TINYGLTF_COMPONENT_TYPE_FLOAT:
+		{
+			float value;
+			memcpy(&value, bytes, sizeof(value));
+			return value;
+		}
+		default:
+			return 0.0f;
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstdint>
+
+namespace tinygltf
+{
+	class Model;
+}
+
+//Typed view of a glTF accessor that reads straight from the model's loaded buffers. Handles interleaved buffer views (byteStride),
+//accessor offsets, normalized integer components and sparse accessors, so importers never have to care how the data is laid out
+class GltfAccessorView
+{
+public:
+	GltfAccessorView() = default;
+	GltfAccessorView(const tinygltf::Model& model, int accessor_index);
+	bool is_valid() const { return valid; }
+	int size() const { return count; }
+	int get_n_components() const { return n_components; }
+	void read_floats(float* out, size_t out_stride_bytes, int n_out_components) const;
+	void read_indices(uint32_t* out) const;
+
+private:
+	float read_component(const unsigned char* element, int component) const;
+	uint32_t get_sparse_index(int i) const;
+
+	const unsigned char* data = nullptr;	//Nullptr means all zeroes, which sparse accessors are allowed to start from
+	size_t stride = 0;
+	int count = 0;
+	int n_components = 0;
+	int component_type = 0;
+	int component_size = 0;
+	bool normalized = false;
+	bool valid = false;
+
+	//Sparse accessors replace some elements with values stored elsewhere
+	const unsigned char* sparse_indices = nullptr;
+	const unsigned char* sparse_values = nullptr;
+	int sparse_count = 0;
+	int sparse_index_type = 0;
+};
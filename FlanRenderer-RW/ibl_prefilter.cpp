@@ -0,0 +1,552 @@
+#include "ibl_prefilter.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <xmmintrin.h>
+#include <glm/common.hpp>
+#include <glm/geometric.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/vec3.hpp>
+
+#include "job_system.h"
+#include "resource_handler_structs.h"
+#include "resource_manager.h"
+
+constexpr float pi = 3.14159265358979f;
+
+//Linear float copy of a cubemap with box filtered mips, 4 floats per texel so a texel is one SSE load
+struct FloatCubemap
+{
+	int n_levels = 0;
+	int sizes[16]{};
+	std::vector<float> levels[16];	//Six faces back to back per level
+
+	float* get_texel(const int level, const int face, const int x, const int y)
+	{
+		return levels[level].data() + ((static_cast<size_t>(face) * sizes[level] + y) * sizes[level] + x) * 4;
+	}
+	const float* get_texel(const int level, const int face, const int x, const int y) const
+	{
+		return levels[level].data() + ((static_cast<size_t>(face) * sizes[level] + y) * sizes[level] + x) * 4;
+	}
+};
+
+//One GGX sample around +Z, along with how much it counts and which source mip it reads
+struct SpecularSample
+{
+	glm::vec3 direction;
+	float weight;
+	int level;
+};
+
+static float decode_channel(const uint8_t value, const bool is_srgb)
+{
+	const float linear = static_cast<float>(value) / 255.0f;
+	if (!is_srgb)
+		return linear;
+	return linear <= 0.04045f ? linear / 12.92f : std::pow((linear + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t encode_channel(float value, const bool is_srgb)
+{
+	value = glm::clamp(value, 0.0f, 1.0f);
+	if (is_srgb)
+		value = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.0f / 2.4f) - 0.055f;
+	return static_cast<uint8_t>(value * 255.0f + 0.5f);
+}
+
+static Pixel32 encode_pixel(const float (&colour)[4], const bool is_srgb)
+{
+	return { encode_channel(colour[0], is_srgb), encode_channel(colour[1], is_srgb), encode_channel(colour[2], is_srgb), encode_channel(colour[3], false) };
+}
+
+//Decodes the faces and box filters them down until a face is min_size texels wide
+static void build_float_cubemap(const Pixel32* const (&faces)[6], const int face_size, const bool is_srgb, const int min_size, FloatCubemap& cubemap)
+{
+	float decode_table[2][256];
+	for (int i = 0; i < 256; i++)
+	{
+		decode_table[0][i] = decode_channel(static_cast<uint8_t>(i), is_srgb);
+		decode_table[1][i] = decode_channel(static_cast<uint8_t>(i), false);
+	}
+
+	cubemap.n_levels = 1;
+	cubemap.sizes[0] = face_size;
+	while (cubemap.n_levels < 16 && cubemap.sizes[cubemap.n_levels - 1] > glm::max(min_size, 1))
+	{
+		cubemap.sizes[cubemap.n_levels] = glm::max(cubemap.sizes[cubemap.n_levels - 1] / 2, 1);
+		cubemap.n_levels++;
+	}
+
+	const int n_texels = face_size * face_size;
+	cubemap.levels[0].resize(static_cast<size_t>(n_texels) * 6 * 4);
+	ResourceManager::get_job_system_instance()->parallel_for(6, [&](const int face)
+	{
+		float* output = cubemap.levels[0].data() + static_cast<size_t>(face) * n_texels * 4;
+		for (int i = 0; i < n_texels; i++)
+		{
+			output[i * 4 + 0] = decode_table[0][faces[face][i].r];
+			output[i * 4 + 1] = decode_table[0][faces[face][i].g];
+			output[i * 4 + 2] = decode_table[0][faces[face][i].b];
+			output[i * 4 + 3] = decode_table[1][faces[face][i].a];
+		}
+	});
+
+	for (int level = 1; level < cubemap.n_levels; level++)
+	{
+		const int source_size = cubemap.sizes[level - 1];
+		const int size = cubemap.sizes[level];
+		cubemap.levels[level].resize(static_cast<size_t>(size) * size * 6 * 4);
+		ResourceManager::get_job_system_instance()->parallel_for(6, [&](const int face)
+		{
+			const __m128 quarter = _mm_set1_ps(0.25f);
+			for (int y = 0; y < size; y++)
+			{
+				const int y0 = glm::min(y * 2, source_size - 1);
+				const int y1 = glm::min(y * 2 + 1, source_size - 1);
+				for (int x = 0; x < size; x++)
+				{
+					const int x0 = glm::min(x * 2, source_size - 1);
+					const int x1 = glm::min(x * 2 + 1, source_size - 1);
+					const __m128 top = _mm_add_ps(_mm_loadu_ps(cubemap.get_texel(level - 1, face, x0, y0)), _mm_loadu_ps(cubemap.get_texel(level - 1, face, x1, y0)));
+					const __m128 bottom = _mm_add_ps(_mm_loadu_ps(cubemap.get_texel(level - 1, face, x0, y1)), _mm_loadu_ps(cubemap.get_texel(level - 1, face, x1, y1)));
+					_mm_storeu_ps(cubemap.get_texel(level, face, x, y), _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+				}
+			}
+		});
+	}
+}
+
+//OpenGL's cubemap layout: the major axis picks the face, the other two give the texture coordinates on it.
+//Per face, the direction a texel at (s, t) points in is axis + (s * 2 - 1) * s_axis + (t * 2 - 1) * t_axis, before normalising
+static const glm::vec3 face_axes[6][3]{
+	{ {  1,  0,  0 }, {  0,  0, -1 }, {  0, -1,  0 } },
+	{ { -1,  0,  0 }, {  0,  0,  1 }, {  0, -1,  0 } },
+	{ {  0,  1,  0 }, {  1,  0,  0 }, {  0,  0,  1 } },
+	{ {  0, -1,  0 }, {  1,  0,  0 }, {  0,  0, -1 } },
+	{ {  0,  0,  1 }, {  1,  0,  0 }, {  0, -1,  0 } },
+	{ {  0,  0, -1 }, { -1,  0,  0 }, {  0, -1,  0 } },
+};
+
+static glm::vec3 face_to_direction(const int face, const float s, const float t)
+{
+	return glm::normalize(face_axes[face][0] + (s * 2.0f - 1.0f) * face_axes[face][1] + (t * 2.0f - 1.0f) * face_axes[face][2]);
+}
+
+static int direction_to_face(const glm::vec3& direction, float& s, float& t)
+{
+	const glm::vec3 abs_direction = glm::abs(direction);
+	int face;
+	float major;
+	float sc;
+	float tc;
+	if (abs_direction.x >= abs_direction.y && abs_direction.x >= abs_direction.z)
+	{
+		major = abs_direction.x;
+		face = direction.x > 0.0f ? 0 : 1;
+		sc = direction.x > 0.0f ? -direction.z : direction.z;
+		tc = -direction.y;
+	}
+	else if (abs_direction.y >= abs_direction.z)
+	{
+		major = abs_direction.y;
+		face = direction.y > 0.0f ? 2 : 3;
+		sc = direction.x;
+		tc = direction.y > 0.0f ? direction.z : -direction.z;
+	}
+	else
+	{
+		major = abs_direction.z;
+		face = direction.z > 0.0f ? 4 : 5;
+		sc = direction.z > 0.0f ? direction.x : -direction.x;
+		tc = -direction.y;
+	}
+	s = (sc / major + 1.0f) * 0.5f;
+	t = (tc / major + 1.0f) * 0.5f;
+	return face;
+}
+
+//Bilinear filtered, clamped to the edges of the face
+static __m128 sample_cubemap(const FloatCubemap& cubemap, const int level, const glm::vec3& direction)
+{
+	float s;
+	float t;
+	const int face = direction_to_face(direction, s, t);
+	const int size = cubemap.sizes[level];
+	const float x = glm::clamp(s * static_cast<float>(size) - 0.5f, 0.0f, static_cast<float>(size - 1));
+	const float y = glm::clamp(t * static_cast<float>(size) - 0.5f, 0.0f, static_cast<float>(size - 1));
+	const int x0 = static_cast<int>(x);
+	const int y0 = static_cast<int>(y);
+	const int x1 = glm::min(x0 + 1, size - 1);
+	const int y1 = glm::min(y0 + 1, size - 1);
+	const __m128 fraction_x = _mm_set1_ps(x - static_cast<float>(x0));
+	const __m128 fraction_y = _mm_set1_ps(y - static_cast<float>(y0));
+
+	const __m128 texel_00 = _mm_loadu_ps(cubemap.get_texel(level, face, x0, y0));
+	const __m128 texel_10 = _mm_loadu_ps(cubemap.get_texel(level, face, x1, y0));
+	const __m128 texel_01 = _mm_loadu_ps(cubemap.get_texel(level, face, x0, y1));
+	const __m128 texel_11 = _mm_loadu_ps(cubemap.get_texel(level, face, x1, y1));
+	const __m128 top = _mm_add_ps(texel_00, _mm_mul_ps(_mm_sub_ps(texel_10, texel_00), fraction_x));
+	const __m128 bottom = _mm_add_ps(texel_01, _mm_mul_ps(_mm_sub_ps(texel_11, texel_01), fraction_x));
+	return _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), fraction_y));
+}
+
+static float radical_inverse(uint32_t bits)
+{
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return static_cast<float>(bits) * 2.3283064365386963e-10f;
+}
+
+//Hammersley points importance sampled on GGX, with the view direction equal to the normal like the split sum approximation assumes.
+//Each sample reads the source mip whose texels cover about as much of the sphere as the sample does, which hides the low sample count
+static std::vector<SpecularSample> build_specular_samples(const float roughness, const int n_samples, const int source_size, const int n_source_levels)
+{
+	const float alpha = roughness * roughness;
+	const float alpha_2 = alpha * alpha;
+	const float texel_solid_angle = 4.0f * pi / (6.0f * static_cast<float>(source_size) * static_cast<float>(source_size));
+
+	std::vector<SpecularSample> samples;
+	samples.reserve(n_samples);
+	for (int i = 0; i < n_samples; i++)
+	{
+		const float u = static_cast<float>(i) / static_cast<float>(n_samples);
+		const float v = radical_inverse(static_cast<uint32_t>(i));
+		const float phi = 2.0f * pi * u;
+		const float cos_theta = std::sqrt((1.0f - v) / (1.0f + (alpha_2 - 1.0f) * v));
+		const float sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+		const glm::vec3 half_vector(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+		const glm::vec3 light = 2.0f * cos_theta * half_vector - glm::vec3(0.0f, 0.0f, 1.0f);
+		if (light.z <= 0.0f)
+			continue;
+
+		//With the view along the normal, the pdf of the reflected direction is D / 4
+		const float denominator = cos_theta * cos_theta * (alpha_2 - 1.0f) + 1.0f;
+		const float distribution = alpha_2 / (pi * denominator * denominator);
+		const float sample_solid_angle = 1.0f / (static_cast<float>(n_samples) * distribution * 0.25f + 0.0001f);
+		const float level = glm::max(0.5f * std::log2(sample_solid_angle / texel_solid_angle) + 1.0f, 0.0f);
+		samples.push_back({ light, light.z, glm::min(static_cast<int>(level + 0.5f), n_source_levels - 1) });
+	}
+	return samples;
+}
+
+//Area of the part of the unit sphere a texel on a face covers, from the corners of the texel in [-1, 1]
+static float area_element(const float x, const float y)
+{
+	return std::atan2(x * y, std::sqrt(x * x + y * y + 1.0f));
+}
+
+static float texel_solid_angle(const int x, const int y, const int size)
+{
+	const float inverse_size = 1.0f / static_cast<float>(size);
+	const float x0 = (static_cast<float>(x) * 2.0f) * inverse_size - 1.0f;
+	const float y0 = (static_cast<float>(y) * 2.0f) * inverse_size - 1.0f;
+	const float x1 = x0 + 2.0f * inverse_size;
+	const float y1 = y0 + 2.0f * inverse_size;
+	return area_element(x0, y0) - area_element(x0, y1) - area_element(x1, y0) + area_element(x1, y1);
+}
+
+static float horizontal_sum(const __m128 value)
+{
+	const __m128 shuffled = _mm_shuffle_ps(value, value, _MM_SHUFFLE(2, 3, 0, 1));
+	const __m128 sums = _mm_add_ps(value, shuffled);
+	return _mm_cvtss_f32(_mm_add_ss(sums, _mm_movehl_ps(shuffled, sums)));
+}
+
+int IblPrefilter::get_n_mips(const int face_size)
+{
+	int n_mips = 1;
+	while ((face_size >> n_mips) > 0)
+		n_mips++;
+	return n_mips;
+}
+
+uint32_t IblPrefilter::get_cubemap_size(const int face_size, const int n_mips)
+{
+	uint32_t size = 0;
+	for (int level = 0; level < n_mips; level++)
+	{
+		const uint32_t level_size = glm::max(face_size >> level, 1);
+		size += level_size * level_size * 6 * sizeof(Pixel32);
+	}
+	return size;
+}
+
+void IblPrefilter::prefilter_specular(const Pixel32* const (&faces)[6], const int face_size, Pixel32* output, const int n_mips, const bool is_srgb)
+{
+	FloatCubemap source;
+	build_float_cubemap(faces, face_size, is_srgb, 1, source);
+
+	//Roughness 0 is a perfect mirror, so the first level is the source itself
+	for (int face = 0; face < 6; face++)
+	{
+		memcpy(output + static_cast<size_t>(face) * face_size * face_size, faces[face], sizeof(Pixel32) * face_size * face_size);
+	}
+	output += static_cast<size_t>(face_size) * face_size * 6;
+
+	for (int level = 1; level < n_mips; level++)
+	{
+		const int size = glm::max(face_size >> level, 1);
+		const float roughness = static_cast<float>(level) / static_cast<float>(glm::max(n_mips - 1, 1));
+		const std::vector<SpecularSample> samples = build_specular_samples(roughness, specular_samples, face_size, source.n_levels);
+
+		//Rows of all six faces go in one batch, so small levels still keep every thread busy
+		const int n_rows = size * 6;
+		const int n_jobs = (n_rows + rows_per_job - 1) / rows_per_job;
+		ResourceManager::get_job_system_instance()->parallel_for(n_jobs, [&](const int job)
+		{
+			const int end_row = glm::min((job + 1) * rows_per_job, n_rows);
+			for (int row = job * rows_per_job; row < end_row; row++)
+			{
+				const int face = row / size;
+				const int y = row % size;
+				for (int x = 0; x < size; x++)
+				{
+					const glm::vec3 normal = face_to_direction(face, (static_cast<float>(x) + 0.5f) / static_cast<float>(size), (static_cast<float>(y) + 0.5f) / static_cast<float>(size));
+					const glm::vec3 up = std::abs(normal.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+					const glm::vec3 tangent = glm::normalize(glm::cross(up, normal));
+					const glm::vec3 bitangent = glm::cross(normal, tangent);
+
+					__m128 sum = _mm_setzero_ps();
+					float total_weight = 0.0f;
+					for (const SpecularSample& sample : samples)
+					{
+						const glm::vec3 direction = tangent * sample.direction.x + bitangent * sample.direction.y + normal * sample.direction.z;
+						sum = _mm_add_ps(sum, _mm_mul_ps(sample_cubemap(source, sample.level, direction), _mm_set1_ps(sample.weight)));
+						total_weight += sample.weight;
+					}
+
+					float colour[4];
+					_mm_storeu_ps(colour, _mm_div_ps(sum, _mm_set1_ps(glm::max(total_weight, 0.0001f))));
+					output[(static_cast<size_t>(face) * size + y) * size + x] = encode_pixel(colour, is_srgb);
+				}
+			}
+		});
+		output += static_cast<size_t>(size) * size * 6;
+	}
+}
+
+void IblPrefilter::convolve_irradiance(const Pixel32* const (&faces)[6], const int face_size, Pixel32* output, const int output_size, const bool is_srgb)
+{
+	FloatCubemap source;
+	build_float_cubemap(faces, face_size, is_srgb, irradiance_source_size, source);
+	const int source_level = source.n_levels - 1;
+	const int source_size = source.sizes[source_level];
+
+	//Every source texel as a direction and a colour weighted by its solid angle, one array per component so four texels fill a register.
+	//The weight array is the solid angle on its own, which gives the normalisation. Padding texels have zero weight
+	const int n_texels = source_size * source_size * 6;
+	const int n_padded = (n_texels + 3) & ~3;
+	std::vector<float> texels[7];
+	for (auto& component : texels)
+		component.assign(n_padded, 0.0f);
+	for (int face = 0; face < 6; face++)
+	{
+		for (int y = 0; y < source_size; y++)
+		{
+			for (int x = 0; x < source_size; x++)
+			{
+				const int i = (face * source_size + y) * source_size + x;
+				const glm::vec3 direction = face_to_direction(face, (static_cast<float>(x) + 0.5f) / static_cast<float>(source_size), (static_cast<float>(y) + 0.5f) / static_cast<float>(source_size));
+				const float solid_angle = texel_solid_angle(x, y, source_size);
+				const float* colour = source.get_texel(source_level, face, x, y);
+				texels[0][i] = direction.x;
+				texels[1][i] = direction.y;
+				texels[2][i] = direction.z;
+				texels[3][i] = colour[0] * solid_angle;
+				texels[4][i] = colour[1] * solid_angle;
+				texels[5][i] = colour[2] * solid_angle;
+				texels[6][i] = solid_angle;
+			}
+		}
+	}
+
+	const int n_rows = output_size * 6;
+	const int n_jobs = (n_rows + rows_per_job - 1) / rows_per_job;
+	ResourceManager::get_job_system_instance()->parallel_for(n_jobs, [&](const int job)
+	{
+		const int end_row = glm::min((job + 1) * rows_per_job, n_rows);
+		for (int row = job * rows_per_job; row < end_row; row++)
+		{
+			const int face = row / output_size;
+			const int y = row % output_size;
+			for (int x = 0; x < output_size; x++)
+			{
+				const glm::vec3 normal = face_to_direction(face, (static_cast<float>(x) + 0.5f) / static_cast<float>(output_size), (static_cast<float>(y) + 0.5f) / static_cast<float>(output_size));
+				const __m128 normal_x = _mm_set1_ps(normal.x);
+				const __m128 normal_y = _mm_set1_ps(normal.y);
+				const __m128 normal_z = _mm_set1_ps(normal.z);
+				__m128 sum_r = _mm_setzero_ps();
+				__m128 sum_g = _mm_setzero_ps();
+				__m128 sum_b = _mm_setzero_ps();
+				__m128 sum_weight = _mm_setzero_ps();
+				for (int i = 0; i < n_padded; i += 4)
+				{
+					__m128 cosine = _mm_mul_ps(normal_x, _mm_loadu_ps(&texels[0][i]));
+					cosine = _mm_add_ps(cosine, _mm_mul_ps(normal_y, _mm_loadu_ps(&texels[1][i])));
+					cosine = _mm_add_ps(cosine, _mm_mul_ps(normal_z, _mm_loadu_ps(&texels[2][i])));
+					cosine = _mm_max_ps(cosine, _mm_setzero_ps());
+					sum_r = _mm_add_ps(sum_r, _mm_mul_ps(cosine, _mm_loadu_ps(&texels[3][i])));
+					sum_g = _mm_add_ps(sum_g, _mm_mul_ps(cosine, _mm_loadu_ps(&texels[4][i])));
+					sum_b = _mm_add_ps(sum_b, _mm_mul_ps(cosine, _mm_loadu_ps(&texels[5][i])));
+					sum_weight = _mm_add_ps(sum_weight, _mm_mul_ps(cosine, _mm_loadu_ps(&texels[6][i])));
+				}
+
+				const float inverse_weight = 1.0f / glm::max(horizontal_sum(sum_weight), 0.0001f);
+				const float colour[4]{ horizontal_sum(sum_r) * inverse_weight, horizontal_sum(sum_g) * inverse_weight, horizontal_sum(sum_b) * inverse_weight, 1.0f };
+				output[(static_cast<size_t>(face) * output_size + y) * output_size + x] = encode_pixel(colour, is_srgb);
+			}
+		}
+	});
+}
+
+void IblPrefilter::project_spherical_harmonics(const Pixel32* const (&faces)[6], const int face_size, glm::vec3 (&coefficients)[9], const bool is_srgb)
+{
+	FloatCubemap source;
+	build_float_cubemap(faces, face_size, is_srgb, sh_source_size, source);
+	const int level = source.n_levels - 1;
+	const int size = source.sizes[level];
+
+	//Every job sums its rows into its own slot, and the slots get added up in order afterwards so the result doesn't depend on timing.
+	//Each slot holds 9 basis functions times RGB, plus the total solid angle
+	const int n_rows = size * 6;
+	const int n_jobs = (n_rows + rows_per_job - 1) / rows_per_job;
+	std::vector<float> job_sums(static_cast<size_t>(n_jobs) * 28, 0.0f);
+	ResourceManager::get_job_system_instance()->parallel_for(n_jobs, [&](const int job)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 texel_scale = _mm_set1_ps(2.0f / static_cast<float>(size));
+		const __m128 solid_angle_scale = _mm_set1_ps(4.0f / (static_cast<float>(size) * static_cast<float>(size)));
+		__m128 sums[28];
+		for (auto& sum : sums)
+			sum = _mm_setzero_ps();
+
+		const int end_row = glm::min((job + 1) * rows_per_job, n_rows);
+		for (int row = job * rows_per_job; row < end_row; row++)
+		{
+			const int face = row / size;
+			const int y = row % size;
+			const glm::vec3& axis = face_axes[face][0];
+			const glm::vec3& s_axis = face_axes[face][1];
+			const glm::vec3& t_axis = face_axes[face][2];
+			const float v = (static_cast<float>(y) + 0.5f) * 2.0f / static_cast<float>(size) - 1.0f;
+			for (int x = 0; x < size; x += 4)
+			{
+				//Four texels of the row at once, transposed so each register holds one channel. Texels past the end of the row are weighted 0
+				__m128 red = _mm_loadu_ps(source.get_texel(level, face, x, y));
+				__m128 green = _mm_loadu_ps(source.get_texel(level, face, glm::min(x + 1, size - 1), y));
+				__m128 blue = _mm_loadu_ps(source.get_texel(level, face, glm::min(x + 2, size - 1), y));
+				__m128 alpha = _mm_loadu_ps(source.get_texel(level, face, glm::min(x + 3, size - 1), y));
+				_MM_TRANSPOSE4_PS(red, green, blue, alpha);
+				const __m128 valid = _mm_cmplt_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps(static_cast<float>(size - x)));
+
+				const __m128 u = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x) + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)), texel_scale), one);
+				const __m128 inverse_length = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(one, _mm_mul_ps(u, u)), _mm_set1_ps(v * v))));
+				const __m128 dir_x = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(axis.x + v * t_axis.x), _mm_mul_ps(u, _mm_set1_ps(s_axis.x))), inverse_length);
+				const __m128 dir_y = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(axis.y + v * t_axis.y), _mm_mul_ps(u, _mm_set1_ps(s_axis.y))), inverse_length);
+				const __m128 dir_z = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(axis.z + v * t_axis.z), _mm_mul_ps(u, _mm_set1_ps(s_axis.z))), inverse_length);
+				const __m128 solid_angle = _mm_and_ps(valid, _mm_mul_ps(solid_angle_scale, _mm_mul_ps(inverse_length, _mm_mul_ps(inverse_length, inverse_length))));
+
+				const __m128 basis[9]{
+					_mm_set1_ps(0.282095f),
+					_mm_mul_ps(_mm_set1_ps(0.488603f), dir_y),
+					_mm_mul_ps(_mm_set1_ps(0.488603f), dir_z),
+					_mm_mul_ps(_mm_set1_ps(0.488603f), dir_x),
+					_mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dir_x, dir_y)),
+					_mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dir_y, dir_z)),
+					_mm_mul_ps(_mm_set1_ps(0.315392f), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(dir_z, dir_z)), one)),
+					_mm_mul_ps(_mm_set1_ps(1.092548f), _mm_mul_ps(dir_x, dir_z)),
+					_mm_mul_ps(_mm_set1_ps(0.546274f), _mm_sub_ps(_mm_mul_ps(dir_x, dir_x), _mm_mul_ps(dir_y, dir_y))),
+				};
+				for (int i = 0; i < 9; i++)
+				{
+					const __m128 weight = _mm_mul_ps(basis[i], solid_angle);
+					sums[i * 3 + 0] = _mm_add_ps(sums[i * 3 + 0], _mm_mul_ps(weight, red));
+					sums[i * 3 + 1] = _mm_add_ps(sums[i * 3 + 1], _mm_mul_ps(weight, green));
+					sums[i * 3 + 2] = _mm_add_ps(sums[i * 3 + 2], _mm_mul_ps(weight, blue));
+				}
+				sums[27] = _mm_add_ps(sums[27], solid_angle);
+			}
+		}
+
+		for (int i = 0; i < 28; i++)
+			job_sums[static_cast<size_t>(job) * 28 + i] = horizontal_sum(sums[i]);
+	});
+
+	float totals[28]{};
+	for (int job = 0; job < n_jobs; job++)
+		for (int i = 0; i < 28; i++)
+			totals[i] += job_sums[static_cast<size_t>(job) * 28 + i];
+
+	//The texel solid angles are an approximation, so scale them to cover exactly the whole sphere. The cosine lobe scales band 0 by pi,
+	//band 1 by 2pi/3 and band 2 by pi/4, and the extra division by pi is folded in
+	const float normalisation = 4.0f * pi / glm::max(totals[27], 0.0001f);
+	const float band_scales[9]{ 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+	for (int i = 0; i < 9; i++)
+		coefficients[i] = glm::vec3(totals[i * 3 + 0], totals[i * 3 + 1], totals[i * 3 + 2]) * normalisation * band_scales[i];
+}
+
+void IblPrefilter::integrate_brdf(const int size, uint16_t* output)
+{
+	//Every row has one roughness, so its GGX half vectors only get generated once. The view direction lies in the xz plane,
+	//which means only the x and z of the half vectors matter.
+	//The first row is the roughest, the same as the top row of the LUT image this replaces, which was uploaded without flipping it
+	const int n_samples = (brdf_samples + 3) & ~3;
+	ResourceManager::get_job_system_instance()->parallel_for(size, [&](const int y)
+	{
+		const float roughness = 1.0f - (static_cast<float>(y) + 0.5f) / static_cast<float>(size);
+		const float alpha = roughness * roughness;
+		const float alpha_2 = alpha * alpha;
+		std::vector<float> half_x(n_samples);
+		std::vector<float> half_z(n_samples);
+		for (int i = 0; i < n_samples; i++)
+		{
+			const float u = static_cast<float>(i) / static_cast<float>(n_samples);
+			const float v = radical_inverse(static_cast<uint32_t>(i));
+			const float cos_theta = std::sqrt((1.0f - v) / (1.0f + (alpha_2 - 1.0f) * v));
+			const float sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+			half_x[i] = sin_theta * std::cos(2.0f * pi * u);
+			half_z[i] = cos_theta;
+		}
+
+		//Smith geometry term with the k that Karis uses for image based lighting
+		const __m128 k = _mm_set1_ps(alpha * 0.5f);
+		const __m128 one_minus_k = _mm_set1_ps(1.0f - alpha * 0.5f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		for (int x = 0; x < size; x++)
+		{
+			const float n_dot_v = (static_cast<float>(x) + 0.5f) / static_cast<float>(size);
+			const __m128 view_x = _mm_set1_ps(std::sqrt(1.0f - n_dot_v * n_dot_v));
+			const __m128 view_z = _mm_set1_ps(n_dot_v);
+			const __m128 geometry_view = _mm_div_ps(view_z, _mm_add_ps(_mm_mul_ps(view_z, one_minus_k), k));
+			__m128 scale = zero;
+			__m128 bias = zero;
+			for (int i = 0; i < n_samples; i += 4)
+			{
+				const __m128 h_x = _mm_loadu_ps(&half_x[i]);
+				const __m128 h_z = _mm_loadu_ps(&half_z[i]);
+				const __m128 v_dot_h = _mm_max_ps(_mm_add_ps(_mm_mul_ps(view_x, h_x), _mm_mul_ps(view_z, h_z)), zero);
+				const __m128 n_dot_l = _mm_sub_ps(_mm_mul_ps(_mm_add_ps(v_dot_h, v_dot_h), h_z), view_z);
+				const __m128 is_lit = _mm_cmpgt_ps(n_dot_l, zero);
+
+				const __m128 geometry_light = _mm_div_ps(n_dot_l, _mm_add_ps(_mm_mul_ps(n_dot_l, one_minus_k), k));
+				const __m128 visibility = _mm_div_ps(_mm_mul_ps(_mm_mul_ps(geometry_light, geometry_view), v_dot_h), _mm_mul_ps(h_z, view_z));
+				const __m128 weight = _mm_and_ps(is_lit, visibility);
+				const __m128 one_minus_v_dot_h = _mm_sub_ps(one, v_dot_h);
+				const __m128 squared = _mm_mul_ps(one_minus_v_dot_h, one_minus_v_dot_h);
+				const __m128 fresnel = _mm_mul_ps(_mm_mul_ps(squared, squared), one_minus_v_dot_h);
+				scale = _mm_add_ps(scale, _mm_mul_ps(_mm_sub_ps(one, fresnel), weight));
+				bias = _mm_add_ps(bias, _mm_mul_ps(fresnel, weight));
+			}
+
+			const float inverse_samples = 1.0f / static_cast<float>(n_samples);
+			output[(static_cast<size_t>(y) * size + x) * 2 + 0] = glm::packHalf1x16(horizontal_sum(scale) * inverse_samples);
+			output[(static_cast<size_t>(y) * size + x) * 2 + 1] = glm::packHalf1x16(horizontal_sum(bias) * inverse_samples);
+		}
+	});
+}
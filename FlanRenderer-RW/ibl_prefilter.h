@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <glm/vec3.hpp>
+
+struct Pixel32;
+
+//Prefilters an environment cubemap for image based lighting on the CPU. Faces are in the order OpenGL numbers them, and every function
+//writes six faces back to back per mip level. The specular cubemap gets GGX filtered with a higher roughness on every mip
+//(roughness = level / (n_mips - 1)), importance sampled from box filtered mips of the source so few samples still come out smooth.
+//The irradiance cubemap is the cosine weighted average of the whole environment around every direction. The heavy loops work on four
+//channels or four source texels at once with SSE, spread across the job system.
+//The spherical harmonics are the same irradiance as 9 L2 coefficients, already convolved with the cosine lobe and divided by pi, so the sum
+//of coefficient * basis function at a normal gives what the irradiance map would at that normal.
+//The BRDF LUT is the other half of the split sum: the scale (red) and bias (green) to F0 for a given n dot v (u) and 1 - roughness (v), as half floats
+class IblPrefilter
+{
+public:
+	static int get_n_mips(int face_size);
+	static uint32_t get_cubemap_size(int face_size, int n_mips);
+	static void prefilter_specular(const Pixel32* const (&faces)[6], int face_size, Pixel32* output, int n_mips, bool is_srgb);
+	static void convolve_irradiance(const Pixel32* const (&faces)[6], int face_size, Pixel32* output, int output_size, bool is_srgb);
+	static void project_spherical_harmonics(const Pixel32* const (&faces)[6], int face_size, glm::vec3 (&coefficients)[9], bool is_srgb);
+	static void integrate_brdf(int size, uint16_t* output);
+	inline static int specular_samples = 64;
+	inline static int irradiance_size = 32;
+	inline static int irradiance_source_size = 32;	//The environment is box filtered down to this before convolving, the result is too smooth for finer detail to matter
+	inline static int sh_source_size = 64;
+	inline static int brdf_lut_size = 128;
+	inline static int brdf_samples = 1024;
+	inline static int rows_per_job = 8;
+};
@@ -0,0 +1,153 @@
+#include "job_system.h"
+
+#include <algorithm>
+
+JobSystem::JobSystem(int n_threads)
+{
+	//If no thread count was given, leave one core for the main thread
+	if (n_threads <= 0)
+	{
+		n_threads = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+		if (n_threads < 1)
+			n_threads = 1;
+	}
+
+	for (int i = 0; i < n_threads; i++)
+	{
+		threads.emplace_back(&JobSystem::worker_loop, this);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	shutdown();
+}
+
+//Lets the workers finish every queued job, then joins them. Calling it again does nothing
+void JobSystem::shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		shutting_down = true;
+	}
+	job_available.notify_all();
+	for (auto& thread : threads)
+	{
+		thread.join();
+	}
+	threads.clear();
+}
+
+void JobSystem::schedule(std::function<void()> job)
+{
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		jobs.push(std::move(job));
+	}
+	job_available.notify_one();
+}
+
+//Runs the oldest queued job on the calling thread, or returns false if there is none. Threads that wait for other jobs call this
+//instead of only blocking, so the jobs they wait on still get done when every worker is waiting too
+bool JobSystem::try_run_job()
+{
+	std::function<void()> job;
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		if (jobs.empty())
+			return false;
+		job = std::move(jobs.front());
+		jobs.pop();
+		jobs_in_progress++;
+	}
+
+	job();
+
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		jobs_in_progress--;
+	}
+	jobs_finished.notify_all();
+	return true;
+}
+
+//Blocks until the queue is empty and no worker is running a job
+void JobSystem::wait_idle()
+{
+	std::unique_lock<std::mutex> lock(jobs_mutex);
+	jobs_finished.wait(lock, [this] { return jobs.empty() && jobs_in_progress == 0; });
+}
+
+//Runs function(i) for every i in [0, n_items) on the workers and the calling thread, and returns once all of them are done.
+//The calling thread takes items too, so this is safe to call from inside a job even when every worker is busy
+void JobSystem::parallel_for(const int n_items, const std::function<void(int)>& function)
+{
+	if (n_items <= 0)
+		return;
+
+	//Shared, since helpers that only start after everything is done still look at it
+	struct ParallelForState
+	{
+		std::function<void(int)> function;
+		int n_items = 0;
+		std::atomic<int> next_item{ 0 };
+		std::atomic<int> n_items_done{ 0 };
+		std::mutex done_mutex;
+		std::condition_variable done;
+	};
+	auto state = std::make_shared<ParallelForState>();
+	state->function = function;
+	state->n_items = n_items;
+
+	const auto work = [state]()
+	{
+		while (true)
+		{
+			const int item = state->next_item++;
+			if (item >= state->n_items)
+				return;
+			state->function(item);
+			if (++state->n_items_done == state->n_items)
+			{
+				std::lock_guard<std::mutex> lock(state->done_mutex);
+				state->done.notify_all();
+			}
+		}
+	};
+
+	const int n_helpers = std::min(n_items - 1, get_thread_count());
+	for (int i = 0; i < n_helpers; i++)
+		schedule(work);
+	work();
+
+	//Only items that another thread already started can still be running at this point
+	std::unique_lock<std::mutex> lock(state->done_mutex);
+	state->done.wait(lock, [&state] { return state->n_items_done == state->n_items; });
+}
+
+void JobSystem::worker_loop()
+{
+	while (true)
+	{
+		//Wait for a job to show up
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(jobs_mutex);
+			job_available.wait(lock, [this] { return shutting_down || !jobs.empty(); });
+			if (shutting_down && jobs.empty())
+				return;
+			job = std::move(jobs.front());
+			jobs.pop();
+			jobs_in_progress++;
+		}
+
+		//Run it outside of the lock so other workers can pick up jobs in the meantime
+		job();
+
+		{
+			std::lock_guard<std::mutex> lock(jobs_mutex);
+			jobs_in_progress--;
+		}
+		jobs_finished.notify_all();
+	}
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class JobSystem
+{
+public:
+	JobSystem(int n_threads = 0);
+	~JobSystem();
+	void schedule(std::function<void()> job);
+	bool try_run_job();
+	void wait_idle();
+	void shutdown();
+	void parallel_for(int n_items, const std::function<void(int)>& function);
+	int get_thread_count() const { return static_cast<int>(threads.size()); }
+
+private:
+	void worker_loop();
+
+	std::vector<std::thread> threads;
+	std::queue<std::function<void()>> jobs;
+	std::mutex jobs_mutex;
+	std::condition_variable job_available;
+	std::condition_variable jobs_finished;
+	int jobs_in_progress = 0;
+	bool shutting_down = false;
+};
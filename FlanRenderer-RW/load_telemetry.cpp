@@ -0,0 +1,123 @@
+#include "load_telemetry.h"
+
+#include <atomic>
+#include <fstream>
+
+#include "logger.h"
+
+void LoadTelemetry::set_name(const uint32_t hash, const std::string& name, const std::string& type)
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	LoadRecord& record = get_record_locked(hash);
+	record.name = name;
+	record.type = type;
+}
+
+void LoadTelemetry::add_phase_time(const uint32_t hash, const LoadPhase phase, const double milliseconds)
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	LoadRecord& record = get_record_locked(hash);
+	record.phase_ms[static_cast<int>(phase)] += milliseconds;
+	record.phase_thread[static_cast<int>(phase)] = get_thread_index();
+}
+
+void LoadTelemetry::add_bytes_read(const uint32_t hash, const uint64_t bytes)
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	get_record_locked(hash).bytes_read += bytes;
+}
+
+void LoadTelemetry::add_request_dedupe(const uint32_t hash)
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	get_record_locked(hash).request_dedupes++;
+}
+
+void LoadTelemetry::add_asset_cache_result(const uint32_t hash, const bool hit)
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	LoadRecord& record = get_record_locked(hash);
+	if (hit)
+		record.asset_cache_hits++;
+	else
+		record.asset_cache_misses++;
+}
+
+std::vector<LoadRecord> LoadTelemetry::get_records()
+{
+	std::lock_guard<std::mutex> lock(records_mutex);
+	return records;
+}
+
+//Writes every record to a JSON file, so runs can be compared by scripts
+bool LoadTelemetry::dump_json(const std::string& path)
+{
+	std::ofstream file(path);
+	if (!file.is_open())
+	{
+		Logger::logf("[ERROR] Failed to write load telemetry to '%s'!\n", path.c_str());
+		return false;
+	}
+
+	const std::vector<LoadRecord> records_copy = get_records();
+	file << "{\n\t\"assets\": [\n";
+	for (size_t i = 0; i < records_copy.size(); i++)
+	{
+		const LoadRecord& record = records_copy[i];
+
+		//Escape the name, paths could contain backslashes
+		std::string escaped_name;
+		for (const char character : record.name)
+		{
+			if (character == '\\' || character == '"')
+				escaped_name += '\\';
+			escaped_name += character;
+		}
+
+		file << "\t\t{ \"name\": \"" << escaped_name << "\", \"type\": \"" << record.type << "\", \"bytes_read\": " << record.bytes_read;
+		file << ", \"request_dedupes\": " << record.request_dedupes << ", \"asset_cache_hits\": " << record.asset_cache_hits << ", \"asset_cache_misses\": " << record.asset_cache_misses;
+		file << ", \"total_ms\": " << record.total_ms() << ", \"phases\": {";
+		for (int phase = 0; phase < static_cast<int>(LoadPhase::count); phase++)
+		{
+			file << (phase == 0 ? " " : ", ") << "\"" << phase_name(static_cast<LoadPhase>(phase)) << "\": { \"ms\": " << record.phase_ms[phase] << ", \"thread\": " << record.phase_thread[phase] << " }";
+		}
+		file << " } }" << (i + 1 < records_copy.size() ? "," : "") << "\n";
+	}
+	file << "\t]\n}\n";
+
+	Logger::logf("Wrote load telemetry for %i assets to '%s'\n", static_cast<int>(records_copy.size()), path.c_str());
+	return true;
+}
+
+const char* LoadTelemetry::phase_name(const LoadPhase phase)
+{
+	switch (phase)
+	{
+	case LoadPhase::file_io: return "file_io";
+	case LoadPhase::decode: return "decode";
+	case LoadPhase::gltf_parse: return "gltf_parse";
+	case LoadPhase::vertex_processing: return "vertex_processing";
+	case LoadPhase::gpu_upload: return "gpu_upload";
+	default: return "unknown";
+	}
+}
+
+//Small sequential thread indices are easier to read than std::thread::id
+int LoadTelemetry::get_thread_index()
+{
+	static std::atomic<int> next_thread_index{ 0 };
+	thread_local int thread_index = next_thread_index++;
+	return thread_index;
+}
+
+LoadRecord& LoadTelemetry::get_record_locked(const uint32_t hash)
+{
+	const auto index = record_indices.find(hash);
+	if (index != record_indices.end())
+		return records[index->second];
+
+	record_indices[hash] = records.size();
+	records.emplace_back();
+	records.back().hash = hash;
+	return records.back();
+}
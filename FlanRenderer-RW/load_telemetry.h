@@ -0,0 +1,75 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class LoadPhase
+{
+	file_io,
+	decode,
+	gltf_parse,
+	vertex_processing,
+	gpu_upload,
+	count,
+};
+
+struct LoadRecord
+{
+	uint32_t hash = 0;
+	std::string name;
+	std::string type;
+	uint64_t bytes_read = 0;
+	double phase_ms[static_cast<int>(LoadPhase::count)]{};
+	int phase_thread[static_cast<int>(LoadPhase::count)]{ -1, -1, -1, -1, -1 };
+	uint32_t request_dedupes = 0;		//Requests that found the resource already queued, loading or loaded, so they didn't load it again
+	uint32_t asset_cache_hits = 0;		//Lookups of the resource's cooked data in the asset cache
+	uint32_t asset_cache_misses = 0;
+	double total_ms() const
+	{
+		double total = 0.0;
+		for (const double ms : phase_ms)
+			total += ms;
+		return total;
+	}
+};
+
+//Collects per-asset load statistics from every loading thread, keyed by the resource hash
+class LoadTelemetry
+{
+public:
+	static void set_name(uint32_t hash, const std::string& name, const std::string& type);
+	static void add_phase_time(uint32_t hash, LoadPhase phase, double milliseconds);
+	static void add_bytes_read(uint32_t hash, uint64_t bytes);
+	static void add_request_dedupe(uint32_t hash);
+	static void add_asset_cache_result(uint32_t hash, bool hit);
+	static std::vector<LoadRecord> get_records();
+	static bool dump_json(const std::string& path);
+	static const char* phase_name(LoadPhase phase);
+	static int get_thread_index();
+
+private:
+	static LoadRecord& get_record_locked(uint32_t hash);
+	inline static std::unordered_map<uint32_t, size_t> record_indices;
+	inline static std::vector<LoadRecord> records;
+	inline static std::mutex records_mutex;
+};
+
+//Adds the time between construction and destruction to a load phase
+class LoadTimer
+{
+public:
+	LoadTimer(const uint32_t hash_, const LoadPhase phase_) : hash(hash_), phase(phase_), start(std::chrono::steady_clock::now()) {}
+	~LoadTimer()
+	{
+		const std::chrono::duration<double, std::milli> duration = std::chrono::steady_clock::now() - start;
+		LoadTelemetry::add_phase_time(hash, phase, duration.count());
+	}
+
+private:
+	uint32_t hash;
+	LoadPhase phase;
+	std::chrono::time_point<std::chrono::steady_clock> start;
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include <imgui.h>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <vector>
 #include <glm/vec2.hpp>
@@ -18,6 +19,7 @@ public:
 		std::string text;
 	};
 	inline static std::vector<Message> messages;
+	inline static std::mutex messages_mutex;
 
 	static void logf(const char* fmt...)
 	{
@@ -70,6 +72,7 @@ public:
 		}
 
 		va_end(args);
+		std::lock_guard<std::mutex> lock(messages_mutex);
 		Message message{};
 		if (msg._Starts_with("[ERROR]"))
 		{
@@ -0,0 +1,69 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "load_telemetry.h"
+#include "resource_manager.h"
+
+//Empty files can't be mapped, so those count as failing to open too
+MappedFile::MappedFile(const std::string& path)
+{
+	LoadTimer timer(ResourceManager::generate_hash_from_string(path), LoadPhase::file_io);
+
+#ifdef _WIN32
+	file_handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file_handle == INVALID_HANDLE_VALUE)
+	{
+		file_handle = nullptr;
+		return;
+	}
+	LARGE_INTEGER file_size;
+	if (!GetFileSizeEx(file_handle, &file_size) || file_size.QuadPart == 0)
+		return;
+	mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping_handle == nullptr)
+		return;
+	data = static_cast<const char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+	if (data != nullptr)
+		size = static_cast<size_t>(file_size.QuadPart);
+#else
+	file_descriptor = open(path.c_str(), O_RDONLY);
+	if (file_descriptor < 0)
+		return;
+	struct stat file_stat;
+	if (fstat(file_descriptor, &file_stat) != 0 || file_stat.st_size == 0)
+		return;
+	void* mapping = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+	if (mapping == MAP_FAILED)
+		return;
+	madvise(mapping, static_cast<size_t>(file_stat.st_size), MADV_SEQUENTIAL);
+	data = static_cast<const char*>(mapping);
+	size = static_cast<size_t>(file_stat.st_size);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+	if (data != nullptr)
+		UnmapViewOfFile(data);
+	if (mapping_handle != nullptr)
+		CloseHandle(mapping_handle);
+	if (file_handle != nullptr)
+		CloseHandle(file_handle);
+#else
+	if (data != nullptr)
+		munmap(const_cast<char*>(data), size);
+	if (file_descriptor >= 0)
+		close(file_descriptor);
+#endif
+}
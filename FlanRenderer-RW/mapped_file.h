@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+//Read-only memory mapping of a whole file. The OS pages the data in as it gets touched, so nothing is copied up front, and the
+//pages can be dropped again under memory pressure since they're backed by the file
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::string& path);
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	bool is_open() const { return data != nullptr; }
+	const char* get_data() const { return data; }
+	size_t get_size() const { return size; }
+
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#else
+	int file_descriptor = -1;
+#endif
+};
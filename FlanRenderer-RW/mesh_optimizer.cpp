@@ -0,0 +1,336 @@
+#include "mesh_optimizer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "logger.h"
+#include "renderer_structs.h"
+
+//Tuning values from Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+constexpr int forsyth_cache_size = 32;
+constexpr int forsyth_max_valence = 32;
+constexpr float forsyth_cache_decay_power = 1.5f;
+constexpr float forsyth_last_triangle_score = 0.75f;
+constexpr float forsyth_valence_boost_scale = 2.0f;
+constexpr float forsyth_valence_boost_power = 0.5f;
+
+struct ForsythScoreTables
+{
+	float cache_position[forsyth_cache_size];
+	float valence[forsyth_max_valence + 1];
+	ForsythScoreTables()
+	{
+		//Vertices used by the last triangle get a fixed score, so the next triangle doesn't just reuse all of them
+		for (int i = 0; i < forsyth_cache_size; i++)
+		{
+			if (i < 3)
+				cache_position[i] = forsyth_last_triangle_score;
+			else
+				cache_position[i] = powf(1.0f - static_cast<float>(i - 3) / static_cast<float>(forsyth_cache_size - 3), forsyth_cache_decay_power);
+		}
+
+		//Vertices with few triangles left get a boost, so lone triangles don't get left behind
+		valence[0] = 0.0f;
+		for (int i = 1; i <= forsyth_max_valence; i++)
+			valence[i] = forsyth_valence_boost_scale * powf(static_cast<float>(i), -forsyth_valence_boost_power);
+	}
+};
+
+static float forsyth_vertex_score(const int cache_position, const int remaining_valence)
+{
+	static const ForsythScoreTables tables;
+	if (remaining_valence == 0)
+		return -1.0f;
+	float score = cache_position >= 0 ? tables.cache_position[cache_position] : 0.0f;
+	score += tables.valence[std::min(remaining_valence, forsyth_max_valence)];
+	return score;
+}
+
+//FIFO post-transform cache, like most hardware has. A vertex is in the cache if fewer than cache_size misses happened since it was loaded
+struct FifoCacheSimulation
+{
+	std::vector<int> timestamps;
+	int time = 0;
+	int cache_size = 16;
+	FifoCacheSimulation(const int n_vertices, const int cache_size_) : timestamps(n_vertices, INT_MIN / 2), cache_size(cache_size_) {}
+	int access(const uint32_t vertex)
+	{
+		if (time - timestamps[vertex] < cache_size)
+			return 0;
+		timestamps[vertex] = time++;
+		return 1;
+	}
+	int access_triangle(const uint32_t* triangle) { return access(triangle[0]) + access(triangle[1]) + access(triangle[2]); }
+	void flush() { time += cache_size + 1; }
+};
+
+//Runs all optimizations in order, and logs how much the vertex cache hit rate improved
+void MeshOptimizer::optimize_mesh(MeshBufferData& mesh)
+{
+	const float acmr_before = calculate_acmr(mesh.indices, mesh.n_indices, mesh.n_verts);
+	optimize_vertex_cache(mesh.indices, mesh.n_indices, mesh.n_verts);
+	optimize_overdraw(mesh.indices, mesh.n_indices, mesh.verts, mesh.n_verts);
+	mesh.n_verts = optimize_vertex_fetch(mesh.verts, mesh.indices, mesh.n_indices, mesh.n_verts);
+	const float acmr_after = calculate_acmr(mesh.indices, mesh.n_indices, mesh.n_verts);
+	Logger::logf("Optimized mesh with %i triangles, ACMR %f -> %f\n", mesh.n_indices / 3, acmr_before, acmr_after);
+}
+
+//Reorders triangles so vertices get reused while they're still in the post-transform cache. This greedily emits the triangle with the
+//highest score, where vertices score higher the more recently they were used and the fewer unemitted triangles they have left
+void MeshOptimizer::optimize_vertex_cache(uint32_t* indices, const int n_indices, const int n_vertices)
+{
+	const int n_triangles = n_indices / 3;
+	if (n_triangles == 0)
+		return;
+
+	//Find which triangles use each vertex. The first remaining_valence entries of each vertex's range are the triangles not emitted yet
+	std::vector<int> remaining_valence(n_vertices, 0);
+	for (int i = 0; i < n_triangles * 3; i++)
+		remaining_valence[indices[i]]++;
+	std::vector<int> adjacency_offsets(n_vertices + 1, 0);
+	for (int i = 0; i < n_vertices; i++)
+		adjacency_offsets[i + 1] = adjacency_offsets[i] + remaining_valence[i];
+	std::vector<int> adjacency(n_triangles * 3);
+	{
+		std::vector<int> fill_positions(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (int triangle = 0; triangle < n_triangles; triangle++)
+			for (int corner = 0; corner < 3; corner++)
+				adjacency[fill_positions[indices[triangle * 3 + corner]]++] = triangle;
+	}
+
+	//Initial scores
+	std::vector<int> cache_positions(n_vertices, -1);
+	std::vector<float> vertex_scores(n_vertices);
+	for (int i = 0; i < n_vertices; i++)
+		vertex_scores[i] = forsyth_vertex_score(-1, remaining_valence[i]);
+	std::vector<float> triangle_scores(n_triangles);
+	std::vector<char> triangle_emitted(n_triangles, 0);
+	int best_triangle = 0;
+	for (int triangle = 0; triangle < n_triangles; triangle++)
+	{
+		const uint32_t* corners = indices + triangle * 3;
+		triangle_scores[triangle] = vertex_scores[corners[0]] + vertex_scores[corners[1]] + vertex_scores[corners[2]];
+		if (triangle_scores[triangle] > triangle_scores[best_triangle])
+			best_triangle = triangle;
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(n_triangles * 3);
+	int cache[forsyth_cache_size + 3];
+	int cache_count = 0;
+	int next_unemitted = 0;
+	for (int n_emitted = 0; n_emitted < n_triangles; n_emitted++)
+	{
+		//If nothing in the cache has triangles left, continue with the next triangle in the original order
+		if (best_triangle < 0)
+		{
+			while (triangle_emitted[next_unemitted])
+				next_unemitted++;
+			best_triangle = next_unemitted;
+		}
+
+		//Emit the triangle, and remove it from its vertices' remaining triangles
+		const uint32_t* corners = indices + best_triangle * 3;
+		triangle_emitted[best_triangle] = 1;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			const uint32_t vertex = corners[corner];
+			output.push_back(vertex);
+			int* triangles = &adjacency[adjacency_offsets[vertex]];
+			for (int i = 0; i < remaining_valence[vertex]; i++)
+			{
+				if (triangles[i] == best_triangle)
+				{
+					std::swap(triangles[i], triangles[remaining_valence[vertex] - 1]);
+					break;
+				}
+			}
+			remaining_valence[vertex]--;
+		}
+
+		//Move the triangle's vertices to the front of the cache. Whatever gets pushed past the end is evicted
+		int new_cache[forsyth_cache_size + 3];
+		int new_cache_count = 0;
+		for (int corner = 0; corner < 3; corner++)
+		{
+			if (std::find(new_cache, new_cache + new_cache_count, static_cast<int>(corners[corner])) == new_cache + new_cache_count)
+				new_cache[new_cache_count++] = static_cast<int>(corners[corner]);
+		}
+		const int n_triangle_vertices = new_cache_count;
+		for (int i = 0; i < cache_count; i++)
+		{
+			if (std::find(new_cache, new_cache + n_triangle_vertices, cache[i]) == new_cache + n_triangle_vertices)
+				new_cache[new_cache_count++] = cache[i];
+		}
+		for (int i = 0; i < new_cache_count; i++)
+		{
+			cache_positions[new_cache[i]] = i < forsyth_cache_size ? i : -1;
+			vertex_scores[new_cache[i]] = forsyth_vertex_score(cache_positions[new_cache[i]], remaining_valence[new_cache[i]]);
+		}
+		cache_count = std::min(new_cache_count, forsyth_cache_size);
+		memcpy(cache, new_cache, sizeof(int) * cache_count);
+
+		//Only triangles touching the cache changed score, so the next best triangle is among them
+		best_triangle = -1;
+		float best_score = -1.0f;
+		for (int i = 0; i < new_cache_count; i++)
+		{
+			const int vertex = new_cache[i];
+			const int* triangles = &adjacency[adjacency_offsets[vertex]];
+			for (int j = 0; j < remaining_valence[vertex]; j++)
+			{
+				const uint32_t* triangle_corners = indices + triangles[j] * 3;
+				const float score = vertex_scores[triangle_corners[0]] + vertex_scores[triangle_corners[1]] + vertex_scores[triangle_corners[2]];
+				triangle_scores[triangles[j]] = score;
+				if (score > best_score)
+				{
+					best_score = score;
+					best_triangle = triangles[j];
+				}
+			}
+		}
+	}
+
+	memcpy(indices, output.data(), sizeof(uint32_t) * output.size());
+}
+
+//Reorders clusters of triangles so the ones on the outside of the mesh, facing outwards, are drawn first and occlude the rest.
+//This follows "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw" (Sander et al.): the vertex cache order is split into
+//clusters wherever that doesn't raise the cluster's ACMR above threshold times the original, so cache efficiency is mostly kept
+void MeshOptimizer::optimize_overdraw(uint32_t* indices, const int n_indices, const Vertex* vertices, const int n_vertices, const float threshold)
+{
+	const int n_triangles = n_indices / 3;
+	if (n_triangles < 2)
+		return;
+
+	//Hard boundaries: triangles where the cache order jumped somewhere new, so none of its vertices were in the cache
+	std::vector<int> hard_boundaries;
+	{
+		FifoCacheSimulation cache(n_vertices, 16);
+		for (int triangle = 0; triangle < n_triangles; triangle++)
+		{
+			if (cache.access_triangle(indices + triangle * 3) == 3 || triangle == 0)
+				hard_boundaries.push_back(triangle);
+		}
+		hard_boundaries.push_back(n_triangles);
+	}
+
+	//Soft boundaries: split hard clusters further, starting a new cluster whenever the current one is within the ACMR target
+	std::vector<int> cluster_starts;
+	{
+		FifoCacheSimulation cache(n_vertices, 16);
+		for (size_t hard_cluster = 0; hard_cluster + 1 < hard_boundaries.size(); hard_cluster++)
+		{
+			const int start = hard_boundaries[hard_cluster];
+			const int end = hard_boundaries[hard_cluster + 1];
+
+			cache.flush();
+			int cluster_misses = 0;
+			for (int triangle = start; triangle < end; triangle++)
+				cluster_misses += cache.access_triangle(indices + triangle * 3);
+			const float target_acmr = threshold * static_cast<float>(cluster_misses) / static_cast<float>(end - start);
+
+			cache.flush();
+			cluster_starts.push_back(start);
+			int misses = 0;
+			int cluster_start = start;
+			for (int triangle = start; triangle < end; triangle++)
+			{
+				misses += cache.access_triangle(indices + triangle * 3);
+				if (triangle + 1 < end && static_cast<float>(misses) / static_cast<float>(triangle + 1 - cluster_start) <= target_acmr)
+				{
+					cluster_starts.push_back(triangle + 1);
+					cluster_start = triangle + 1;
+					misses = 0;
+					cache.flush();
+				}
+			}
+		}
+		cluster_starts.push_back(n_triangles);
+	}
+	const int n_clusters = static_cast<int>(cluster_starts.size()) - 1;
+
+	//Find the area weighted centroid and normal of each cluster, and of the whole mesh
+	std::vector<glm::vec3> cluster_centroids(n_clusters, glm::vec3(0.0f));
+	std::vector<glm::vec3> cluster_normals(n_clusters, glm::vec3(0.0f));
+	glm::vec3 mesh_centroid(0.0f);
+	float mesh_area = 0.0f;
+	for (int cluster = 0; cluster < n_clusters; cluster++)
+	{
+		float cluster_area = 0.0f;
+		for (int triangle = cluster_starts[cluster]; triangle < cluster_starts[cluster + 1]; triangle++)
+		{
+			const glm::vec3& a = vertices[indices[triangle * 3 + 0]].position;
+			const glm::vec3& b = vertices[indices[triangle * 3 + 1]].position;
+			const glm::vec3& c = vertices[indices[triangle * 3 + 2]].position;
+			const glm::vec3 normal = glm::cross(b - a, c - a);
+			const float area = glm::length(normal);
+			cluster_centroids[cluster] += (a + b + c) * (area / 3.0f);
+			cluster_normals[cluster] += normal;
+			cluster_area += area;
+		}
+		mesh_centroid += cluster_centroids[cluster];
+		mesh_area += cluster_area;
+		if (cluster_area > 0.0f)
+			cluster_centroids[cluster] /= cluster_area;
+	}
+	if (mesh_area > 0.0f)
+		mesh_centroid /= mesh_area;
+
+	//Clusters further out along their normal go first
+	std::vector<float> sort_keys(n_clusters);
+	for (int cluster = 0; cluster < n_clusters; cluster++)
+	{
+		const float normal_length = glm::length(cluster_normals[cluster]);
+		sort_keys[cluster] = normal_length > 0.0f ? glm::dot(cluster_centroids[cluster] - mesh_centroid, cluster_normals[cluster] / normal_length) : 0.0f;
+	}
+	std::vector<int> cluster_order(n_clusters);
+	for (int cluster = 0; cluster < n_clusters; cluster++)
+		cluster_order[cluster] = cluster;
+	std::stable_sort(cluster_order.begin(), cluster_order.end(), [&sort_keys](const int lhs, const int rhs) { return sort_keys[lhs] > sort_keys[rhs]; });
+
+	//Write the triangles back in cluster order
+	std::vector<uint32_t> output;
+	output.reserve(n_triangles * 3);
+	for (const int cluster : cluster_order)
+		output.insert(output.end(), indices + cluster_starts[cluster] * 3, indices + cluster_starts[cluster + 1] * 3);
+	memcpy(indices, output.data(), sizeof(uint32_t) * output.size());
+}
+
+//Reorders vertices in the order the index buffer first uses them, so vertex fetches move through memory linearly.
+//Vertices that aren't used are dropped, and the new vertex count is returned
+int MeshOptimizer::optimize_vertex_fetch(Vertex* vertices, uint32_t* indices, const int n_indices, const int n_vertices)
+{
+	std::vector<uint32_t> remap(n_vertices, UINT32_MAX);
+	std::vector<Vertex> reordered_vertices;
+	reordered_vertices.reserve(n_vertices);
+	for (int i = 0; i < n_indices; i++)
+	{
+		uint32_t& new_index = remap[indices[i]];
+		if (new_index == UINT32_MAX)
+		{
+			new_index = static_cast<uint32_t>(reordered_vertices.size());
+			reordered_vertices.push_back(vertices[indices[i]]);
+		}
+		indices[i] = new_index;
+	}
+	if (!reordered_vertices.empty())
+		memcpy(vertices, reordered_vertices.data(), sizeof(Vertex) * reordered_vertices.size());
+	return static_cast<int>(reordered_vertices.size());
+}
+
+//Average cache miss ratio: the number of vertex shader invocations per triangle, with a FIFO cache of the given size.
+//0.5 is the best a regular grid can do, 3 means no vertex is ever reused
+float MeshOptimizer::calculate_acmr(const uint32_t* indices, const int n_indices, const int n_vertices, const int cache_size)
+{
+	if (n_indices < 3)
+		return 0.0f;
+	FifoCacheSimulation cache(n_vertices, cache_size);
+	int misses = 0;
+	for (int i = 0; i < n_indices; i++)
+		misses += cache.access(indices[i]);
+	return static_cast<float>(misses) / static_cast<float>(n_indices / 3);
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include <cstdint>
+
+struct Vertex;
+struct MeshBufferData;
+
+//Reorders mesh data so the GPU does less work drawing it. None of these change what the mesh looks like
+class MeshOptimizer
+{
+public:
+	static void optimize_mesh(MeshBufferData& mesh);
+	static void optimize_vertex_cache(uint32_t* indices, int n_indices, int n_vertices);
+	static void optimize_overdraw(uint32_t* indices, int n_indices, const Vertex* vertices, int n_vertices, float threshold = 1.05f);
+	static int optimize_vertex_fetch(Vertex* vertices, uint32_t* indices, int n_indices, int n_vertices);
+	static float calculate_acmr(const uint32_t* indices, int n_indices, int n_vertices, int cache_size = 16);
+};
@@ -0,0 +1,316 @@
+#include "mesh_simplifier.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+#include <glm/geometric.hpp>
+
+#include "asset_cache.h"
+#include "common_defines.h"
+#include "logger.h"
+#include "mesh_optimizer.h"
+#include "renderer_structs.h"
+#include "resource_manager.h"
+
+constexpr float lod_max_relative_error = 0.1f;	//Simplification stops once it would move the surface this far, relative to the mesh's radius
+constexpr float lod_min_reduction = 0.85f;		//A level that keeps more than this much of the previous level's triangles isn't worth drawing
+constexpr int lod_min_triangles = 32;
+
+//Sum of squared distances to a set of planes, as a symmetric 4x4 matrix. Doubles, since the terms cancel out a lot near the minimum
+struct Quadric
+{
+	double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+	double b0 = 0, b1 = 0, b2 = 0;
+	double c = 0;
+	double weight = 0;
+
+	void add_plane(const glm::vec3& normal, const float distance, const double plane_weight)
+	{
+		a00 += plane_weight * normal.x * normal.x; a01 += plane_weight * normal.x * normal.y; a02 += plane_weight * normal.x * normal.z;
+		a11 += plane_weight * normal.y * normal.y; a12 += plane_weight * normal.y * normal.z; a22 += plane_weight * normal.z * normal.z;
+		b0 += plane_weight * normal.x * distance; b1 += plane_weight * normal.y * distance; b2 += plane_weight * normal.z * distance;
+		c += plane_weight * distance * distance;
+		weight += plane_weight;
+	}
+	void add(const Quadric& other)
+	{
+		a00 += other.a00; a01 += other.a01; a02 += other.a02; a11 += other.a11; a12 += other.a12; a22 += other.a22;
+		b0 += other.b0; b1 += other.b1; b2 += other.b2;
+		c += other.c;
+		weight += other.weight;
+	}
+	//Weighted average of the squared distances, so the error is in model space units squared no matter how big the triangles are
+	float evaluate(const glm::vec3& p) const
+	{
+		const double x = p.x, y = p.y, z = p.z;
+		const double error = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + a11 * y * y + 2 * a12 * y * z + a22 * z * z + 2 * (b0 * x + b1 * y + b2 * z) + c;
+		return weight > 0.0 ? static_cast<float>(std::fabs(error) / weight) : 0.0f;
+	}
+};
+
+struct EdgeCollapse
+{
+	uint32_t from;
+	uint32_t to;
+	float cost;
+};
+
+//Generates up to max_mesh_lods levels of detail, each with about half the triangles of the previous one. The levels get appended to
+//the mesh's index buffer, and lods[0] covers the original indices
+void MeshSimplifier::generate_lods(MeshBufferData& mesh)
+{
+	mesh.n_lods = 1;
+	mesh.lods[0] = { 0, static_cast<uint32_t>(mesh.n_indices), 0, 0, 0.0f };
+
+	//The error limit is relative to the mesh's size, so big and small meshes simplify equally far
+	glm::vec3 min_pos(FLT_MAX);
+	glm::vec3 max_pos(-FLT_MAX);
+	for (int i = 0; i < mesh.n_verts; i++)
+	{
+		min_pos = glm::min(min_pos, mesh.verts[i].position);
+		max_pos = glm::max(max_pos, mesh.verts[i].position);
+	}
+	if (mesh.n_verts == 0)
+		return;
+	const float max_error = glm::length(max_pos - min_pos) * 0.5f * lod_max_relative_error;
+
+	//Simplify each level from the previous one, which is a lot faster than starting over. The errors add up, so the recorded error is a
+	//bound on the distance to the original surface
+	std::vector<std::vector<uint32_t>> lod_indices;
+	const uint32_t* previous_indices = mesh.indices;
+	int previous_n_indices = mesh.n_indices;
+	float total_error = 0.0f;
+	while (mesh.n_lods < max_mesh_lods)
+	{
+		const int target_index_count = (previous_n_indices / 6) * 3;
+		if (target_index_count < lod_min_triangles * 3)
+			break;
+
+		float lod_error = 0.0f;
+		std::vector<uint32_t> simplified = simplify(previous_indices, previous_n_indices, mesh.verts, mesh.n_verts, target_index_count, max_error - total_error, lod_error);
+		if (static_cast<float>(simplified.size()) > static_cast<float>(previous_n_indices) * lod_min_reduction)
+			break;
+		MeshOptimizer::optimize_vertex_cache(simplified.data(), static_cast<int>(simplified.size()), mesh.n_verts);
+
+		total_error += lod_error;
+		lod_indices.push_back(std::move(simplified));
+		previous_indices = lod_indices.back().data();
+		previous_n_indices = static_cast<int>(lod_indices.back().size());
+		mesh.lods[mesh.n_lods++] = { 0, static_cast<uint32_t>(previous_n_indices), 0, 0, total_error };
+	}
+	if (lod_indices.empty())
+		return;
+
+	//Put all levels in one index buffer
+	int total_indices = mesh.n_indices;
+	for (const auto& indices : lod_indices)
+		total_indices += static_cast<int>(indices.size());
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - index buffers";
+	uint32_t* all_indices = static_cast<uint32_t*>(dynamic_allocate(static_cast<uint32_t>(sizeof(uint32_t) * total_indices)));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	memcpy(all_indices, mesh.indices, sizeof(uint32_t) * mesh.n_indices);
+	uint32_t offset = static_cast<uint32_t>(mesh.n_indices);
+	for (int lod = 1; lod < mesh.n_lods; lod++)
+	{
+		memcpy(all_indices + offset, lod_indices[lod - 1].data(), sizeof(uint32_t) * lod_indices[lod - 1].size());
+		mesh.lods[lod].index_offset = offset;
+		offset += mesh.lods[lod].index_count;
+	}
+	dynamic_free(mesh.indices);
+	mesh.indices = all_indices;
+	mesh.n_indices = total_indices;
+
+	Logger::logf("Generated %i LODs, the last one has %i triangles and error %f\n", mesh.n_lods, mesh.lods[mesh.n_lods - 1].index_count / 3, total_error);
+}
+
+//Collapses edges until the index count is at or below the target, or until every collapse left would move the surface further than
+//max_error. Vertices on open borders and UV or normal seams are locked, so the silhouette and texture layout stay intact
+std::vector<uint32_t> MeshSimplifier::simplify(const uint32_t* indices, const int n_indices, const Vertex* vertices, const int n_vertices, const int target_index_count, const float max_error, float& error_out)
+{
+	error_out = 0.0f;
+	std::vector<uint32_t> result(indices, indices + (n_indices / 3) * 3);
+	if (static_cast<int>(result.size()) <= target_index_count)
+		return result;
+
+	//Vertices that only differ in their other attributes share a position, find one vertex per position
+	std::vector<uint32_t> position_ids(n_vertices);
+	std::vector<int> vertices_per_position(n_vertices, 0);
+	{
+		const auto hash_position = [](const glm::vec3& position) { return static_cast<size_t>(AssetCache::hash_data(reinterpret_cast<const char*>(&position), sizeof(position))); };
+		const auto compare_position = [](const glm::vec3& lhs, const glm::vec3& rhs) { return memcmp(&lhs, &rhs, sizeof(glm::vec3)) == 0; };
+		std::unordered_map<glm::vec3, uint32_t, decltype(hash_position), decltype(compare_position)> unique_positions(n_vertices, hash_position, compare_position);
+		for (int i = 0; i < n_vertices; i++)
+		{
+			position_ids[i] = unique_positions.emplace(vertices[i].position, static_cast<uint32_t>(i)).first->second;
+			vertices_per_position[position_ids[i]]++;
+		}
+	}
+
+	//Lock seams, and border vertices, which have an edge with no triangle on the other side
+	std::vector<char> locked(n_vertices, 0);
+	{
+		std::unordered_map<uint64_t, int> edges;
+		edges.reserve(result.size());
+		const auto edge_key = [](const uint32_t from, const uint32_t to) { return (static_cast<uint64_t>(from) << 32) | to; };
+		for (size_t i = 0; i < result.size(); i += 3)
+			for (int corner = 0; corner < 3; corner++)
+				edges[edge_key(position_ids[result[i + corner]], position_ids[result[i + (corner + 1) % 3]])]++;
+		for (int i = 0; i < n_vertices; i++)
+		{
+			if (vertices_per_position[position_ids[i]] > 1)
+				locked[i] = 1;
+		}
+		for (const auto& [key, count] : edges)
+		{
+			const uint32_t from = static_cast<uint32_t>(key >> 32);
+			const uint32_t to = static_cast<uint32_t>(key & 0xFFFFFFFF);
+			const auto reverse = edges.find(edge_key(to, from));
+			if (count != 1 || reverse == edges.end() || reverse->second != 1)
+			{
+				locked[from] = 1;
+				locked[to] = 1;
+			}
+		}
+	}
+
+	//Every position starts out with the planes of the triangles around it, weighted by area
+	std::vector<Quadric> quadrics(n_vertices);
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		const glm::vec3& a = vertices[result[i + 0]].position;
+		const glm::vec3& b = vertices[result[i + 1]].position;
+		const glm::vec3& c = vertices[result[i + 2]].position;
+		const glm::vec3 normal = glm::cross(b - a, c - a);
+		const float area = glm::length(normal);
+		if (area <= 0.0f)
+			continue;
+		const glm::vec3 unit_normal = normal / area;
+		for (int corner = 0; corner < 3; corner++)
+			quadrics[position_ids[result[i + corner]]].add_plane(unit_normal, -glm::dot(unit_normal, a), area);
+	}
+
+	//Collapse in passes: find the cheapest collapses, do as many as possible that don't touch the same vertices, and clean up
+	const float max_cost = max_error * max_error;
+	float max_cost_used = 0.0f;
+	std::vector<uint32_t> collapse_target(n_vertices);
+	std::vector<char> touched(n_vertices);
+	std::vector<int> adjacency_offsets(n_vertices + 1);
+	std::vector<uint32_t> adjacency;
+	std::vector<EdgeCollapse> collapses;
+	while (static_cast<int>(result.size()) > target_index_count)
+	{
+		const int n_triangles = static_cast<int>(result.size() / 3);
+
+		//Triangles around each vertex
+		std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+		for (const uint32_t index : result)
+			adjacency_offsets[index + 1]++;
+		for (int i = 0; i < n_vertices; i++)
+			adjacency_offsets[i + 1] += adjacency_offsets[i];
+		adjacency.resize(result.size());
+		{
+			std::vector<int> fill_positions(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+			for (int i = 0; i < n_triangles * 3; i++)
+				adjacency[fill_positions[result[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+
+		//Candidate collapses, moving an unlocked vertex onto one of its neighbours
+		collapses.clear();
+		for (int i = 0; i < n_triangles * 3; i++)
+		{
+			const uint32_t from = result[i];
+			const uint32_t to = result[(i / 3) * 3 + (i % 3 + 1) % 3];
+			for (int direction = 0; direction < 2; direction++)
+			{
+				const uint32_t collapse_from = direction == 0 ? from : to;
+				const uint32_t collapse_to = direction == 0 ? to : from;
+				if (locked[collapse_from])
+					continue;
+				Quadric quadric = quadrics[position_ids[collapse_from]];
+				quadric.add(quadrics[position_ids[collapse_to]]);
+				const float cost = quadric.evaluate(vertices[collapse_to].position);
+				if (cost <= max_cost)
+					collapses.push_back({ collapse_from, collapse_to, cost });
+			}
+		}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end(), [](const EdgeCollapse& lhs, const EdgeCollapse& rhs) { return lhs.cost < rhs.cost; });
+
+		for (int i = 0; i < n_vertices; i++)
+			collapse_target[i] = static_cast<uint32_t>(i);
+		std::fill(touched.begin(), touched.end(), 0);
+		int triangles_left = n_triangles;
+		int n_collapsed = 0;
+		for (const auto& collapse : collapses)
+		{
+			if (triangles_left * 3 <= target_index_count)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			//Don't collapse if it would flip a triangle around. The triangles that get removed don't matter
+			bool flips = false;
+			int n_removed = 0;
+			const glm::vec3& new_position = vertices[collapse.to].position;
+			for (int j = adjacency_offsets[collapse.from]; j < adjacency_offsets[collapse.from + 1] && !flips; j++)
+			{
+				const uint32_t* corners = &result[adjacency[j] * 3];
+				if (position_ids[corners[0]] == position_ids[collapse.to] || position_ids[corners[1]] == position_ids[collapse.to] || position_ids[corners[2]] == position_ids[collapse.to])
+				{
+					n_removed++;
+					continue;
+				}
+				glm::vec3 positions[3] = { vertices[corners[0]].position, vertices[corners[1]].position, vertices[corners[2]].position };
+				const glm::vec3 old_normal = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+				for (int corner = 0; corner < 3; corner++)
+				{
+					if (corners[corner] == collapse.from)
+						positions[corner] = new_position;
+				}
+				const glm::vec3 new_normal = glm::cross(positions[1] - positions[0], positions[2] - positions[0]);
+				if (glm::dot(old_normal, new_normal) <= 1e-2f * glm::length(old_normal) * glm::length(new_normal))
+					flips = true;
+			}
+			if (flips)
+				continue;
+
+			//Only the positions have to match, any other attributes can come from the target vertex
+			//Neighbours are left alone for the rest of the pass, since their flip checks would use positions that are about to change
+			collapse_target[collapse.from] = collapse.to;
+			quadrics[position_ids[collapse.to]].add(quadrics[position_ids[collapse.from]]);
+			for (int j = adjacency_offsets[collapse.from]; j < adjacency_offsets[collapse.from + 1]; j++)
+			{
+				const uint32_t* corners = &result[adjacency[j] * 3];
+				touched[corners[0]] = 1;
+				touched[corners[1]] = 1;
+				touched[corners[2]] = 1;
+			}
+			triangles_left -= n_removed;
+			max_cost_used = glm::max(max_cost_used, collapse.cost);
+			n_collapsed++;
+		}
+		if (n_collapsed == 0)
+			break;
+
+		//Apply the collapses and remove the triangles that became degenerate
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			const uint32_t a = collapse_target[result[i + 0]];
+			const uint32_t b = collapse_target[result[i + 1]];
+			const uint32_t c = collapse_target[result[i + 2]];
+			if (position_ids[a] == position_ids[b] || position_ids[b] == position_ids[c] || position_ids[a] == position_ids[c])
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	error_out = std::sqrt(max_cost_used);
+	return result;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+struct Vertex;
+struct MeshBufferData;
+
+//Builds lower detail versions of meshes by collapsing edges, ordered by quadric error (Garland & Heckbert). Vertices are never moved or
+//created, only dropped, so every level of detail can share the original vertex buffer
+class MeshSimplifier
+{
+public:
+	static void generate_lods(MeshBufferData& mesh);
+	static std::vector<uint32_t> simplify(const uint32_t* indices, int n_indices, const Vertex* vertices, int n_vertices, int target_index_count, float max_error, float& error_out);
+};
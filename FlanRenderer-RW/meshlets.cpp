@@ -0,0 +1,177 @@
+#include "meshlets.h"
+
+#include <cfloat>
+#include <cmath>
+#include <glm/geometric.hpp>
+
+#include "renderer_structs.h"
+
+//Cuts the index buffer into meshlets of at most max_vertices unique vertices and max_triangles triangles. Triangles are kept in order,
+//so each meshlet is a contiguous index range. Run this after vertex cache optimization, which already puts neighbouring triangles close
+//together, so the meshlets come out compact
+std::vector<Meshlet> Meshlets::build_meshlets(const uint32_t* indices, const int n_indices, const Vertex* vertices, const int n_vertices, const int max_vertices, const int max_triangles)
+{
+	std::vector<Meshlet> meshlets;
+	const int n_triangles = n_indices / 3;
+	if (n_triangles == 0)
+		return meshlets;
+
+	//Stores which meshlet last used each vertex, so counting unique vertices doesn't need a set per meshlet
+	std::vector<int> vertex_meshlet(n_vertices, -1);
+	int meshlet_id = 0;
+	int meshlet_first_triangle = 0;
+	int meshlet_vertex_count = 0;
+
+	for (int triangle = 0; triangle < n_triangles; triangle++)
+	{
+		const uint32_t* corners = &indices[triangle * 3];
+		auto count_new_vertices = [&]()
+		{
+			int n_new = 0;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				const bool duplicate = (corner > 0 && corners[corner] == corners[0]) || (corner > 1 && corners[corner] == corners[1]);
+				if (!duplicate && vertex_meshlet[corners[corner]] != meshlet_id)
+					n_new++;
+			}
+			return n_new;
+		};
+
+		//Start a new meshlet if this triangle doesn't fit in the current one
+		int n_new = count_new_vertices();
+		if (meshlet_vertex_count + n_new > max_vertices || triangle - meshlet_first_triangle >= max_triangles)
+		{
+			meshlets.push_back({ static_cast<uint32_t>(meshlet_first_triangle * 3), static_cast<uint32_t>((triangle - meshlet_first_triangle) * 3) });
+			meshlet_id++;
+			meshlet_first_triangle = triangle;
+			meshlet_vertex_count = 0;
+			n_new = count_new_vertices();
+		}
+
+		for (int corner = 0; corner < 3; corner++)
+			vertex_meshlet[corners[corner]] = meshlet_id;
+		meshlet_vertex_count += n_new;
+	}
+	meshlets.push_back({ static_cast<uint32_t>(meshlet_first_triangle * 3), static_cast<uint32_t>((n_triangles - meshlet_first_triangle) * 3) });
+
+	for (auto& meshlet : meshlets)
+		compute_meshlet_bounds(meshlet, indices, vertices);
+	return meshlets;
+}
+
+//Bounding sphere around the meshlet's vertices, and a cone that contains all its triangle normals. When the camera is inside the cone
+//(placed at cone_apex, opening away from the axis), it sees the back of every triangle in the meshlet
+void Meshlets::compute_meshlet_bounds(Meshlet& meshlet, const uint32_t* indices, const Vertex* vertices)
+{
+	const uint32_t* meshlet_indices = &indices[meshlet.index_offset];
+	const int n_triangles = static_cast<int>(meshlet.index_count / 3);
+
+	//Sphere centered on the bounding box
+	glm::vec3 min_pos(FLT_MAX);
+	glm::vec3 max_pos(-FLT_MAX);
+	for (uint32_t i = 0; i < meshlet.index_count; i++)
+	{
+		min_pos = glm::min(min_pos, vertices[meshlet_indices[i]].position);
+		max_pos = glm::max(max_pos, vertices[meshlet_indices[i]].position);
+	}
+	meshlet.center = (min_pos + max_pos) * 0.5f;
+	float radius_squared = 0.0f;
+	for (uint32_t i = 0; i < meshlet.index_count; i++)
+	{
+		const glm::vec3 offset = vertices[meshlet_indices[i]].position - meshlet.center;
+		radius_squared = glm::max(radius_squared, glm::dot(offset, offset));
+	}
+	meshlet.radius = std::sqrt(radius_squared);
+
+	//By default the meshlet is never backface culled
+	meshlet.cone_apex = meshlet.center;
+	meshlet.cone_axis = glm::vec3(0.0f);
+	meshlet.cone_cutoff = 1.0f;
+
+	//Average the triangle normals to get the cone axis. Degenerate triangles don't face anywhere, so they are skipped
+	std::vector<glm::vec3> normals;
+	normals.reserve(n_triangles);
+	glm::vec3 axis(0.0f);
+	for (int triangle = 0; triangle < n_triangles; triangle++)
+	{
+		const glm::vec3& a = vertices[meshlet_indices[triangle * 3 + 0]].position;
+		const glm::vec3& b = vertices[meshlet_indices[triangle * 3 + 1]].position;
+		const glm::vec3& c = vertices[meshlet_indices[triangle * 3 + 2]].position;
+		const glm::vec3 normal = glm::cross(b - a, c - a);
+		const float length = glm::length(normal);
+		if (length <= 1e-12f)
+		{
+			normals.push_back(glm::vec3(0.0f));
+			continue;
+		}
+		normals.push_back(normal / length);
+		axis += normal / length;
+	}
+	const float axis_length = glm::length(axis);
+	if (axis_length <= 1e-6f)
+		return;
+	axis /= axis_length;
+
+	//The widest normal decides the cone's angle. If the normals spread over more than a hemisphere (or close to it) the cone is useless
+	float min_dot = 1.0f;
+	for (const auto& normal : normals)
+	{
+		if (normal != glm::vec3(0.0f))
+			min_dot = glm::min(min_dot, glm::dot(axis, normal));
+	}
+	if (min_dot <= 0.1f)
+		return;
+
+	//Move the apex back along the axis until it's behind the plane of every triangle, so the test works for cameras close to the meshlet
+	float max_t = 0.0f;
+	for (int triangle = 0; triangle < n_triangles; triangle++)
+	{
+		if (normals[triangle] == glm::vec3(0.0f))
+			continue;
+		const glm::vec3& a = vertices[meshlet_indices[triangle * 3]].position;
+		const float t = glm::dot(meshlet.center - a, normals[triangle]) / glm::dot(axis, normals[triangle]);
+		max_t = glm::max(max_t, t);
+	}
+	meshlet.cone_apex = meshlet.center - axis * max_t;
+	meshlet.cone_axis = axis;
+	meshlet.cone_cutoff = std::sqrt(1.0f - min_dot * min_dot);
+}
+
+//Gribb-Hartmann plane extraction. With the model matrix included, the planes are in model space so meshlet bounds can be tested directly
+void Meshlets::extract_frustum_planes(const glm::mat4& model_view_projection, glm::vec4 planes[6])
+{
+	const glm::vec4 row_x(model_view_projection[0][0], model_view_projection[1][0], model_view_projection[2][0], model_view_projection[3][0]);
+	const glm::vec4 row_y(model_view_projection[0][1], model_view_projection[1][1], model_view_projection[2][1], model_view_projection[3][1]);
+	const glm::vec4 row_z(model_view_projection[0][2], model_view_projection[1][2], model_view_projection[2][2], model_view_projection[3][2]);
+	const glm::vec4 row_w(model_view_projection[0][3], model_view_projection[1][3], model_view_projection[2][3], model_view_projection[3][3]);
+	planes[0] = row_w + row_x;
+	planes[1] = row_w - row_x;
+	planes[2] = row_w + row_y;
+	planes[3] = row_w - row_y;
+	planes[4] = row_w + row_z;
+	planes[5] = row_w - row_z;
+
+	//Normalize so plane distances are real distances, which the sphere test needs
+	for (int i = 0; i < 6; i++)
+	{
+		const float length = glm::length(glm::vec3(planes[i]));
+		if (length > 0.0f)
+			planes[i] /= length;
+	}
+}
+
+//Camera position has to be in the same space as the planes and the meshlet bounds
+bool Meshlets::is_meshlet_visible(const Meshlet& meshlet, const glm::vec4 planes[6], const glm::vec3& camera_position)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (glm::dot(glm::vec3(planes[i]), meshlet.center) + planes[i].w < -meshlet.radius)
+			return false;
+	}
+
+	if (meshlet.cone_cutoff >= 1.0f)
+		return true;
+	const glm::vec3 view_direction = meshlet.cone_apex - camera_position;
+	const float distance = glm::length(view_direction);
+	return distance <= 0.0f || glm::dot(view_direction, meshlet.cone_axis) < meshlet.cone_cutoff * distance;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+
+struct Vertex;
+struct Meshlet;
+
+//Splits meshes into small clusters with bounds, so the renderer can skip the parts of a mesh that can't be seen
+class Meshlets
+{
+public:
+	static std::vector<Meshlet> build_meshlets(const uint32_t* indices, int n_indices, const Vertex* vertices, int n_vertices, int max_vertices = 64, int max_triangles = 124);
+	static void extract_frustum_planes(const glm::mat4& model_view_projection, glm::vec4 planes[6]);
+	static bool is_meshlet_visible(const Meshlet& meshlet, const glm::vec4 planes[6], const glm::vec3& camera_position);
+
+private:
+	static void compute_meshlet_bounds(Meshlet& meshlet, const uint32_t* indices, const Vertex* vertices);
+};
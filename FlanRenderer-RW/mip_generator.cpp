@@ -0,0 +1,342 @@
+#include "mip_generator.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+#include <glm/common.hpp>
+
+#include "job_system.h"
+#include "resource_handler_structs.h"
+#include "resource_manager.h"
+#include "vertex_transform.h"
+
+//MSVC lets any function use AVX intrinsics, GCC and Clang need to be told which functions may
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+//Linear values are turned back into sRGB with a table indexed by the exponent and the top 10 mantissa bits of the float.
+//Anything below 2^-13 encodes to 0, so the table starts there and ends right below 1.0
+static constexpr uint32_t encode_min_bits = 0x39000000;
+static constexpr uint32_t encode_max_bits = 0x3F7FFFFF;
+static constexpr int encode_shift = 13;
+static constexpr int n_encode_entries = (0x3F800000 - encode_min_bits) >> encode_shift;
+
+struct ConversionTables
+{
+	float decode[512];							//sRGB to linear in the first half, byte / 255 in the second half
+	uint8_t encode[n_encode_entries + 3];		//Padded, so 32-bit gathers of the last entry stay in bounds
+};
+
+static const ConversionTables& get_tables()
+{
+	static const ConversionTables tables = []
+	{
+		ConversionTables new_tables{};
+		for (int i = 0; i < 256; i++)
+		{
+			const float srgb = static_cast<float>(i) / 255.0f;
+			new_tables.decode[i] = srgb <= 0.04045f ? srgb / 12.92f : std::pow((srgb + 0.055f) / 1.055f, 2.4f);
+			new_tables.decode[i + 256] = srgb;
+		}
+
+		//Each entry holds the encoded value at the middle of its range
+		for (int i = 0; i < n_encode_entries; i++)
+		{
+			const uint32_t bits = encode_min_bits + (static_cast<uint32_t>(i) << encode_shift) + (1u << (encode_shift - 1));
+			float linear;
+			memcpy(&linear, &bits, sizeof(linear));
+			const float srgb = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+			new_tables.encode[i] = static_cast<uint8_t>(glm::clamp(static_cast<int>(srgb * 255.0f + 0.5f), 0, 255));
+		}
+		return new_tables;
+	}();
+	return tables;
+}
+
+static inline uint8_t encode_srgb(const ConversionTables& tables, float value)
+{
+	float min_value, max_value;
+	memcpy(&min_value, &encode_min_bits, sizeof(float));
+	memcpy(&max_value, &encode_max_bits, sizeof(float));
+	value = value > min_value ? value : min_value;
+	value = value < max_value ? value : max_value;
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return tables.encode[(bits - encode_min_bits) >> encode_shift];
+}
+
+static inline uint8_t encode_linear(const float value)
+{
+	return static_cast<uint8_t>(static_cast<int>(value * 255.0f + 0.5f));
+}
+
+//Averages rows of destination pixels from first_pixel up to end_pixel. Also handles 1 pixel wide sources, by clamping the second column
+void MipGenerator::generate_row_scalar(const uint8_t* row_0, const uint8_t* row_1, uint8_t* destination, const int first_pixel, const int end_pixel, const int source_width, const bool is_srgb)
+{
+	const ConversionTables& tables = get_tables();
+	for (int x = first_pixel; x < end_pixel; x++)
+	{
+		const int x0 = (x * 2) * 4;
+		const int x1 = glm::min(x * 2 + 1, source_width - 1) * 4;
+		for (int channel = 0; channel < 4; channel++)
+		{
+			if (!is_srgb)
+			{
+				destination[x * 4 + channel] = static_cast<uint8_t>((row_0[x0 + channel] + row_1[x0 + channel] + row_0[x1 + channel] + row_1[x1 + channel] + 2) / 4);
+				continue;
+			}
+			const bool is_srgb_channel = channel < 3;
+			const float* decode = tables.decode + (is_srgb_channel ? 0 : 256);
+			const float sum = (decode[row_0[x0 + channel]] + decode[row_1[x0 + channel]]) + (decode[row_0[x1 + channel]] + decode[row_1[x1 + channel]]);
+			const float average = sum * 0.25f;
+			destination[x * 4 + channel] = is_srgb_channel ? encode_srgb(tables, average) : encode_linear(average);
+		}
+	}
+}
+
+//Returns how many pixels were done. Linear textures are averaged as integers, 2 pixels at a time. For sRGB textures SSE has no gathers,
+//so the table lookups stay scalar and only the maths is vectorised
+int MipGenerator::generate_row_sse(const uint8_t* row_0, const uint8_t* row_1, uint8_t* destination, const int n_pixels, const bool is_srgb)
+{
+	if (!is_srgb)
+	{
+		const int n_batched = n_pixels & ~1;
+		for (int x = 0; x < n_batched; x += 2)
+		{
+			//Add the rows as 16-bit values, then pair up source pixels 0 and 2, and 1 and 3, so adding those gives both destination pixels
+			const __m128i source_0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row_0 + x * 8));
+			const __m128i source_1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row_1 + x * 8));
+			const __m128i zero = _mm_setzero_si128();
+			const __m128i pixels_01 = _mm_add_epi16(_mm_unpacklo_epi8(source_0, zero), _mm_unpacklo_epi8(source_1, zero));
+			const __m128i pixels_23 = _mm_add_epi16(_mm_unpackhi_epi8(source_0, zero), _mm_unpackhi_epi8(source_1, zero));
+			__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(pixels_01, pixels_23), _mm_unpackhi_epi64(pixels_01, pixels_23));
+			sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_set1_epi16(2)), 2);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(destination + x * 4), _mm_packus_epi16(sum, sum));
+		}
+		return n_batched;
+	}
+
+	const ConversionTables& tables = get_tables();
+	const float* decode_colour = tables.decode;
+	const float* decode_alpha = tables.decode + 256;
+	const auto decode_pixel = [&](const uint8_t* pixel)
+	{
+		return _mm_setr_ps(decode_colour[pixel[0]], decode_colour[pixel[1]], decode_colour[pixel[2]], decode_alpha[pixel[3]]);
+	};
+
+	const __m128 min_value = _mm_castsi128_ps(_mm_set1_epi32(encode_min_bits));
+	const __m128 max_value = _mm_castsi128_ps(_mm_set1_epi32(encode_max_bits));
+	for (int x = 0; x < n_pixels; x++)
+	{
+		const __m128 pixel_0 = _mm_add_ps(decode_pixel(row_0 + x * 8), decode_pixel(row_1 + x * 8));
+		const __m128 pixel_1 = _mm_add_ps(decode_pixel(row_0 + x * 8 + 4), decode_pixel(row_1 + x * 8 + 4));
+		const __m128 average = _mm_mul_ps(_mm_add_ps(pixel_0, pixel_1), _mm_set1_ps(0.25f));
+
+		alignas(16) int32_t linear[4];
+		alignas(16) int32_t index[4];
+		const __m128 clamped = _mm_min_ps(_mm_max_ps(average, min_value), max_value);
+		_mm_store_si128(reinterpret_cast<__m128i*>(linear), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(average, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f))));
+		_mm_store_si128(reinterpret_cast<__m128i*>(index), _mm_srli_epi32(_mm_sub_epi32(_mm_castps_si128(clamped), _mm_set1_epi32(encode_min_bits)), encode_shift));
+		for (int channel = 0; channel < 3; channel++)
+			linear[channel] = tables.encode[index[channel]];
+		for (int channel = 0; channel < 4; channel++)
+			destination[x * 4 + channel] = static_cast<uint8_t>(linear[channel]);
+	}
+	return n_pixels;
+}
+
+//Decodes 2 neighbouring pixels to 8 floats
+AVX2_FUNCTION static inline __m256 decode_pixels_avx2(const float* decode, const uint8_t* pixels, const __m256i offsets)
+{
+	const __m256i bytes = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(pixels)));
+	return _mm256_i32gather_ps(decode, _mm256_add_epi32(bytes, offsets), 4);
+}
+
+//Returns how many pixels were done. Linear textures are averaged as integers like in the SSE path, 4 pixels at a time. For sRGB textures,
+//the colour and alpha channels are decoded and encoded together, by offsetting alpha into the linear half of the decode table and
+//blending the encoded values per channel
+AVX2_FUNCTION int MipGenerator::generate_row_avx2(const uint8_t* row_0, const uint8_t* row_1, uint8_t* destination, const int n_pixels, const bool is_srgb)
+{
+	if (!is_srgb)
+	{
+		const int n_batched = n_pixels & ~3;
+		for (int x = 0; x < n_batched; x += 4)
+		{
+			//Unpacking works within each 128-bit half, so the two halves each end up with 2 destination pixels
+			const __m256i source_0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row_0 + x * 8));
+			const __m256i source_1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row_1 + x * 8));
+			const __m256i zero = _mm256_setzero_si256();
+			const __m256i pixels_01 = _mm256_add_epi16(_mm256_unpacklo_epi8(source_0, zero), _mm256_unpacklo_epi8(source_1, zero));
+			const __m256i pixels_23 = _mm256_add_epi16(_mm256_unpackhi_epi8(source_0, zero), _mm256_unpackhi_epi8(source_1, zero));
+			__m256i sum = _mm256_add_epi16(_mm256_unpacklo_epi64(pixels_01, pixels_23), _mm256_unpackhi_epi64(pixels_01, pixels_23));
+			sum = _mm256_srli_epi16(_mm256_add_epi16(sum, _mm256_set1_epi16(2)), 2);
+			const __m256i bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(sum, sum), 0x08);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(destination + x * 4), _mm256_castsi256_si128(bytes));
+		}
+		return n_batched;
+	}
+
+	const ConversionTables& tables = get_tables();
+	const __m256i offsets = _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256);
+	const __m256i srgb_channels = _mm256_setr_epi32(-1, -1, -1, 0, -1, -1, -1, 0);
+	const __m256 min_value = _mm256_castsi256_ps(_mm256_set1_epi32(encode_min_bits));
+	const __m256 max_value = _mm256_castsi256_ps(_mm256_set1_epi32(encode_max_bits));
+
+	const int n_batched = n_pixels & ~1;
+	for (int x = 0; x < n_batched; x += 2)
+	{
+		//Source pixels 0 and 1, and 2 and 3, with both rows added. Then the halves are swapped around so each destination pixel adds its own two
+		const __m256 pixels_01 = _mm256_add_ps(decode_pixels_avx2(tables.decode, row_0 + x * 8, offsets), decode_pixels_avx2(tables.decode, row_1 + x * 8, offsets));
+		const __m256 pixels_23 = _mm256_add_ps(decode_pixels_avx2(tables.decode, row_0 + x * 8 + 8, offsets), decode_pixels_avx2(tables.decode, row_1 + x * 8 + 8, offsets));
+		const __m256 sum = _mm256_add_ps(_mm256_permute2f128_ps(pixels_01, pixels_23, 0x20), _mm256_permute2f128_ps(pixels_01, pixels_23, 0x31));
+		const __m256 average = _mm256_mul_ps(sum, _mm256_set1_ps(0.25f));
+
+		const __m256 clamped = _mm256_min_ps(_mm256_max_ps(average, min_value), max_value);
+		const __m256i index = _mm256_srli_epi32(_mm256_sub_epi32(_mm256_castps_si256(clamped), _mm256_set1_epi32(encode_min_bits)), encode_shift);
+		const __m256i srgb = _mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(tables.encode), index, 1), _mm256_set1_epi32(0xFF));
+		const __m256i linear = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(average, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f)));
+		__m256i bytes = _mm256_blendv_epi8(linear, srgb, srgb_channels);
+		bytes = _mm256_packus_epi32(bytes, bytes);
+		bytes = _mm256_packus_epi16(bytes, bytes);
+
+		const int32_t pixel_0 = _mm_cvtsi128_si32(_mm256_castsi256_si128(bytes));
+		const int32_t pixel_1 = _mm_cvtsi128_si32(_mm256_extracti128_si256(bytes, 1));
+		memcpy(destination + x * 4, &pixel_0, sizeof(pixel_0));
+		memcpy(destination + x * 4 + 4, &pixel_1, sizeof(pixel_1));
+	}
+	return n_batched;
+}
+
+//Filters one level from the one above it. Levels with an odd size drop the last row or column, like glGenerateMipmap's box filter
+void MipGenerator::generate_mip(const Pixel32* source, const int source_width, const int source_height, Pixel32* destination, const int destination_width, const int destination_height, const bool is_srgb)
+{
+	static const bool has_avx2 = VertexTransform::is_avx2_supported();
+	const int n_jobs = (destination_height + rows_per_job - 1) / rows_per_job;
+	ResourceManager::get_job_system_instance()->parallel_for(n_jobs, [&](const int job)
+	{
+		const int end_row = glm::min((job + 1) * rows_per_job, destination_height);
+		for (int y = job * rows_per_job; y < end_row; y++)
+		{
+			const uint8_t* row_0 = reinterpret_cast<const uint8_t*>(source + glm::min(y * 2, source_height - 1) * source_width);
+			const uint8_t* row_1 = reinterpret_cast<const uint8_t*>(source + glm::min(y * 2 + 1, source_height - 1) * source_width);
+			uint8_t* destination_row = reinterpret_cast<uint8_t*>(destination + y * destination_width);
+
+			int n_done = 0;
+			if (use_simd && source_width >= 2)
+			{
+				if (has_avx2)
+					n_done = generate_row_avx2(row_0, row_1, destination_row, destination_width, is_srgb);
+				else
+					n_done = generate_row_sse(row_0, row_1, destination_row, destination_width, is_srgb);
+			}
+			generate_row_scalar(row_0, row_1, destination_row, n_done, destination_width, source_width, is_srgb);
+		}
+	});
+}
+
+//Fills mip_chain with levels 1 and up, stored back to back. Each level depends on the previous one, so only the rows within a level run in parallel
+void MipGenerator::generate_mip_chain(const Pixel32* level_0, const int width, const int height, Pixel32* mip_chain, const int n_mips, const bool is_srgb)
+{
+	std::vector<Pixel32*> levels(n_mips);
+	levels[0] = const_cast<Pixel32*>(level_0);
+	Pixel32* level_data = mip_chain;
+	for (int level = 1; level < n_mips; level++)
+	{
+		const int source_width = glm::max(width >> (level - 1), 1);
+		const int source_height = glm::max(height >> (level - 1), 1);
+		const int destination_width = glm::max(width >> level, 1);
+		const int destination_height = glm::max(height >> level, 1);
+		levels[level] = level_data;
+		generate_mip(levels[level - 1], source_width, source_height, levels[level], destination_width, destination_height, is_srgb);
+		level_data += destination_width * destination_height;
+	}
+
+	//Averaging alpha makes cutouts fade away in the distance, since more and more pixels end up below the cutoff. Scaling alpha afterwards
+	//keeps the share of pixels that pass the alpha test the same as on the full size texture
+	if (!preserve_alpha_coverage || n_mips == 1 || !is_alpha_cutout(level_0, width * height))
+		return;
+
+	const float coverage = calculate_alpha_coverage(level_0, width * height);
+	ResourceManager::get_job_system_instance()->parallel_for(n_mips - 1, [&](const int i)
+	{
+		const int level = i + 1;
+		scale_alpha_to_coverage(levels[level], glm::max(width >> level, 1) * glm::max(height >> level, 1), coverage);
+	});
+}
+
+void MipGenerator::build_alpha_histogram(const Pixel32* pixels, const int n_pixels, uint32_t (&histogram)[256])
+{
+	memset(histogram, 0, sizeof(histogram));
+	for (int i = 0; i < n_pixels; i++)
+		histogram[pixels[i].a]++;
+}
+
+//Textures count as cutouts if some pixels are below the cutoff, and most pixels are close to either fully transparent or fully opaque
+bool MipGenerator::is_alpha_cutout(const Pixel32* pixels, const int n_pixels)
+{
+	uint32_t histogram[256];
+	build_alpha_histogram(pixels, n_pixels, histogram);
+
+	uint32_t n_below_cutoff = 0;
+	uint32_t n_partial = 0;
+	for (int alpha = 0; alpha < 256; alpha++)
+	{
+		if (static_cast<float>(alpha) <= alpha_cutoff * 255.0f)
+			n_below_cutoff += histogram[alpha];
+		if (alpha >= 16 && alpha < 240)
+			n_partial += histogram[alpha];
+	}
+	return n_below_cutoff > 0 && n_partial * 4 < static_cast<uint32_t>(n_pixels);
+}
+
+//Share of the pixels that pass the alpha test
+float MipGenerator::calculate_alpha_coverage(const Pixel32* pixels, const int n_pixels)
+{
+	if (n_pixels == 0)
+		return 0.0f;
+
+	uint32_t histogram[256];
+	build_alpha_histogram(pixels, n_pixels, histogram);
+
+	uint32_t n_above_cutoff = 0;
+	for (int alpha = 0; alpha < 256; alpha++)
+	{
+		if (static_cast<float>(alpha) > alpha_cutoff * 255.0f)
+			n_above_cutoff += histogram[alpha];
+	}
+	return static_cast<float>(n_above_cutoff) / static_cast<float>(n_pixels);
+}
+
+//Scales alpha so the given share of pixels passes the alpha test. Since alpha only has 256 values, the histogram gives the exact threshold
+//that gets closest, and the scale is picked so values above the threshold end up above the cutoff and the rest below it
+void MipGenerator::scale_alpha_to_coverage(Pixel32* pixels, const int n_pixels, const float coverage)
+{
+	uint32_t histogram[256];
+	build_alpha_histogram(pixels, n_pixels, histogram);
+
+	const float target = coverage * static_cast<float>(n_pixels);
+	uint32_t n_above = static_cast<uint32_t>(n_pixels);
+	int best_threshold = 0;
+	float best_error = FLT_MAX;
+	for (int threshold = 0; threshold < 256; threshold++)
+	{
+		n_above -= histogram[threshold];
+		const float error = std::abs(static_cast<float>(n_above) - target);
+		if (error < best_error)
+		{
+			best_error = error;
+			best_threshold = threshold;
+		}
+	}
+
+	const float scale = alpha_cutoff * 255.0f / (static_cast<float>(best_threshold) + 0.5f);
+	for (int i = 0; i < n_pixels; i++)
+	{
+		pixels[i].a = static_cast<uint8_t>(glm::min(static_cast<int>(static_cast<float>(pixels[i].a) * scale + 0.5f), 255));
+	}
+}
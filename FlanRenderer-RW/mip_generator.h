@@ -0,0 +1,27 @@
+#pragma once
+#include <cstdint>
+
+struct Pixel32;
+
+//Builds mip chains for RGBA8 textures on the CPU with a 2x2 box filter. sRGB colour is converted to linear before averaging and back
+//afterwards, alpha and the channels of linear textures are averaged as-is. Rows of each level are spread across the job system, and every path (scalar, SSE, AVX2)
+//does the same float operations in the same order, so they all give the same pixels
+class MipGenerator
+{
+public:
+	static void generate_mip_chain(const Pixel32* level_0, int width, int height, Pixel32* mip_chain, int n_mips, bool is_srgb);
+	static void generate_mip(const Pixel32* source, int source_width, int source_height, Pixel32* destination, int destination_width, int destination_height, bool is_srgb);
+	static bool is_alpha_cutout(const Pixel32* pixels, int n_pixels);
+	static float calculate_alpha_coverage(const Pixel32* pixels, int n_pixels);
+	static void scale_alpha_to_coverage(Pixel32* pixels, int n_pixels, float coverage);
+	inline static bool use_simd = true;
+	inline static bool preserve_alpha_coverage = true;	//Keep the share of pixels that pass the alpha test the same on every level, for cutout textures
+	inline static float alpha_cutoff = 0.5f;
+	inline static int rows_per_job = 32;
+
+private:
+	static void generate_row_scalar(const uint8_t* row_0, const uint8_t* row_1, uint8_t* destination, int first_pixel, int end_pixel, int source_width, bool is_srgb);
+	static int generate_row_sse(const uint8_t* row_0, const uint8_t* row_1, uint8_t* destination, int n_pixels, bool is_srgb);
+	static int generate_row_avx2(const uint8_t* row_0, const uint8_t* row_1, uint8_t* destination, int n_pixels, bool is_srgb);
+	static void build_alpha_histogram(const Pixel32* pixels, int n_pixels, uint32_t (&histogram)[256]);
+};
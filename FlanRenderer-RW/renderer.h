@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <unordered_map>
 
 #include "renderer_structs.h"
@@ -22,10 +23,13 @@ public:
 	void end_frame();
 	void draw_model(ResourceHandle model_handle, glm::mat4 model_matrix);
 	void draw_text(const std::string& text, glm::vec2 pos_pixels/*, AnchorPoint anchor*/); //TODO: anchorpoint
-	void issue_draw_call(int draw_count);
-	TextureGPU upload_texture_to_gpu(ResourceHandle texture_handle, bool is_srgb = true, bool unload_resource_afterwards = false);
-	TextureGPU upload_cubemap_to_gpu(std::vector<ResourceHandle> texture_handle, bool unload_resource_afterwards = false);
+	void issue_draw_call(MeshGPU mesh);
+	void issue_draw_call(MeshGPU mesh, const std::vector<DrawRange>& ranges);
+	void issue_draw_call_instanced(MeshGPU mesh, DrawRange range, int first_instance, int n_instances);
+	TextureGPU upload_texture_to_gpu(ResourceHandle texture_handle, bool is_srgb = true, bool unload_resource_afterwards = false, bool allow_streaming = false, BlockFormat block_format = BlockFormat::none);
+	TextureGPU upload_cubemap_to_gpu(std::vector<ResourceHandle> texture_handle, bool unload_resource_afterwards = false, TextureGPU* irradiance_map = nullptr);
 	TextureGPU upload_font_to_gpu(ResourceHandle font_texture_handle);
+	void set_ambient_from_cubemap(const std::vector<ResourceHandle>& texture_handle);
 	ModelGPU upload_mesh_to_gpu(ResourceHandle model_handle, bool unload_resources = true);
 	void set_resolution(glm::ivec2 resolution);
 	void toggle_fullscreen();
@@ -35,12 +39,40 @@ public:
 	void update_camera_proj(glm::mat4 proj_matrix);
 	void* get_window();
 	TextureGPU get_framebuffer_texture();
-	TextureGPU curr_cubemap;
+	TextureGPU curr_cubemap;			//GGX prefiltered, with the roughness going from 0 to 1 over the mip levels
+	TextureGPU curr_irradiance_map;
 	TextureGPU curr_font;
 
 	bool flip_normal_y = true;
 	float rgh_pow = 0.55f;
 	float rgh_mul = 1.0f;
+
+	//Texture streaming
+	bool texture_streaming = true;
+	uint64_t texture_memory_budget = 256ull * 1024 * 1024;
+	uint64_t texture_memory_resident = 0;
+	int texture_streaming_initial_size = 64;		//Streamed textures start out with only the mips up to this size
+	int texture_streaming_uploads_per_frame = 4;
+	float texture_streaming_world_size = 1.0f;		//Rough world space size one texture repeat covers, used to estimate the mip a draw needs
+	bool texture_compression = true;				//Upload material textures block compressed. Only affects textures uploaded after changing it
+	bool texture_packing = false;					//Put material textures into texture arrays and atlases where they fit. Only affects models uploaded after changing it. Needs a shader that reads MaterialGPU's tex_rects and tex_layers, and packs the ORM layout so it goes with orm_textures
+
+	bool orm_textures = false;						//Upload occlusion, roughness and metallic as one texture in slot 2, instead of metallic in slot 2 and roughness in slot 3. Needs a shader that reads the ORM layout. Only affects models uploaded after changing it
+
+	bool use_packed_vertices = true;	//Upload meshes with the compact PackedVertex layout. Only affects meshes uploaded after changing it
+
+	//Meshlet culling, the counters are for the last frame
+	bool meshlet_culling = true;
+	int meshlets_visible = 0;
+	int meshlets_total = 0;
+
+	//Level of detail selection, picks the lowest detail LOD whose error stays under this many pixels on screen
+	bool mesh_lods = true;
+	float lod_error_pixels = 1.0f;
+
+	//Draw meshes a model uses in several places with one instanced draw per LOD, instead of one draw per instance
+	bool mesh_instancing = false;	//Needs a vertex shader that reads the instance matrix from attributes 5-8
+	int draw_calls = 0;	//For the last frame
 private:
 	void bind_texture(int slot, TextureGPU texture);
 	void bind_mesh(MeshGPU mesh);
@@ -54,7 +86,22 @@ private:
 	void platform_specific_init();
 	bool load_shader_part(const std::string& path, ShaderType type, const ShaderGPU& program);
 	void* allocate_temporary(uint32_t size, uint32_t align = 16);
-	MeshGPU init_vertex_buffer(Vertex* vertices, int n_vertices);
+	MeshGPU init_vertex_buffer(Vertex* vertices, int n_vertices, uint32_t* indices, int n_indices);
+	std::vector<PackedVertex> pack_vertex_buffer(const Vertex* vertices, int n_vertices, glm::vec3& position_offset, float& position_scale);
+	ResourceHandle create_orm_texture(const MaterialResource& material);
+	TextureGPU upload_orm_texture(const MaterialResource& material);
+	void upload_packed_material_textures(const ModelResource* model_resource, ModelGPU& model_gpu, const std::vector<bool>& repeating_materials);
+	TextureGPU create_brdf_lut();
+	bool get_cubemap_faces(const std::vector<ResourceHandle>& texture_handle, TextureResource* (&faces)[6], uint64_t& version);
+	char* load_or_generate_cached(const std::string& key, uint64_t version, uint32_t size_bytes, const std::function<void(char*)>& generate);
+	TextureGPU create_streamed_texture(ResourceHandle texture_handle, TextureResource* texture_resource, bool is_srgb, BlockFormat block_format, bool unload_resource_afterwards);
+	void set_texture_resident_mip(StreamedTexture& texture, int new_resident_mip, TextureResource* texture_resource);
+	void request_texture_mip(TextureGPU texture, float projected_size_pixels, const Bounds& bounds);
+	void update_texture_streaming();
+	void cull_meshlets(const MeshGPU& mesh, const MeshLod& lod, const glm::mat4& model_matrix, std::vector<DrawRange>& ranges_out);
+	int select_mesh_lod(const MeshGPU& mesh, const glm::mat4& model_matrix) const;
+	void queue_instanced_mesh(const MeshGPU& mesh, const MaterialGPU& material, const glm::mat4& model_matrix, const glm::vec4 planes[6]);
+	void upload_instance_data();
 
 	template<typename T>
 	void init_or_update_constant_buffer(int slot, ConstantBufferGPU& const_buffer, T*& buffer_data);
@@ -63,6 +110,8 @@ private:
 	FrameBufferData fb_data{};
 	CameraDataConstantBuffer* camera_data{};
 	ConstantBufferGPU camera_cb_gpu{};
+	LightingDataConstantBuffer* lighting_data{};
+	ConstantBufferGPU lighting_cb_gpu{};
 	std::unordered_map<uint32_t, TextureGPU>	loaded_textures;
 	std::unordered_map<uint32_t, MeshGPU>		loaded_meshes;
 	std::unordered_map<uint32_t, ModelGPU>		loaded_models;
@@ -70,6 +119,11 @@ private:
 	std::vector<void*> temporary_memory_allocations;
 	std::vector<ConstantBufferGPU> temporary_const_buffers;
 	std::vector<MeshRenderData> mesh_queue;
+	std::vector<StreamedTexture> streamed_textures;
+	std::vector<DrawRange> visible_ranges;
+	std::vector<glm::mat4> instance_matrices;	//Of every instanced draw this frame, uploaded all at once before drawing
+	std::vector<int> instance_lods;
+	GLuint instance_buffer = 0;
 
 	ResourceHandle debug_quad_handle;
 	MeshGPU debug_quad_gpu;
@@ -79,6 +133,7 @@ private:
 	TextureGPU tex_default_nrm;
 	TextureGPU tex_default_mtl;
 	TextureGPU tex_default_rgh;
+	TextureGPU tex_default_orm;
 	TextureGPU ibl_brdf_lut;
 
 	ResourceManager* resource_manager;
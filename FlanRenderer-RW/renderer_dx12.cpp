@@ -134,11 +134,31 @@ void Renderer::init_framebuffer()
 {
 }
 
-TextureGPU Renderer::upload_texture_to_gpu(const ResourceHandle texture_handle, bool is_srgb, bool unload_resource_afterwards)
+TextureGPU Renderer::upload_texture_to_gpu(const ResourceHandle texture_handle, bool is_srgb, bool unload_resource_afterwards, bool allow_streaming, BlockFormat block_format)
 {
 }
 
-TextureGPU Renderer::upload_cubemap_to_gpu(std::vector<ResourceHandle> texture_handle, bool unload_resource_afterwards)
+TextureGPU Renderer::create_streamed_texture(const ResourceHandle texture_handle, TextureResource* texture_resource, const bool is_srgb, const BlockFormat block_format, const bool unload_resource_afterwards)
+{
+}
+
+void Renderer::upload_packed_material_textures(const ModelResource* model_resource, ModelGPU& model_gpu, const std::vector<bool>& repeating_materials)
+{
+}
+
+TextureGPU Renderer::create_brdf_lut()
+{
+}
+
+void Renderer::set_texture_resident_mip(StreamedTexture& texture, const int new_resident_mip, TextureResource* texture_resource)
+{
+}
+
+void Renderer::update_texture_streaming()
+{
+}
+
+TextureGPU Renderer::upload_cubemap_to_gpu(std::vector<ResourceHandle> texture_handle, bool unload_resource_afterwards, TextureGPU* irradiance_map)
 {
 }
 
@@ -436,15 +456,12 @@ void Renderer::platform_specific_init()
     }
 }
 
-MeshGPU Renderer::init_vertex_buffer(Vertex* vertices, int n_vertices)
+MeshGPU Renderer::init_vertex_buffer(Vertex* vertices, int n_vertices, uint32_t* indices, int n_indices)
 {
     // Create MeshGPU
     MeshGPU out;
     out.vert_count = n_vertices;
-
-    // Generate index buffer
-    std::vector<uint32_t> indices(n_vertices);
-    std::iota(indices.begin(), indices.end(), 0);
+    out.index_count = n_indices;
     
     // Only the GPU needs this data, the CPU won't need this
     D3D12_RANGE vertex_range{ 0, 0 };
@@ -496,7 +513,7 @@ MeshGPU Renderer::init_vertex_buffer(Vertex* vertices, int n_vertices)
     // Only the GPU needs this data, the CPU won't need this
     D3D12_RANGE index_range{ 0, 0 };
     uint8_t* index_data_begin = nullptr;
-    const size_t triangle_index_size = sizeof(indices[0]) * indices.size();
+    const size_t triangle_index_size = sizeof(indices[0]) * n_indices;
 
     // Upload index buffer to GPU
     {
@@ -525,7 +542,7 @@ MeshGPU Renderer::init_vertex_buffer(Vertex* vertices, int n_vertices)
 
         // Bind the index buffer, copy the data to it, then unbind the index buffer
         throw_if_failed(out.index_buffer->Map(0, &index_range, reinterpret_cast<void**>(&index_data_begin)));
-        memcpy_s(index_data_begin, triangle_index_size, indices.data(), triangle_index_size);
+        memcpy_s(index_data_begin, triangle_index_size, indices, triangle_index_size);
         out.index_buffer->Unmap(0, nullptr);
 
         // Init the buffer view
@@ -543,7 +560,19 @@ bool Renderer::load_shader_part(const std::string& path, ShaderType type, const
 {
 }
 
-void Renderer::issue_draw_call(int draw_count)
+void Renderer::issue_draw_call(MeshGPU mesh)
+{
+}
+
+void Renderer::issue_draw_call(MeshGPU mesh, const std::vector<DrawRange>& ranges)
+{
+}
+
+void Renderer::issue_draw_call_instanced(MeshGPU mesh, DrawRange range, int first_instance, int n_instances)
+{
+}
+
+void Renderer::upload_instance_data()
 {
 }
 
@@ -1,9 +1,19 @@
+#include <algorithm>
+#include <cfloat>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <GL/gl3w.h>
+#include <glm/packing.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
+#include "asset_cache.h"
+#include "bounds.h"
 #include "common_defines.h"
+#include "ibl_prefilter.h"
+#include "logger.h"
+#include "meshlets.h"
 #include "renderer.h"
 #include "resource_manager.h"
 
@@ -20,6 +30,8 @@ void Renderer::init()
 	init_or_update_constant_buffer<CameraDataConstantBuffer>((int)ConstantBufferType::camera_data, camera_cb_gpu, camera_data);
 	camera_data->proj_matrix = glm::mat4(1.0f);
 	camera_data->view_matrix = glm::mat4(1.0f);
+	init_or_update_constant_buffer<LightingDataConstantBuffer>((int)ConstantBufferType::lighting_data, lighting_cb_gpu, lighting_data);
+	bind_constant_buffer((int)ConstantBufferType::lighting_data, lighting_cb_gpu);
 
 	//Create temporary quad
 	//debug_quad_handle = resource_manager->load_resource<MeshResource>("Assets/Models/monkey.glb");
@@ -38,21 +50,25 @@ void Renderer::init()
 	TextureResource tex_nrm	(1, 1, (Pixel32*)dynamic_allocate(sizeof(Pixel32)), (char*)"internal/default normal texture" );
 	TextureResource tex_mtl	(1, 1, (Pixel32*)dynamic_allocate(sizeof(Pixel32)), (char*)"internal/default metallic texture" );
 	TextureResource tex_rgh	(1, 1, (Pixel32*)dynamic_allocate(sizeof(Pixel32)), (char*)"internal/default roughness texture" );
+	TextureResource tex_orm	(1, 1, (Pixel32*)dynamic_allocate(sizeof(Pixel32)), (char*)"internal/default occlusion roughness metallic texture" );
 	tex_col.data[0] = { 255, 255, 255, 255 };
 	tex_nrm.data[0] = { 128, 128, 255, 255 };
 	tex_mtl.data[0] = {   0,   0,   0, 255 };
 	tex_rgh.data[0] = { 255, 255, 255, 255 };
+	tex_orm.data[0] = { 255, 255,   0, 255 };
 	auto resource_col = resource_manager->load_resource_from_buffer<TextureResource>(std::string(tex_col.name), &tex_col);
 	auto resource_nrm = resource_manager->load_resource_from_buffer<TextureResource>(std::string(tex_nrm.name), &tex_nrm);
 	auto resource_mtl = resource_manager->load_resource_from_buffer<TextureResource>(std::string(tex_mtl.name), &tex_mtl);
 	auto resource_rgh = resource_manager->load_resource_from_buffer<TextureResource>(std::string(tex_rgh.name), &tex_rgh);
+	auto resource_orm = resource_manager->load_resource_from_buffer<TextureResource>(std::string(tex_orm.name), &tex_orm);
 	tex_default_col = upload_texture_to_gpu(resource_col);
 	tex_default_nrm = upload_texture_to_gpu(resource_nrm);
 	tex_default_mtl = upload_texture_to_gpu(resource_mtl);
 	tex_default_rgh = upload_texture_to_gpu(resource_rgh);
+	tex_default_orm = upload_texture_to_gpu(resource_orm);
 
-	//Load IBL BRDF LUT
-	ibl_brdf_lut = upload_texture_to_gpu(resource_manager->load_resource_from_disk<TextureResource>("Assets/Textures/ibl_brdf_lut.png"));
+	//Generate IBL BRDF LUT
+	ibl_brdf_lut = create_brdf_lut();
 }
 
 void Renderer::begin_frame()
@@ -68,18 +84,56 @@ void Renderer::end_frame()
 
 	//Draw mesh queue
 	{
+		upload_instance_data();
+		meshlets_visible = 0;
+		meshlets_total = 0;
+		draw_calls = 0;
 		for (auto& mesh : mesh_queue)
 		{
-			camera_data->model_matrix = mesh.model_matrix;
+			//Instanced draws already had their instances culled, and use one LOD for all of them
+			if (mesh.n_instances > 0)
+			{
+				const DrawRange range = mesh.mesh.n_lods > 0
+					? DrawRange{ mesh.mesh.lods[mesh.lod].index_offset, mesh.mesh.lods[mesh.lod].index_count }
+					: DrawRange{ 0, static_cast<uint32_t>(mesh.mesh.index_count) };
+				camera_data->model_matrix = mesh.model_matrix;
+				init_or_update_constant_buffer((int)ConstantBufferType::camera_data, camera_cb_gpu, camera_data);
+				bind_constant_buffer((int)ConstantBufferType::camera_data, camera_cb_gpu);
+				bind_material_pbr(mesh.material);
+				bind_mesh(mesh.mesh);
+				issue_draw_call_instanced(mesh.mesh, range, mesh.first_instance, mesh.n_instances);
+				draw_calls++;
+				continue;
+			}
+
+			//Draw only the selected LOD, and of that only the meshlets that aren't off screen or facing away. Skip the mesh if none are left
+			visible_ranges.clear();
+			if (mesh.mesh.n_lods > 0)
+			{
+				const MeshLod& lod = mesh.mesh.lods[mesh.lod];
+				if (meshlet_culling && lod.meshlet_count > 0)
+					cull_meshlets(mesh.mesh, lod, mesh.model_matrix, visible_ranges);
+				else
+					visible_ranges.push_back({ lod.index_offset, lod.index_count });
+				if (visible_ranges.empty())
+					continue;
+			}
+
+			camera_data->model_matrix = glm::scale(glm::translate(mesh.model_matrix, mesh.mesh.position_offset), glm::vec3(mesh.mesh.position_scale));
 			init_or_update_constant_buffer((int)ConstantBufferType::camera_data, camera_cb_gpu, camera_data);
 			bind_constant_buffer((int)ConstantBufferType::camera_data, camera_cb_gpu);
 			bind_material_pbr(mesh.material);
 			
 			bind_mesh(mesh.mesh);
 
-			issue_draw_call(mesh.mesh.vert_count);
+			if (visible_ranges.empty())
+				issue_draw_call(mesh.mesh);
+			else
+				issue_draw_call(mesh.mesh, visible_ranges);
+			draw_calls++;
 		}
 		mesh_queue.clear();
+		instance_matrices.clear();
 	}
 
 	flip_buffers();
@@ -90,23 +144,158 @@ void Renderer::end_frame()
 		dynamic_free(pointers);
 	}
 	temporary_memory_allocations.clear();
+
+	update_texture_streaming();
 }
 
 void Renderer::draw_model(ResourceHandle model_handle, glm::mat4 model_matrix)
 {
 	const ModelGPU model_gpu = loaded_models[model_handle.hash];
+
+	//Skip the whole model if it's off screen
+	glm::vec4 planes[6];
+	Meshlets::extract_frustum_planes(camera_data->proj_matrix * camera_data->view_matrix, planes);
+	const Bounds model_bounds = BoundingVolumes::transform_bounds(model_gpu.bounds, model_matrix);
+	if (!BoundingVolumes::is_visible(model_bounds, planes))
+		return;
+
 	for (int i = 0; i < model_gpu.n_meshes; i++)
 	{
+		//Estimate how many pixels one texture repeat covers on screen at the closest point of the mesh, so streamed textures know which
+		//mip they need. Meshes with several instances use the whole model's bounds instead of checking every instance
+		const MeshGPU& mesh = model_gpu.meshes[i];
+		const Bounds mesh_bounds = mesh.n_instances > 1 ? model_bounds : BoundingVolumes::transform_bounds(mesh.bounds, mesh.n_instances == 1 ? model_matrix * mesh.instances[0] : model_matrix);
+		const float distance = glm::max(glm::length(mesh_bounds.center - camera_data->view_pos) - glm::max(mesh_bounds.radius, 0.0f), 0.001f);
+		const float projected_size_pixels = texture_streaming_world_size * camera_data->proj_matrix[1][1] * 0.5f * static_cast<float>(render_ctx.resolution.y) / distance;
+		request_texture_mip(model_gpu.materials[i].tex_col, projected_size_pixels, mesh_bounds);
+		request_texture_mip(model_gpu.materials[i].tex_nrm, projected_size_pixels, mesh_bounds);
+		request_texture_mip(model_gpu.materials[i].tex_mtl, projected_size_pixels, mesh_bounds);
+		request_texture_mip(model_gpu.materials[i].tex_rgh, projected_size_pixels, mesh_bounds);
+		request_texture_mip(model_gpu.materials[i].tex_orm, projected_size_pixels, mesh_bounds);
+
+		//Meshes the model uses in several places get one instanced draw per LOD. With instancing off, every instance is a regular draw
+		if (mesh_instancing && mesh.n_instances > 1)
+		{
+			queue_instanced_mesh(mesh, model_gpu.materials[i], model_matrix, planes);
+			continue;
+		}
+		for (int instance = 0; instance < glm::max(mesh.n_instances, 1); instance++)
+		{
+			const glm::mat4 instance_matrix = mesh.n_instances > 0 ? model_matrix * mesh.instances[instance] : model_matrix;
+			if (!BoundingVolumes::is_visible(BoundingVolumes::transform_bounds(mesh.bounds, instance_matrix), planes))
+				continue;
+			MeshRenderData render_data
+			{
+				mesh,
+				model_gpu.materials[i],
+				instance_matrix,
+				select_mesh_lod(mesh, instance_matrix),
+				0,
+				0
+			};
+			mesh_queue.push_back(render_data);
+		}
+	}
+}
+
+//Culls the instances of a mesh against the view frustum, and queues one instanced draw for every LOD the visible instances picked
+void Renderer::queue_instanced_mesh(const MeshGPU& mesh, const MaterialGPU& material, const glm::mat4& model_matrix, const glm::vec4 planes[6])
+{
+	instance_lods.resize(mesh.n_instances);
+	for (int i = 0; i < mesh.n_instances; i++)
+	{
+		const glm::mat4 instance_matrix = model_matrix * mesh.instances[i];
+		const bool is_visible = BoundingVolumes::is_visible(BoundingVolumes::transform_bounds(mesh.bounds, instance_matrix), planes);
+		instance_lods[i] = is_visible ? select_mesh_lod(mesh, instance_matrix) : -1;
+	}
+
+	//The instance matrices also map packed vertex positions back to model space, which the model matrix does for regular draws
+	const glm::mat4 unpack_matrix = glm::scale(glm::translate(glm::mat4(1.0f), mesh.position_offset), glm::vec3(mesh.position_scale));
+	for (int lod = 0; lod < glm::max(mesh.n_lods, 1); lod++)
+	{
+		const int first_instance = static_cast<int>(instance_matrices.size());
+		for (int i = 0; i < mesh.n_instances; i++)
+		{
+			if (instance_lods[i] == lod)
+				instance_matrices.push_back(mesh.instances[i] * unpack_matrix);
+		}
+		const int n_instances = static_cast<int>(instance_matrices.size()) - first_instance;
+		if (n_instances == 0)
+			continue;
+
 		MeshRenderData render_data
 		{
-			model_gpu.meshes[i],
-			model_gpu.materials[i],
-			model_matrix
+			mesh,
+			material,
+			model_matrix,
+			lod,
+			first_instance,
+			n_instances
 		};
 		mesh_queue.push_back(render_data);
 	}
 }
 
+//Tests each meshlet against the view frustum and its normal cone, and returns the index ranges of the ones that might be visible.
+//Neighbouring visible meshlets are merged into one range, so a mostly visible mesh still only needs a few draws
+void Renderer::cull_meshlets(const MeshGPU& mesh, const MeshLod& lod, const glm::mat4& model_matrix, std::vector<DrawRange>& ranges_out)
+{
+	ranges_out.clear();
+
+	//Meshlet bounds are in model space, so bring the frustum and camera there instead of transforming every meshlet
+	glm::vec4 planes[6];
+	Meshlets::extract_frustum_planes(camera_data->proj_matrix * camera_data->view_matrix * model_matrix, planes);
+	const glm::vec3 camera_position = glm::vec3(glm::inverse(model_matrix) * glm::vec4(camera_data->view_pos, 1.0f));
+
+	for (uint32_t i = lod.meshlet_offset; i < lod.meshlet_offset + lod.meshlet_count; i++)
+	{
+		const Meshlet& meshlet = mesh.meshlets[i];
+		if (!Meshlets::is_meshlet_visible(meshlet, planes, camera_position))
+			continue;
+
+		meshlets_visible++;
+		if (!ranges_out.empty() && ranges_out.back().index_offset + ranges_out.back().index_count == meshlet.index_offset)
+			ranges_out.back().index_count += meshlet.index_count;
+		else
+			ranges_out.push_back({ meshlet.index_offset, meshlet.index_count });
+	}
+	meshlets_total += static_cast<int>(lod.meshlet_count);
+}
+
+//Picks the lowest detail LOD whose error, projected to the screen at the nearest point of the mesh's bounds, is at most lod_error_pixels
+int Renderer::select_mesh_lod(const MeshGPU& mesh, const glm::mat4& model_matrix) const
+{
+	if (!mesh_lods || mesh.n_lods <= 1)
+		return 0;
+
+	const float scale = glm::max(glm::max(glm::length(glm::vec3(model_matrix[0])), glm::length(glm::vec3(model_matrix[1]))), glm::length(glm::vec3(model_matrix[2])));
+	const glm::vec3 center = glm::vec3(model_matrix * glm::vec4(mesh.bounds.center, 1.0f));
+	const float distance = glm::max(glm::length(center - camera_data->view_pos) - mesh.bounds.radius * scale, 0.001f);
+	const float pixels_per_unit = camera_data->proj_matrix[1][1] * 0.5f * static_cast<float>(render_ctx.resolution.y) / distance;
+
+	int lod = 0;
+	while (lod + 1 < mesh.n_lods && mesh.lods[lod + 1].error * scale * pixels_per_unit <= lod_error_pixels)
+		lod++;
+	return lod;
+}
+
+//Lowers the desired mip of a streamed texture so that one texel roughly maps to one pixel
+void Renderer::request_texture_mip(const TextureGPU texture, const float projected_size_pixels, const Bounds& bounds)
+{
+	if (texture.streaming_id == 0)
+		return;
+
+	StreamedTexture& streamed_texture = streamed_textures[texture.streaming_id - 1];
+	const float texture_size = static_cast<float>(glm::max(streamed_texture.width, streamed_texture.height));
+	const int mip = glm::clamp(static_cast<int>(glm::log2(texture_size / glm::max(projected_size_pixels, 1.0f))), 0, streamed_texture.n_mips - 1);
+	if (mip <= streamed_texture.desired_mip)
+	{
+		streamed_texture.desired_mip = mip;
+		streamed_texture.desired_position = bounds.center;
+		streamed_texture.desired_radius = glm::max(bounds.radius, 0.0f);
+	}
+}
+
 void Renderer::draw_text(const std::string& text, glm::vec2 pos_pixels)
 {
 	const glm::vec2 correction_factor
@@ -171,4 +360,163 @@ TextureGPU Renderer::upload_font_to_gpu(const ResourceHandle font_texture_handle
 {
 	curr_font = upload_texture_to_gpu(font_texture_handle);
 	return curr_font;
-}
\ No newline at end of file
+}
+
+//Packs a material's occlusion, roughness and metallic maps into one texture, so the shader samples them with a single fetch.
+//Packed textures have no file to reload from when streaming, so their pixels stay in memory
+ResourceHandle Renderer::create_orm_texture(const MaterialResource& material)
+{
+	TextureResource* sources[3]{
+		resource_manager->get_resource<TextureResource>(material.tex_occ),
+		resource_manager->get_resource<TextureResource>(material.tex_rgh),
+		resource_manager->get_resource<TextureResource>(material.tex_mtl),
+	};
+	if (sources[0] == nullptr && sources[1] == nullptr && sources[2] == nullptr)
+		return { 0, ResourceType::invalid };
+
+	//Materials that use the same maps share the packed texture too
+	std::string name = "orm";
+	for (const auto* source : sources)
+	{
+		name += std::string(" - ") + (source != nullptr ? source->name : "none");
+	}
+	const ResourceHandle existing_handle{ ResourceManager::generate_hash_from_string(name), ResourceType::texture };
+	if (resource_manager->get_resource<TextureResource>(existing_handle) != nullptr)
+		return existing_handle;
+
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TextureResource - " + name;
+	auto* packed = static_cast<TextureResource*>(dynamic_allocate(sizeof(TextureResource), alignof(TextureResource)));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	const int source_channels[3]{ 0, material.rgh_channel, material.mtl_channel };
+	const uint8_t fallbacks[3]{ 255, 255, 0 };
+	packed->load_packed(name, sources, source_channels, fallbacks);
+	const ResourceHandle packed_handle = resource_manager->load_resource_from_buffer<TextureResource>(name, packed);
+
+	for (auto* source : sources)
+	{
+		if (source != nullptr)
+			source->schedule_unload();
+	}
+	return packed_handle;
+}
+
+TextureGPU Renderer::upload_orm_texture(const MaterialResource& material)
+{
+	const ResourceHandle packed_handle = create_orm_texture(material);
+	const auto existing_texture = loaded_textures.find(packed_handle.hash);
+	if (existing_texture != loaded_textures.end())
+		return existing_texture->second;
+	return upload_texture_to_gpu(packed_handle, false, false, true, BlockFormat::bc7);
+}
+
+//Projects the environment onto spherical harmonics for the diffuse ambient light, which the lit shader reads from the lighting constant buffer
+void Renderer::set_ambient_from_cubemap(const std::vector<ResourceHandle>& texture_handle)
+{
+	TextureResource* faces[6];
+	uint64_t faces_version;
+	if (!get_cubemap_faces(texture_handle, faces, faces_version))
+		return;
+	const Pixel32* face_data[6];
+	for (int i = 0; i < 6; i++)
+		face_data[i] = faces[i]->data;
+
+	const uint64_t inputs[2]{ faces_version, static_cast<uint64_t>(IblPrefilter::sh_source_size) };
+	const uint64_t version = faces_version != 0 ? AssetCache::hash_data(reinterpret_cast<const char*>(inputs), sizeof(inputs)) : 0;
+	char* coefficients = load_or_generate_cached(std::string("cubemap sh - ") + faces[0]->name, version, sizeof(glm::vec3) * 9, [&](char* output)
+	{
+		IblPrefilter::project_spherical_harmonics(face_data, faces[0]->width, *reinterpret_cast<glm::vec3(*)[9]>(output), false);
+	});
+	for (int i = 0; i < 9; i++)
+		lighting_data->sh_coefficients[i] = glm::vec4(reinterpret_cast<glm::vec3*>(coefficients)[i], 0.0f);
+	dynamic_free(coefficients);
+
+	init_or_update_constant_buffer((int)ConstantBufferType::lighting_data, lighting_cb_gpu, lighting_data);
+	bind_constant_buffer((int)ConstantBufferType::lighting_data, lighting_cb_gpu);
+}
+
+//Checks that all six faces are loaded, square and the same size. The version combines their source versions, or is 0 if one of them isn't known
+bool Renderer::get_cubemap_faces(const std::vector<ResourceHandle>& texture_handle, TextureResource* (&faces)[6], uint64_t& version)
+{
+	//Make sure there are enough sides for the cubemap
+	if (texture_handle.size() != 6)
+	{
+		Logger::logf("[ERROR] Texture resources list does not have 6 entries! Skipping...");
+		return false;
+	}
+
+	uint64_t face_versions[6];
+	for (int i = 0; i < 6; i++)
+	{
+		faces[i] = resource_manager->get_resource<TextureResource>(texture_handle[i]);
+		if (faces[i] == nullptr || faces[i]->data == nullptr)
+		{
+			Logger::logf("[ERROR] Cubemap face %i could not be loaded! Skipping...\n", i);
+			return false;
+		}
+		if (faces[i]->width != faces[i]->height || faces[i]->width != faces[0]->width)
+		{
+			Logger::logf("[ERROR] Cubemap face %i: texture \"%s\" is %ix%i, but every face has to be square and the same size! Skipping...\n", i, faces[i]->name, faces[i]->width, faces[i]->height);
+			return false;
+		}
+		face_versions[i] = faces[i]->source_version;
+	}
+
+	const bool is_cacheable = std::all_of(face_versions, face_versions + 6, [](const uint64_t face_version) { return face_version != 0; });
+	version = is_cacheable ? AssetCache::hash_data(reinterpret_cast<const char*>(face_versions), sizeof(face_versions)) : 0;
+	return true;
+}
+
+//For data that only depends on its inputs, like prefiltered environment maps. Version 0 means the inputs aren't known, which skips the cache
+char* Renderer::load_or_generate_cached(const std::string& key, const uint64_t version, const uint32_t size_bytes, const std::function<void(char*)>& generate)
+{
+	if (version != 0)
+	{
+		uint32_t cached_size = 0;
+		char* cached_data = AssetCache::load(key, version, cached_size);
+		if (cached_data != nullptr && cached_size == size_bytes)
+			return cached_data;
+		dynamic_free(cached_data);
+	}
+
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = key;
+	char* data = static_cast<char*>(dynamic_allocate(size_bytes, 16));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	generate(data);
+	if (version != 0)
+		AssetCache::store(key, version, data, size_bytes);
+	return data;
+}
+
+//Converts vertices to the compact layout. Positions are quantized within the bounding cube rather than the bounding box,
+//so the scale that gets folded into the model matrix is uniform and doesn't skew normals
+std::vector<PackedVertex> Renderer::pack_vertex_buffer(const Vertex* vertices, const int n_vertices, glm::vec3& position_offset, float& position_scale)
+{
+	glm::vec3 min(FLT_MAX);
+	glm::vec3 max(-FLT_MAX);
+	for (int i = 0; i < n_vertices; i++)
+	{
+		min = glm::min(min, vertices[i].position);
+		max = glm::max(max, vertices[i].position);
+	}
+	const glm::vec3 extent = n_vertices > 0 ? max - min : glm::vec3(0.0f);
+	position_offset = n_vertices > 0 ? min : glm::vec3(0.0f);
+	position_scale = glm::max(glm::max(extent.x, extent.y), extent.z);
+	if (position_scale <= 0.0f)
+		position_scale = 1.0f;
+
+	std::vector<PackedVertex> packed_vertices(n_vertices);
+	for (int i = 0; i < n_vertices; i++)
+	{
+		const Vertex& vertex = vertices[i];
+		PackedVertex& packed = packed_vertices[i];
+		const glm::vec3 position = glm::clamp((vertex.position - position_offset) / position_scale, 0.0f, 1.0f);
+		const uint64_t position_packed = glm::packUnorm4x16(glm::vec4(position, 0.0f));
+		memcpy(packed.position, &position_packed, sizeof(packed.position));
+		packed.normal = glm::packSnorm3x10_1x2(glm::vec4(vertex.normal, 0.0f));
+		packed.tangent = glm::packSnorm3x10_1x2(glm::vec4(vertex.tangent, 0.0f));
+		packed.colour = glm::packUnorm4x8(glm::vec4(glm::clamp(vertex.colour, 0.0f, 1.0f), 1.0f));
+		packed.texcoord[0] = glm::packHalf1x16(vertex.texcoord.x);
+		packed.texcoord[1] = glm::packHalf1x16(vertex.texcoord.y);
+	}
+	return packed_vertices;
+}
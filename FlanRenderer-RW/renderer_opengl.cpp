@@ -1,14 +1,20 @@
+#include <algorithm>
 #include <GL/gl3w.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
 #include <imgui_impl_opengl3_loader.h>
 
+#include "asset_cache.h"
 #include "common_defines.h"
+#include "ibl_prefilter.h"
 #include "input.h"
+#include "load_telemetry.h"
 #include "logger.h"
 #include "renderer.h"
 #include "resource_manager.h"
+#include "texture_compression.h"
+#include "texture_packer.h"
 
 static void debug_callback_func(
 	GLenum source,
@@ -19,6 +25,48 @@ static void debug_callback_func(
 	const GLchar* message,
 	const GLvoid* userParam);
 
+//S3TC isn't part of core OpenGL, but every desktop driver supports it
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+static GLenum get_texture_format(const BlockFormat block_format, const bool is_srgb)
+{
+	switch (block_format)
+	{
+	case BlockFormat::bc1: return is_srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	case BlockFormat::bc3: return is_srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BlockFormat::bc4: return GL_COMPRESSED_RED_RGTC1;
+	case BlockFormat::bc5: return GL_COMPRESSED_RG_RGTC2;
+	case BlockFormat::bc7: return is_srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: return is_srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+	}
+}
+
+//Single channel maps get their value in every colour channel, the same as the greyscale RGBA8 textures they replace
+static void set_texture_swizzle(const GLuint texture, const BlockFormat block_format)
+{
+	if (block_format != BlockFormat::bc4)
+		return;
+	const GLint swizzle[4]{ GL_RED, GL_RED, GL_RED, GL_ONE };
+	glTextureParameteriv(texture, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+}
+
+//Shaders read the instance matrix from attribute locations 5 to 8, one column each. Outside of instanced draws those attributes are
+//disabled, and read as this constant identity matrix instead
+static void set_default_instance_matrix()
+{
+	for (int column = 0; column < 4; column++)
+	{
+		glVertexAttrib4f(5 + column, column == 0 ? 1.0f : 0.0f, column == 1 ? 1.0f : 0.0f, column == 2 ? 1.0f : 0.0f, column == 3 ? 1.0f : 0.0f);
+	}
+}
+
 ShaderGPU Renderer::load_shader(std::string path)
 {
 	const ShaderGPU shader_gpu{ glCreateProgram() };
@@ -80,6 +128,9 @@ TextureGPU Renderer::get_framebuffer_texture()
 
 void Renderer::bind_texture(int slot, TextureGPU texture)
 {
+	//Streamed textures are recreated when their resident mips change, so get the current texture object
+	if (texture.streaming_id != 0)
+		texture.handle = streamed_textures[texture.streaming_id - 1].handle;
 	glBindTextureUnit(slot, texture.handle);
 }
 
@@ -106,15 +157,30 @@ void Renderer::bind_material_pbr(MaterialGPU material)
 	//Bind textures - if a material doesn't have a texture for a certain slot, that texture handle is 0, which means "no texture" in OpenGL
 	if (material.tex_col.handle != 0) { bind_texture(0, material.tex_col); } else { bind_texture(0, tex_default_col); }
 	if (material.tex_nrm.handle != 0) { bind_texture(1, material.tex_nrm); } else { bind_texture(1, tex_default_nrm); }	
-	if (material.tex_mtl.handle != 0) { bind_texture(2, material.tex_mtl); } else { bind_texture(2, tex_default_mtl); }
-	if (material.tex_rgh.handle != 0) { bind_texture(3, material.tex_rgh); } else { bind_texture(3, tex_default_rgh); }
+	if (orm_textures)
+	{
+		if (material.tex_orm.handle != 0) { bind_texture(2, material.tex_orm); } else { bind_texture(2, tex_default_orm); }
+	}
+	else
+	{
+		if (material.tex_mtl.handle != 0) { bind_texture(2, material.tex_mtl); } else { bind_texture(2, tex_default_mtl); }
+		if (material.tex_rgh.handle != 0) { bind_texture(3, material.tex_rgh); } else { bind_texture(3, tex_default_rgh); }
+	}
 	bind_texture(4, ibl_brdf_lut);
 	bind_texture(5, curr_cubemap);
+	bind_texture(6, curr_irradiance_map);
 
 	//Create and bind constant buffer
 	ConstantBufferGPU material_const_buffer_gpu{};
 	auto* material_buffer_data =  static_cast<MaterialDataConstantBuffer*>(allocate_temporary(sizeof(MaterialDataConstantBuffer)));
-	memcpy(&material_buffer_data->mul_col.r, &material.mul_col.r, sizeof(MaterialDataConstantBuffer));
+	material_buffer_data->mul_col = glm::vec3(material.mul_col);
+	material_buffer_data->mul_nrm = material.mul_nrm;
+	material_buffer_data->mul_rgh = glm::vec3(material.mul_rgh);
+	material_buffer_data->mul_mtl = glm::vec3(material.mul_mtl);
+	material_buffer_data->mul_emm = material.mul_emm;
+	material_buffer_data->mul_tex = material.mul_tex;
+	memcpy(material_buffer_data->tex_rects, material.tex_rects, sizeof(material.tex_rects));
+	material_buffer_data->tex_layers = material.tex_layers;
 	init_or_update_constant_buffer<MaterialDataConstantBuffer>(static_cast<int>(ConstantBufferType::material_data), material_const_buffer_gpu, material_buffer_data);
 	glBindBufferBase(GL_UNIFORM_BUFFER, static_cast<int>(ConstantBufferType::material_data), material_const_buffer_gpu.handle);
 	temporary_const_buffers.push_back(material_const_buffer_gpu);
@@ -139,6 +205,8 @@ void Renderer::create_render_context()
 	//Set clear colour and disable vsync
 	glClearColor(0.1f, 0.1f, 0.2f, 1.0f);
 	glfwSwapInterval(0);
+
+	set_default_instance_matrix();
 }
 
 void Renderer::init_framebuffer()
@@ -199,21 +267,48 @@ void Renderer::init_framebuffer()
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)(12 * sizeof(float)));
 }
 
-TextureGPU Renderer::upload_texture_to_gpu(const ResourceHandle texture_handle, bool is_srgb, bool unload_resource_afterwards)
+TextureGPU Renderer::upload_texture_to_gpu(const ResourceHandle texture_handle, bool is_srgb, bool unload_resource_afterwards, bool allow_streaming, BlockFormat block_format)
 {
 	if (texture_handle.type == ResourceType::invalid)
 		return { 0 };
 	//Get texture resource
 	auto* texture_resource = resource_manager->get_resource<TextureResource>(texture_handle);
+	if (texture_resource == nullptr)
+		return { 0 };
 	Logger::logf("Loading texture '%s', size = %ix%i\n", texture_resource->name, texture_resource->width, texture_resource->height);
+	LoadTimer timer(texture_handle.hash, LoadPhase::gpu_upload);
+
+	//Compressing also generates the mips
+	if (!texture_compression)
+		block_format = BlockFormat::none;
+	if (block_format != BlockFormat::none && (texture_resource->block_format != block_format || texture_resource->compressed_data == nullptr))
+		texture_resource->compress(block_format, is_srgb);
+
+	//Big textures only get their smallest mips uploaded for now, the rest is streamed in when a draw needs them
+	if (allow_streaming && texture_streaming && glm::max(texture_resource->width, texture_resource->height) > texture_streaming_initial_size)
+	{
+		TextureGPU texture_gpu = create_streamed_texture(texture_handle, texture_resource, is_srgb, block_format, unload_resource_afterwards);
+		loaded_textures[texture_handle.hash] = texture_gpu;
+		return texture_gpu;
+	}
 
 	//Create texture on GPU
 	TextureGPU texture_gpu{};
 	glGenTextures(1, &texture_gpu.handle);
 	glBindTexture(GL_TEXTURE_2D, texture_gpu.handle);
-	glTexImage2D(GL_TEXTURE_2D, 0, is_srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, texture_resource->width, texture_resource->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture_resource->data);
-	glGenerateMipmap(GL_TEXTURE_2D);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	if (texture_resource->n_mips == 1)
+		texture_resource->generate_mips(is_srgb);
+	const GLenum format = get_texture_format(block_format, is_srgb);
+	for (int level = 0; level < texture_resource->n_mips; level++)
+	{
+		if (block_format != BlockFormat::none)
+			glCompressedTexImage2D(GL_TEXTURE_2D, level, format, texture_resource->get_mip_width(level), texture_resource->get_mip_height(level), 0, texture_resource->get_compressed_mip_size(level), texture_resource->get_compressed_mip_data(level));
+		else
+			glTexImage2D(GL_TEXTURE_2D, level, format, texture_resource->get_mip_width(level), texture_resource->get_mip_height(level), 0, GL_RGBA, GL_UNSIGNED_BYTE, texture_resource->get_mip_data(level));
+	}
+	set_texture_swizzle(texture_gpu.handle, block_format);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, texture_resource->n_mips - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, texture_resource->n_mips > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
 	//glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
@@ -227,50 +322,249 @@ TextureGPU Renderer::upload_texture_to_gpu(const ResourceHandle texture_handle,
 	return texture_gpu;
 }
 
-TextureGPU Renderer::upload_cubemap_to_gpu(std::vector<ResourceHandle> texture_handle, bool unload_resource_afterwards)
+//Image based lighting needs the environment blurred by how rough a surface is, which gets done once on the CPU and kept in the asset cache.
+//The faces are uploaded as linear RGBA like before, so they're filtered as linear too
+TextureGPU Renderer::upload_cubemap_to_gpu(std::vector<ResourceHandle> texture_handle, bool unload_resource_afterwards, TextureGPU* irradiance_map)
 {
-	//Make sure there are enough sides for the cubemap
-	if (texture_handle.size() != 6)
-	{
-		Logger::logf("[ERROR] Texture resources list does not have 6 entries! Skipping...");
+	//Faces should be in order -X, +X, -Y, +Y, -Z, +Z
+	TextureResource* faces[6];
+	uint64_t faces_version;
+	if (!get_cubemap_faces(texture_handle, faces, faces_version))
 		return { 0 };
-	}
+	const Pixel32* face_data[6];
+	for (int i = 0; i < 6; i++)
+		face_data[i] = faces[i]->data;
+	LoadTimer timer(texture_handle[0].hash, LoadPhase::gpu_upload);
 
-	//Create texture object
-	TextureGPU texture;
+	//The cached results stay valid as long as the faces and the prefilter settings do
+	const int face_size = faces[0]->width;
+	const int n_mips = IblPrefilter::get_n_mips(face_size);
+	const uint64_t inputs[4]{ faces_version, static_cast<uint64_t>(IblPrefilter::specular_samples), static_cast<uint64_t>(IblPrefilter::irradiance_size), static_cast<uint64_t>(IblPrefilter::irradiance_source_size) };
+	const uint64_t version = faces_version != 0 ? AssetCache::hash_data(reinterpret_cast<const char*>(inputs), sizeof(inputs)) : 0;
 
-	glGenTextures(1, &texture.handle);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texture.handle);
+	const auto upload_faces = [](const Pixel32* data, const int size, const int n_levels)
+	{
+		TextureGPU texture;
+		glGenTextures(1, &texture.handle);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texture.handle);
+		for (int level = 0; level < n_levels; level++)
+		{
+			const int level_size = glm::max(size >> level, 1);
+			for (int face = 0; face < 6; face++)
+			{
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGBA, level_size, level_size, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
+				data += level_size * level_size;
+			}
+		}
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, n_levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		return texture;
+	};
 
-	//Loop over each cubemap entry; It should be in order -X, +X, -Y, +Y, -Z, +Z
-	for (int i = 0; i < 6; i++)
+	const std::string name = faces[0]->name;
+	char* specular = load_or_generate_cached("cubemap specular - " + name, version, IblPrefilter::get_cubemap_size(face_size, n_mips), [&](char* output)
 	{
-		auto* tex_resource = resource_manager->get_resource<TextureResource>(texture_handle[i]);
-		tex_resource->scheduled_for_unload = true;
+		IblPrefilter::prefilter_specular(face_data, face_size, reinterpret_cast<Pixel32*>(output), n_mips, false);
+	});
+	const TextureGPU texture = upload_faces(reinterpret_cast<Pixel32*>(specular), face_size, n_mips);
+	dynamic_free(specular);
 
-		if (tex_resource == nullptr)
+	if (irradiance_map != nullptr)
+	{
+		const int irradiance_size = IblPrefilter::irradiance_size;
+		char* irradiance = load_or_generate_cached("cubemap irradiance - " + name, version, IblPrefilter::get_cubemap_size(irradiance_size, 1), [&](char* output)
 		{
-			Logger::logf("Cubemap face %i: texture \"%s\" could not be loaded!", i, tex_resource->name);
+			IblPrefilter::convolve_irradiance(face_data, face_size, reinterpret_cast<Pixel32*>(output), irradiance_size, false);
+		});
+		*irradiance_map = upload_faces(reinterpret_cast<Pixel32*>(irradiance), irradiance_size, 1);
+		dynamic_free(irradiance);
+	}
+
+	if (unload_resource_afterwards)
+	{
+		for (auto* face : faces)
+			face->schedule_unload();
+	}
+	return texture;
+}
+
+//The split sum BRDF LUT only depends on its size and sample count, so after the first run it comes straight from the asset cache.
+//u is n dot v and v is 1 - roughness, which is how the Assets/Textures/ibl_brdf_lut.png this replaces ended up on the GPU, so the lit shader's
+//lookup doesn't change. The scale and bias to F0 are in red and green
+TextureGPU Renderer::create_brdf_lut()
+{
+	const int size = IblPrefilter::brdf_lut_size;
+	constexpr uint64_t layout_version = 2;	//Version 1 had roughness 0 in the first row
+	const uint64_t inputs[3]{ static_cast<uint64_t>(size), static_cast<uint64_t>(IblPrefilter::brdf_samples), layout_version };
+	const uint64_t version = AssetCache::hash_data(reinterpret_cast<const char*>(inputs), sizeof(inputs));
+	char* lut = load_or_generate_cached("ibl brdf lut", version, size * size * 2 * sizeof(uint16_t), [size](char* output)
+	{
+		IblPrefilter::integrate_brdf(size, reinterpret_cast<uint16_t*>(output));
+	});
+
+	TextureGPU texture{};
+	glCreateTextures(GL_TEXTURE_2D, 1, &texture.handle);
+	glTextureStorage2D(texture.handle, 1, GL_RG16F, size, size);
+	glTextureSubImage2D(texture.handle, 0, 0, 0, size, size, GL_RG, GL_HALF_FLOAT, lut);
+	glTextureParameteri(texture.handle, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTextureParameteri(texture.handle, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTextureParameteri(texture.handle, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTextureParameteri(texture.handle, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	dynamic_free(lut);
+	return texture;
+}
+
+TextureGPU Renderer::create_streamed_texture(const ResourceHandle texture_handle, TextureResource* texture_resource, const bool is_srgb, const BlockFormat block_format, const bool unload_resource_afterwards)
+{
+	if (texture_resource->n_mips == 1)
+		texture_resource->generate_mips(is_srgb);
+
+	StreamedTexture streamed_texture;
+	streamed_texture.resource = texture_handle;
+	streamed_texture.path = texture_resource->name;
+	streamed_texture.width = texture_resource->width;
+	streamed_texture.height = texture_resource->height;
+	streamed_texture.n_mips = texture_resource->n_mips;
+	streamed_texture.resident_mip = texture_resource->n_mips;
+	streamed_texture.is_srgb = is_srgb;
+	streamed_texture.block_format = block_format;
+	streamed_texture.unload_resource_when_resident = unload_resource_afterwards;
+
+	//Start at the first mip that fits in the initial size
+	int initial_mip = 0;
+	while (glm::max(texture_resource->get_mip_width(initial_mip), texture_resource->get_mip_height(initial_mip)) > texture_streaming_initial_size)
+	{
+		initial_mip++;
+	}
+	streamed_texture.desired_mip = initial_mip;
+	set_texture_resident_mip(streamed_texture, initial_mip, texture_resource);
+
+	streamed_textures.push_back(streamed_texture);
+	return { streamed_texture.handle, static_cast<uint32_t>(streamed_textures.size()) };
+}
+
+//Recreates a streamed texture so it holds the mips from new_resident_mip down to 1x1. Mips that were already resident are copied on the GPU,
+//new ones are uploaded from the texture resource, which can be nullptr if the texture only loses mips
+void Renderer::set_texture_resident_mip(StreamedTexture& texture, const int new_resident_mip, TextureResource* texture_resource)
+{
+	const auto mip_width = [&texture](const int level) { return glm::max(texture.width >> level, 1); };
+	const auto mip_height = [&texture](const int level) { return glm::max(texture.height >> level, 1); };
+	LoadTimer timer(texture.resource.hash, LoadPhase::gpu_upload);
+
+	//Create texture with only the levels we want
+	GLuint new_handle;
+	glCreateTextures(GL_TEXTURE_2D, 1, &new_handle);
+	glTextureStorage2D(new_handle, texture.n_mips - new_resident_mip, get_texture_format(texture.block_format, texture.is_srgb), mip_width(new_resident_mip), mip_height(new_resident_mip));
+	glTextureParameteri(new_handle, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTextureParameteri(new_handle, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	set_texture_swizzle(new_handle, texture.block_format);
+
+	//Copy the levels that are already on the GPU
+	uint64_t resident_bytes = 0;
+	for (int level = glm::max(new_resident_mip, texture.resident_mip); level < texture.n_mips; level++)
+	{
+		glCopyImageSubData(
+			texture.handle, GL_TEXTURE_2D, level - texture.resident_mip, 0, 0, 0,
+			new_handle, GL_TEXTURE_2D, level - new_resident_mip, 0, 0, 0,
+			mip_width(level), mip_height(level), 1);
+	}
+
+	//Upload the new ones
+	for (int level = new_resident_mip; level < texture.resident_mip; level++)
+	{
+		if (texture.block_format != BlockFormat::none)
+			glCompressedTextureSubImage2D(new_handle, level - new_resident_mip, 0, 0, mip_width(level), mip_height(level), get_texture_format(texture.block_format, texture.is_srgb), texture_resource->get_compressed_mip_size(level), texture_resource->get_compressed_mip_data(level));
+		else
+			glTextureSubImage2D(new_handle, level - new_resident_mip, 0, 0, mip_width(level), mip_height(level), GL_RGBA, GL_UNSIGNED_BYTE, texture_resource->get_mip_data(level));
+	}
+
+	//Swap them out
+	for (int level = new_resident_mip; level < texture.n_mips; level++)
+	{
+		resident_bytes += TextureCompression::get_compressed_size(texture.block_format, mip_width(level), mip_height(level));
+	}
+	if (texture.handle != 0)
+		glDeleteTextures(1, &texture.handle);
+	texture_memory_resident = texture_memory_resident - texture.resident_bytes + resident_bytes;
+	texture.handle = new_handle;
+	texture.resident_mip = new_resident_mip;
+	texture.resident_bytes = resident_bytes;
+}
+
+void Renderer::update_texture_streaming()
+{
+	std::vector<StreamedTexture*> candidates;
+
+	//While over budget, drop mips nobody needs, starting with the textures that have the most detail to spare
+	for (auto& texture : streamed_textures)
+	{
+		if (texture.desired_mip > texture.resident_mip)
+			candidates.push_back(&texture);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const StreamedTexture* lhs, const StreamedTexture* rhs)
+	{
+		return lhs->desired_mip - lhs->resident_mip > rhs->desired_mip - rhs->resident_mip;
+	});
+	for (auto* texture : candidates)
+	{
+		if (texture_memory_resident <= texture_memory_budget)
+			break;
+		set_texture_resident_mip(*texture, texture->desired_mip, nullptr);
+	}
+
+	//Stream in missing mips one level at a time, starting with the textures that are missing the most detail
+	candidates.clear();
+	for (auto& texture : streamed_textures)
+	{
+		if (texture.desired_mip < texture.resident_mip)
+			candidates.push_back(&texture);
+	}
+	std::sort(candidates.begin(), candidates.end(), [](const StreamedTexture* lhs, const StreamedTexture* rhs)
+	{
+		return lhs->resident_mip - lhs->desired_mip > rhs->resident_mip - rhs->desired_mip;
+	});
+	int n_uploads = 0;
+	for (auto* texture : candidates)
+	{
+		if (n_uploads >= texture_streaming_uploads_per_frame)
+			break;
+
+		//Skip it if the next level doesn't fit in the budget
+		const int new_mip = texture->resident_mip - 1;
+		const uint64_t level_bytes = TextureCompression::get_compressed_size(texture->block_format, glm::max(texture->width >> new_mip, 1), glm::max(texture->height >> new_mip, 1));
+		if (texture_memory_resident + level_bytes > texture_memory_budget)
 			continue;
-		}
-		if (tex_resource->data == nullptr)
+
+		//If the pixel data was unloaded after the texture was fully resident, it has to come from disk again. Textures missing more
+		//detail, and closer ones, get loaded first
+		TextureResource* texture_resource = resource_manager->get_resource<TextureResource>(texture->resource);
+		if (texture_resource == nullptr)
 		{
-			Logger::logf("Cubemap face %i: texture \"%s\" could not be loaded!", i, tex_resource->name);
+			const LoadPriority priority{ static_cast<float>(texture->resident_mip - texture->desired_mip), texture->desired_position, texture->desired_radius };
+			resource_manager->load_resource_async<TextureResource>(texture->path, priority);
 			continue;
 		}
-		
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, tex_resource->width, tex_resource->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, tex_resource->data);
-			
-	}
-	glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		if (texture_resource->n_mips == 1)
+			texture_resource->generate_mips(texture->is_srgb);
+		if (texture->block_format != BlockFormat::none && texture_resource->compressed_data == nullptr)
+			texture_resource->compress(texture->block_format, texture->is_srgb);
 
-	return texture;
+		set_texture_resident_mip(*texture, new_mip, texture_resource);
+		n_uploads++;
+
+		if (texture->resident_mip == 0 && texture->unload_resource_when_resident)
+			texture_resource->schedule_unload();
+	}
+
+	//Draws in the next frame will request mips again
+	for (auto& texture : streamed_textures)
+	{
+		texture.desired_mip = texture.n_mips - 1;
+	}
 }
 
 ModelGPU Renderer::upload_mesh_to_gpu(ResourceHandle model_handle, bool unload_resources)
@@ -284,32 +578,79 @@ ModelGPU Renderer::upload_mesh_to_gpu(ResourceHandle model_handle, bool unload_r
 	model_gpu.materials = (MaterialGPU*)dynamic_allocate(sizeof(MaterialGPU) * model_resource->n_materials);
 	model_gpu.n_meshes = model_resource->n_meshes;
 	model_gpu.n_materials = model_resource->n_materials;
+	model_gpu.bounds = model_resource->bounds;
 
-	//Set default handles to 0 by memsetting
-	memset(model_gpu.materials, 0, sizeof(MaterialGPU) * model_resource->n_materials);
+	//Set default handles to 0, and texture rects and layers to "not packed"
+	for (int i = 0; i < model_resource->n_materials; i++)
+		model_gpu.materials[i] = MaterialGPU{};
+
+	//Materials whose UVs leave 0-1 rely on their textures repeating, which atlas entries can't do. Each mesh uses the material with its index
+	std::vector<bool> repeating_materials(model_resource->n_materials, false);
+	for (int i = 0; i < model_resource->n_meshes && i < model_resource->n_materials; i++)
+	{
+		const MeshBufferData& mesh = model_resource->meshes[i];
+		for (int vertex = 0; vertex < mesh.n_verts && !repeating_materials[i]; vertex++)
+		{
+			const glm::vec2 texcoord = mesh.verts[vertex].texcoord * model_resource->materials[i].mul_tex;
+			repeating_materials[i] = texcoord.x < -0.001f || texcoord.y < -0.001f || texcoord.x > 1.001f || texcoord.y > 1.001f;
+		}
+	}
 
 	//Parse all meshes
-	for (int i = 0; i < model_resource->n_meshes; i++)
 	{
-		model_gpu.meshes[i] = init_vertex_buffer(model_resource->meshes[i].verts, model_resource->meshes[i].n_verts);
-		dynamic_free(model_resource->meshes[i].verts);
+		LoadTimer timer(model_handle.hash, LoadPhase::gpu_upload);
+		for (int i = 0; i < model_resource->n_meshes; i++)
+		{
+			model_gpu.meshes[i] = init_vertex_buffer(model_resource->meshes[i].verts, model_resource->meshes[i].n_verts, model_resource->meshes[i].indices, model_resource->meshes[i].n_indices);
+			model_gpu.meshes[i].meshlets = model_resource->meshes[i].meshlets;	//Culling happens on the CPU, so the meshlets stay around
+			model_gpu.meshes[i].n_meshlets = model_resource->meshes[i].n_meshlets;
+			memcpy(model_gpu.meshes[i].lods, model_resource->meshes[i].lods, sizeof(MeshLod) * max_mesh_lods);
+			model_gpu.meshes[i].n_lods = model_resource->meshes[i].n_lods;
+			model_gpu.meshes[i].bounds = model_resource->meshes[i].bounds;
+			model_gpu.meshes[i].instances = model_resource->meshes[i].instances;	//Instances get culled on the CPU too
+			model_gpu.meshes[i].n_instances = model_resource->meshes[i].n_instances;
+			model_gpu.meshes[i].sub_ranges = model_resource->meshes[i].sub_ranges;
+			model_gpu.meshes[i].n_sub_ranges = model_resource->meshes[i].n_sub_ranges;
+			dynamic_free(model_resource->meshes[i].verts);
+			dynamic_free(model_resource->meshes[i].indices);
+		}
 	}
 
 	//Parse all materials
-	for (int i = 0; i < model_resource->n_materials; i++)
+	if (texture_packing)
+	{
+		upload_packed_material_textures(model_resource, model_gpu, repeating_materials);
+	}
+	else
 	{
-		model_gpu.materials[i].tex_col = upload_texture_to_gpu(model_resource->materials[i].tex_col, false, true);
-		model_gpu.materials[i].tex_nrm = upload_texture_to_gpu(model_resource->materials[i].tex_nrm, false, true);
-		model_gpu.materials[i].tex_mtl = upload_texture_to_gpu(model_resource->materials[i].tex_mtl, false, true);
-		model_gpu.materials[i].tex_rgh = upload_texture_to_gpu(model_resource->materials[i].tex_rgh, false, true);
-		/*
-		if (model_resource->materials[i].tex_col != nullptr) {
-			const std::string name = model_resource->materials[i].tex_col->name;
-			const auto resource = model_resource->materials[i].tex_col;
-			const auto handle = resource_manager->load_resource_from_buffer<TextureResource>(name, resource);
-			model_gpu.materials[i].tex_col = upload_texture_to_gpu(handle, true);
+		for (int i = 0; i < model_resource->n_materials; i++)
+		{
+			//Normal maps stay BC7 rather than BC5, since the lit shader reads the normal's z from the texture instead of rebuilding it.
+			//Colour is sRGB, so its mips are averaged in linear space and the sampler converts it back to linear
+			model_gpu.materials[i].tex_col = upload_texture_to_gpu(model_resource->materials[i].tex_col, true, true, true, BlockFormat::bc7);
+			model_gpu.materials[i].tex_nrm = upload_texture_to_gpu(model_resource->materials[i].tex_nrm, false, true, true, BlockFormat::bc7);
+			if (orm_textures)
+			{
+				model_gpu.materials[i].tex_orm = upload_orm_texture(model_resource->materials[i]);
+			}
+			else
+			{
+				//The separate maps are read from their red channel, so glTF's combined metallic roughness texture falls back to the defaults
+				const MaterialResource& material = model_resource->materials[i];
+				if (material.mtl_channel == 0)
+					model_gpu.materials[i].tex_mtl = upload_texture_to_gpu(material.tex_mtl, false, true, true, BlockFormat::bc4);
+				if (material.rgh_channel == 0)
+					model_gpu.materials[i].tex_rgh = upload_texture_to_gpu(material.tex_rgh, false, true, true, BlockFormat::bc4);
+			}
+			/*
+			if (model_resource->materials[i].tex_col != nullptr) {
+				const std::string name = model_resource->materials[i].tex_col->name;
+				const auto resource = model_resource->materials[i].tex_col;
+				const auto handle = resource_manager->load_resource_from_buffer<TextureResource>(name, resource);
+				model_gpu.materials[i].tex_col = upload_texture_to_gpu(handle, true);
+			}
+			*/
 		}
-		*/
 	}
 
 
@@ -318,6 +659,167 @@ ModelGPU Renderer::upload_mesh_to_gpu(ResourceHandle model_handle, bool unload_r
 	return model_gpu;
 }
 
+//Material textures that fit into a texture array or atlas share one GL texture with the other textures in it, so materials only differ in
+//which layer or part of it they read. The rest are uploaded on their own, the same as without packing
+void Renderer::upload_packed_material_textures(const ModelResource* model_resource, ModelGPU& model_gpu, const std::vector<bool>& repeating_materials)
+{
+	//Colour, normal and ORM for every material, in the same order as MaterialGPU's tex_rects and tex_layers
+	constexpr int n_slots = 3;
+	const int n_slot_textures = model_resource->n_materials * n_slots;
+	std::vector<ResourceHandle> slot_handles(n_slot_textures);
+	for (int i = 0; i < model_resource->n_materials; i++)
+	{
+		slot_handles[i * n_slots + 0] = model_resource->materials[i].tex_col;
+		slot_handles[i * n_slots + 1] = model_resource->materials[i].tex_nrm;
+		slot_handles[i * n_slots + 2] = create_orm_texture(model_resource->materials[i]);
+	}
+
+	//A texture has to stay out of the atlases if any material that uses it repeats it
+	std::unordered_map<uint32_t, bool> repeating_textures;
+	for (int i = 0; i < n_slot_textures; i++)
+		repeating_textures[slot_handles[i].hash] = repeating_textures[slot_handles[i].hash] || repeating_materials[i / n_slots];
+
+	//Every slot uses BC7 (see upload_mesh_to_gpu), so the sizes and whether a texture is colour are what split textures into arrays
+	const BlockFormat block_format = texture_compression ? BlockFormat::bc7 : BlockFormat::none;
+	TexturePacker packer;
+	std::unordered_map<uint32_t, int> texture_ids;
+	std::vector<int> slot_texture_ids(n_slot_textures, -1);
+	std::vector<ResourceHandle> texture_handles;
+	std::vector<bool> texture_is_srgb;
+	std::vector<bool> keep_resources;	//The packed ORM textures stay around, other materials may want them again
+	for (int i = 0; i < n_slot_textures; i++)
+	{
+		auto* texture_resource = resource_manager->get_resource<TextureResource>(slot_handles[i]);
+		if (texture_resource == nullptr)
+			continue;
+		const auto existing_id = texture_ids.find(slot_handles[i].hash);
+		if (existing_id != texture_ids.end())
+		{
+			slot_texture_ids[i] = existing_id->second;
+			continue;
+		}
+
+		//Compressing also generates the mips. Colour is sRGB, which also keeps it out of the pages the linear slots go in
+		const bool is_srgb = i % n_slots == 0;
+		if (block_format != BlockFormat::none && (texture_resource->block_format != block_format || texture_resource->compressed_data == nullptr))
+			texture_resource->compress(block_format, is_srgb);
+		else if (block_format == BlockFormat::none && texture_resource->n_mips == 1)
+			texture_resource->generate_mips(is_srgb);
+		const int texture_id = packer.add_texture(texture_resource->width, texture_resource->height, texture_resource->n_mips, block_format, is_srgb, !repeating_textures[slot_handles[i].hash]);
+		texture_ids[slot_handles[i].hash] = texture_id;
+		slot_texture_ids[i] = texture_id;
+		texture_handles.push_back(slot_handles[i]);
+		texture_is_srgb.push_back(is_srgb);
+		keep_resources.push_back(i % n_slots == 2);
+	}
+	packer.pack();
+
+	//Create the pages. They're always fully resident, streaming only works on separate textures
+	const std::vector<TexturePage>& pages = packer.get_pages();
+	std::vector<TextureGPU> pages_gpu(pages.size());
+	for (size_t i = 0; i < pages.size(); i++)
+	{
+		const TexturePage& page = pages[i];
+		const GLenum format = get_texture_format(page.block_format, page.is_srgb);
+		if (page.type == TexturePageType::array)
+		{
+			glCreateTextures(GL_TEXTURE_2D_ARRAY, 1, &pages_gpu[i].handle);
+			glTextureStorage3D(pages_gpu[i].handle, page.n_mips, format, page.width, page.height, page.n_layers);
+		}
+		else
+		{
+			glCreateTextures(GL_TEXTURE_2D, 1, &pages_gpu[i].handle);
+			glTextureStorage2D(pages_gpu[i].handle, page.n_mips, format, page.width, page.height);
+		}
+		glTextureParameteri(pages_gpu[i].handle, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTextureParameteri(pages_gpu[i].handle, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		set_texture_swizzle(pages_gpu[i].handle, page.block_format);
+		Logger::logf("Created texture %s %i, size = %ix%i, %i layers, %i mips\n", page.type == TexturePageType::array ? "array" : "atlas", static_cast<int>(i), page.width, page.height, page.n_layers, page.n_mips);
+	}
+
+	//Copy every packed texture into its page, atlas entries only get the levels the page has
+	std::vector<Pixel32> padded_pixels;
+	std::vector<uint8_t> padded_blocks;
+	for (int texture_id = 0; texture_id < static_cast<int>(texture_handles.size()); texture_id++)
+	{
+		const TexturePlacement& placement = packer.get_placement(texture_id);
+		if (placement.page == -1)
+			continue;
+		auto* texture_resource = resource_manager->get_resource<TextureResource>(texture_handles[texture_id]);
+		const TexturePage& page = pages[placement.page];
+		const GLuint handle = pages_gpu[placement.page].handle;
+		const GLenum format = get_texture_format(page.block_format, page.is_srgb);
+		LoadTimer timer(texture_handles[texture_id].hash, LoadPhase::gpu_upload);
+		for (int level = 0; level < page.n_mips; level++)
+		{
+			const int width = texture_resource->get_mip_width(level);
+			const int height = texture_resource->get_mip_height(level);
+			if (page.type == TexturePageType::array)
+			{
+				if (page.block_format != BlockFormat::none)
+					glCompressedTextureSubImage3D(handle, level, 0, 0, placement.layer, width, height, 1, format, texture_resource->get_compressed_mip_size(level), texture_resource->get_compressed_mip_data(level));
+				else
+					glTextureSubImage3D(handle, level, 0, 0, placement.layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, texture_resource->get_mip_data(level));
+				continue;
+			}
+
+			//Atlas entries go in with their edge texels repeated out into the padding. The padding is a whole number of blocks on every level
+			//the page has, so compressed pages get the padded level compressed again rather than repeating whole edge blocks
+			const int padding = placement.padding >> level;
+			const int padded_width = width + padding * 2;
+			const int padded_height = height + padding * 2;
+			const Pixel32* mip_data = texture_resource->get_mip_data(level);
+			padded_pixels.resize(static_cast<size_t>(padded_width) * padded_height);
+			for (int y = 0; y < padded_height; y++)
+			{
+				const int source_y = std::clamp(y - padding, 0, height - 1);
+				for (int x = 0; x < padded_width; x++)
+					padded_pixels[static_cast<size_t>(y) * padded_width + x] = mip_data[source_y * width + std::clamp(x - padding, 0, width - 1)];
+			}
+			const int x = (placement.x >> level) - padding;
+			const int y = (placement.y >> level) - padding;
+			if (page.block_format != BlockFormat::none)
+			{
+				const uint32_t compressed_size = TextureCompression::get_compressed_size(page.block_format, padded_width, padded_height);
+				padded_blocks.resize(compressed_size);
+				TextureCompression::compress_image(padded_pixels.data(), padded_width, padded_height, page.block_format, padded_blocks.data());
+				glCompressedTextureSubImage2D(handle, level, x, y, padded_width, padded_height, format, compressed_size, padded_blocks.data());
+			}
+			else
+			{
+				glTextureSubImage2D(handle, level, x, y, padded_width, padded_height, GL_RGBA, GL_UNSIGNED_BYTE, padded_pixels.data());
+			}
+		}
+		if (!keep_resources[texture_id])
+			texture_resource->schedule_unload();
+	}
+
+	//Point the materials at their pages, or upload the textures that didn't get packed
+	std::vector<TextureGPU> separate_textures(texture_handles.size());
+	for (int i = 0; i < model_resource->n_materials; i++)
+	{
+		MaterialGPU& material = model_gpu.materials[i];
+		TextureGPU* slot_textures[n_slots]{ &material.tex_col, &material.tex_nrm, &material.tex_orm };
+		for (int slot = 0; slot < n_slots; slot++)
+		{
+			const int texture_id = slot_texture_ids[i * n_slots + slot];
+			if (texture_id == -1)
+				continue;
+			const TexturePlacement& placement = packer.get_placement(texture_id);
+			if (placement.page == -1)
+			{
+				if (separate_textures[texture_id].handle == 0)
+					separate_textures[texture_id] = upload_texture_to_gpu(texture_handles[texture_id], texture_is_srgb[texture_id], !keep_resources[texture_id], true, block_format);
+				*slot_textures[slot] = separate_textures[texture_id];
+				continue;
+			}
+			*slot_textures[slot] = pages_gpu[placement.page];
+			material.tex_rects[slot] = placement.uv_rect;
+			material.tex_layers[slot] = pages[placement.page].type == TexturePageType::array ? placement.layer : -1;
+		}
+	}
+}
+
 void Renderer::clear_framebuffer()
 {
 	glClearColor(0.1f, 0.1f, 0.2f, 1.0f);
@@ -388,6 +890,7 @@ void Renderer::init_or_update_constant_buffer(int slot, ConstantBufferGPU& const
 }
 template void Renderer::init_or_update_constant_buffer(int slot, ConstantBufferGPU& const_buffer, CameraDataConstantBuffer*& buffer_data);
 template void Renderer::init_or_update_constant_buffer(int slot, ConstantBufferGPU& const_buffer, MaterialDataConstantBuffer*& buffer_data);
+template void Renderer::init_or_update_constant_buffer(int slot, ConstantBufferGPU& const_buffer, LightingDataConstantBuffer*& buffer_data);
 
 void Renderer::platform_specific_init()
 {
@@ -406,12 +909,13 @@ void Renderer::platform_specific_init()
 #endif
 }
 
-MeshGPU Renderer::init_vertex_buffer(Vertex* vertices, int n_vertices)
+MeshGPU Renderer::init_vertex_buffer(Vertex* vertices, int n_vertices, uint32_t* indices, int n_indices)
 {
 	MeshGPU mesh_gpu{};
 
-	//Set number of vertices
+	//Set number of vertices and indices
 	mesh_gpu.vert_count = n_vertices;
+	mesh_gpu.index_count = n_indices;
 
 	//Generate buffers on GPU
 	glGenVertexArrays(1, &mesh_gpu.vao);
@@ -421,12 +925,31 @@ MeshGPU Renderer::init_vertex_buffer(Vertex* vertices, int n_vertices)
 	glBindVertexArray(mesh_gpu.vao);
 	glBindBuffer(GL_ARRAY_BUFFER, mesh_gpu.vbo);
 
-	//Setup vertex arrays
-	glVertexAttribPointer(0, sizeof(Vertex::position) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, position.x)));
-	glVertexAttribPointer(1, sizeof(Vertex::normal  ) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, normal  .x)));
-	glVertexAttribPointer(2, sizeof(Vertex::tangent ) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, tangent .x)));
-	glVertexAttribPointer(3, sizeof(Vertex::colour  ) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, colour  .x)));
-	glVertexAttribPointer(4, sizeof(Vertex::texcoord) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, texcoord.x)));
+	if (use_packed_vertices)
+	{
+		//Setup vertex arrays, these are all normalized to floats by the vertex fetch. Positions only bind xyz, so w reads as 1 like the unpacked layout's
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT,        GL_TRUE,  sizeof(PackedVertex), reinterpret_cast<void*>(offsetof(PackedVertex, position)));
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV,    GL_TRUE,  sizeof(PackedVertex), reinterpret_cast<void*>(offsetof(PackedVertex, normal  )));
+		glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV,    GL_TRUE,  sizeof(PackedVertex), reinterpret_cast<void*>(offsetof(PackedVertex, tangent )));
+		glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE,         GL_TRUE,  sizeof(PackedVertex), reinterpret_cast<void*>(offsetof(PackedVertex, colour  )));
+		glVertexAttribPointer(4, 2, GL_HALF_FLOAT,            GL_FALSE, sizeof(PackedVertex), reinterpret_cast<void*>(offsetof(PackedVertex, texcoord)));
+
+		//Send vertices to vertex buffer
+		const std::vector<PackedVertex> packed_vertices = pack_vertex_buffer(vertices, n_vertices, mesh_gpu.position_offset, mesh_gpu.position_scale);
+		glBufferData(GL_ARRAY_BUFFER, static_cast<int>(sizeof(PackedVertex) * n_vertices), packed_vertices.data(), GL_STATIC_DRAW);
+	}
+	else
+	{
+		//Setup vertex arrays
+		glVertexAttribPointer(0, sizeof(Vertex::position) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, position.x)));
+		glVertexAttribPointer(1, sizeof(Vertex::normal  ) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, normal  .x)));
+		glVertexAttribPointer(2, sizeof(Vertex::tangent ) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, tangent .x)));
+		glVertexAttribPointer(3, sizeof(Vertex::colour  ) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, colour  .x)));
+		glVertexAttribPointer(4, sizeof(Vertex::texcoord) / sizeof(float), GL_FLOAT, GL_FALSE, sizeof(Vertex), reinterpret_cast<void*>(offsetof(Vertex, texcoord.x)));
+
+		//Send vertices to vertex buffer
+		glBufferData(GL_ARRAY_BUFFER, static_cast<int>(sizeof(Vertex) * n_vertices), &vertices[0], GL_STATIC_DRAW);
+	}
 
 	//Enable vertex arrays
 	glEnableVertexAttribArray(0);
@@ -435,12 +958,25 @@ MeshGPU Renderer::init_vertex_buffer(Vertex* vertices, int n_vertices)
 	glEnableVertexAttribArray(3);
 	glEnableVertexAttribArray(4);
 
-	//Send vertices to vertex buffer
-	glBufferData(GL_ARRAY_BUFFER, static_cast<int>(sizeof(Vertex) * n_vertices), &vertices[0], GL_STATIC_DRAW);
+	//Send indices to index buffer, as 16-bit if every vertex fits. The index buffer binding is stored in the vertex array
+	glGenBuffers(1, &mesh_gpu.ebo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh_gpu.ebo);
+	if (n_vertices <= 65536)
+	{
+		std::vector<uint16_t> indices_16(indices, indices + n_indices);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<int>(sizeof(uint16_t) * n_indices), indices_16.data(), GL_STATIC_DRAW);
+		mesh_gpu.index_type = GL_UNSIGNED_SHORT;
+	}
+	else
+	{
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, static_cast<int>(sizeof(uint32_t) * n_indices), indices, GL_STATIC_DRAW);
+		mesh_gpu.index_type = GL_UNSIGNED_INT;
+	}
 
 	//Unbind buffers
 	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
 	return mesh_gpu;
 }
@@ -526,9 +1062,73 @@ bool Renderer::load_shader_part(const std::string& path, ShaderType type, const
 	return true;
 }
 
-void Renderer::issue_draw_call(int draw_count)
+void Renderer::issue_draw_call(MeshGPU mesh)
+{
+	if (mesh.ebo != 0)
+		glDrawElements(GL_TRIANGLES, mesh.index_count, mesh.index_type, nullptr);
+	else
+		glDrawArrays(GL_TRIANGLES, 0, mesh.vert_count);
+}
+
+//Draws only the given parts of the index buffer, all in one call
+void Renderer::issue_draw_call(MeshGPU mesh, const std::vector<DrawRange>& ranges)
+{
+	if (mesh.ebo == 0 || ranges.empty())
+		return;
+
+	const size_t index_size = mesh.index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+	if (ranges.size() == 1)
+	{
+		glDrawElements(GL_TRIANGLES, ranges[0].index_count, mesh.index_type, reinterpret_cast<const void*>(ranges[0].index_offset * index_size));
+		return;
+	}
+
+	std::vector<GLsizei> counts(ranges.size());
+	std::vector<const void*> offsets(ranges.size());
+	for (size_t i = 0; i < ranges.size(); i++)
+	{
+		counts[i] = static_cast<GLsizei>(ranges[i].index_count);
+		offsets[i] = reinterpret_cast<const void*>(ranges[i].index_offset * index_size);
+	}
+	glMultiDrawElements(GL_TRIANGLES, counts.data(), mesh.index_type, offsets.data(), static_cast<GLsizei>(ranges.size()));
+}
+
+//Draws one range of the mesh's indices once for every instance, with the instance matrices starting at first_instance
+void Renderer::issue_draw_call_instanced(MeshGPU mesh, const DrawRange range, const int first_instance, const int n_instances)
 {
-	glDrawArrays(GL_TRIANGLES, 0, draw_count);
+	if (mesh.ebo == 0 || n_instances <= 0 || instance_buffer == 0)
+		return;
+
+	//The instance attributes are part of the mesh's vertex array, so they're only enabled for the length of this draw
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	for (int column = 0; column < 4; column++)
+	{
+		glVertexAttribPointer(5 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), reinterpret_cast<void*>(sizeof(glm::mat4) * first_instance + sizeof(glm::vec4) * column));
+		glVertexAttribDivisor(5 + column, 1);
+		glEnableVertexAttribArray(5 + column);
+	}
+
+	const size_t index_size = mesh.index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+	glDrawElementsInstanced(GL_TRIANGLES, range.index_count, mesh.index_type, reinterpret_cast<const void*>(range.index_offset * index_size), n_instances);
+
+	for (int column = 0; column < 4; column++)
+	{
+		glDisableVertexAttribArray(5 + column);
+	}
+	set_default_instance_matrix();
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vbo);
+}
+
+//Sends the instance matrices of this frame's instanced draws to the GPU in one go
+void Renderer::upload_instance_data()
+{
+	if (instance_matrices.empty())
+		return;
+	if (instance_buffer == 0)
+		glCreateBuffers(1, &instance_buffer);
+
+	//Reallocating the storage every frame means the driver doesn't have to wait for last frame's draws to finish reading it
+	glNamedBufferData(instance_buffer, static_cast<GLsizeiptr>(sizeof(glm::mat4) * instance_matrices.size()), instance_matrices.data(), GL_STREAM_DRAW);
 }
 
 void Renderer::flip_buffers()
@@ -1,9 +1,12 @@
 #pragma once
+#include <cstddef>
+#include <string>
 #include <GL/glcorearb.h>
 #include <glfw/glfw3.h>
 #include <glm/matrix.hpp>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
 #include "resource_handler_structs.h"
 
 #ifdef DIRECTX12
@@ -25,13 +28,78 @@ struct Vertex
 	glm::vec2 texcoord { 0,0 };
 };
 
+//Compact vertex, 24 bytes instead of 56. Every attribute is in a format the vertex fetch converts back to floats, so shaders don't change.
+//Positions are stored relative to the mesh's bounding cube, which MeshGPU's position offset and scale map back to model space
+struct PackedVertex
+{
+	uint16_t position[4];	//Unorm16, the 4th component is padding and isn't bound
+	uint32_t normal;		//Snorm 10:10:10:2
+	uint32_t tangent;		//Snorm 10:10:10:2
+	uint32_t colour;		//Unorm8 RGBA
+	uint16_t texcoord[2];	//Half float
+};
+
+//A small cluster of triangles that can be culled as a whole. Its triangles are a contiguous range of the mesh's index buffer
+struct Meshlet
+{
+	uint32_t index_offset = 0;
+	uint32_t index_count = 0;
+	glm::vec3 center { 0,0,0 };		//Bounding sphere, in model space
+	float radius = 0.0f;
+	glm::vec3 cone_apex { 0,0,0 };	//Normal cone, every triangle faces away from cameras inside it
+	glm::vec3 cone_axis { 0,0,0 };
+	float cone_cutoff = 1.0f;		//Cosine of the cone's angle, 1 if the meshlet can't be backface culled
+};
+
+//One level of detail. All levels of a mesh share its vertices, and their indices follow each other in one index buffer
+struct MeshLod
+{
+	uint32_t index_offset;
+	uint32_t index_count;
+	uint32_t meshlet_offset;
+	uint32_t meshlet_count;
+	float error;	//How far the simplified surface can be from the original, in model space
+};
+
+constexpr int max_mesh_lods = 5;
+
+//Axis aligned box and sphere that both contain the whole mesh or model. The sphere is cheaper to test, the box is tighter
+struct Bounds
+{
+	glm::vec3 min{ 0.0f };
+	glm::vec3 max{ 0.0f };
+	glm::vec3 center{ 0.0f };
+	float radius = -1.0f;	//Negative if there's nothing inside
+};
+
+//Range of indices to draw, in indices rather than bytes
+struct DrawRange
+{
+	uint32_t index_offset;
+	uint32_t index_count;
+};
+
 
 struct MeshGPU
 {
     int vert_count = 0;
+	int index_count = 0;
+	glm::vec3 position_offset{ 0.0f };	//Packed vertex positions are in 0..1, these map them back to model space
+	float position_scale = 1.0f;
+	Meshlet* meshlets = nullptr;
+	int n_meshlets = 0;
+	MeshLod lods[max_mesh_lods]{};
+	int n_lods = 0;
+	Bounds bounds;	//In model space, without the instance transforms
+	glm::mat4* instances = nullptr;	//Transforms of every place the model uses this mesh, on top of the model matrix
+	int n_instances = 0;
+	DrawRange* sub_ranges = nullptr;	//Most detailed LOD of each primitive that was batched into this mesh
+	int n_sub_ranges = 0;
 #ifdef OPENGL
 	GLuint vao = 0;
 	GLuint vbo = 0;
+	GLuint ebo = 0;
+	GLenum index_type = GL_UNSIGNED_INT;
 #else if DIRECTX12
     ComPtr<ID3D12Resource> vertex_buffer;
     D3D12_VERTEX_BUFFER_VIEW vertex_buffer_view;
@@ -44,6 +112,26 @@ struct MeshGPU
 struct TextureGPU
 {
 	GLuint handle = 0;
+	uint32_t streaming_id = 0; //Index + 1 into the renderer's streamed textures, 0 if the texture is fully resident
+};
+
+//A texture that only keeps the mip levels it needs on the GPU. The GL texture object gets recreated whenever that changes
+struct StreamedTexture
+{
+	ResourceHandle resource;
+	std::string path;
+	GLuint handle = 0;
+	int width = 0;
+	int height = 0;
+	int n_mips = 0;
+	int resident_mip = 0;	//Most detailed mip level currently on the GPU
+	int desired_mip = 0;	//Most detailed mip level any draw needed this frame
+	glm::vec3 desired_position{ 0.0f };	//World space bounding sphere of the draw that needed desired_mip, so reloads can be prioritized
+	float desired_radius = 0.0f;
+	bool is_srgb = false;
+	BlockFormat block_format = BlockFormat::none;
+	bool unload_resource_when_resident = false;
+	uint64_t resident_bytes = 0;
 };
 
 struct ShaderGPU
@@ -57,6 +145,7 @@ struct MaterialGPU
 	TextureGPU tex_nrm;
 	TextureGPU tex_rgh;
 	TextureGPU tex_mtl;
+	TextureGPU tex_orm;	//Occlusion, roughness and metallic in the red, green and blue channels, used instead of tex_rgh and tex_mtl with orm_textures on
 	TextureGPU tex_emm;
 	glm::vec4 mul_col;
 	glm::vec3 mul_nrm;
@@ -64,6 +153,8 @@ struct MaterialGPU
 	float mul_mtl;
 	glm::vec3 mul_emm;
 	glm::vec2 mul_tex;
+	glm::vec4 tex_rects[3]{ { 0, 0, 1, 1 }, { 0, 0, 1, 1 }, { 0, 0, 1, 1 } };	//UV offset and scale of the colour, normal and ORM textures within their atlas page
+	glm::ivec4 tex_layers{ -1 };	//Layer of the colour, normal and ORM textures within their texture array, -1 if they aren't in one
 };
 
 struct ModelGPU
@@ -72,12 +163,24 @@ struct ModelGPU
 	MaterialGPU* materials;
 	int n_meshes;
 	int n_materials;
+	Bounds bounds;	//Of every mesh, instances included
 };
 
 struct MeshBufferData
 {
 	Vertex* verts;
 	int n_verts;
+	uint32_t* indices;
+	int n_indices;
+	Meshlet* meshlets;
+	int n_meshlets;
+	MeshLod lods[max_mesh_lods];
+	int n_lods;
+	Bounds bounds;
+	glm::mat4* instances;
+	int n_instances;
+	DrawRange* sub_ranges;
+	int n_sub_ranges;
 };
 
 struct FrameBufferData
@@ -133,20 +236,33 @@ struct CameraDataConstantBuffer
 	glm::vec3 view_pos;
 };
 
+//Laid out the way std140 wants it, vec3s and arrays start on 16 bytes
 struct MaterialDataConstantBuffer
 {
-	glm::vec3 mul_col;
-	glm::vec3 mul_nrm;
-	glm::vec3 mul_rgh;
-	glm::vec3 mul_mtl;
-	glm::vec3 mul_emm;
-	glm::vec2 mul_tex;
+	alignas(16) glm::vec3 mul_col;
+	alignas(16) glm::vec3 mul_nrm;
+	alignas(16) glm::vec3 mul_rgh;
+	alignas(16) glm::vec3 mul_mtl;
+	alignas(16) glm::vec3 mul_emm;
+	alignas(8) glm::vec2 mul_tex;
+	alignas(16) glm::vec4 tex_rects[3];
+	alignas(16) glm::ivec4 tex_layers;
+};
+static_assert(offsetof(MaterialDataConstantBuffer, mul_tex) == 80 && offsetof(MaterialDataConstantBuffer, tex_rects) == 96 && offsetof(MaterialDataConstantBuffer, tex_layers) == 144, "MaterialDataConstantBuffer doesn't match std140");
+
+//Diffuse ambient light as L2 spherical harmonics, already convolved with the cosine lobe and divided by pi. The sum of each coefficient
+//times its basis function (0.282095, 0.488603 * y, 0.488603 * z, 0.488603 * x, 1.092548 * xy, 1.092548 * yz, 0.315392 * (3z^2 - 1),
+//1.092548 * xz, 0.546274 * (x^2 - y^2)) at the normal gives the irradiance
+struct LightingDataConstantBuffer
+{
+	glm::vec4 sh_coefficients[9];	//RGB, w is unused
 };
 
 enum class ConstantBufferType
 {
 	camera_data,
-	material_data
+	material_data,
+	lighting_data,
 };
 
 struct ConstantBufferGPU
@@ -167,6 +283,7 @@ struct ConstantBufferGPU
 struct ModelRenderComponent
 {
 	ResourceHandle model;
+	int bvh_object = -1;	//Object in the scene BVH, which has to be moved along whenever the entity's transform changes
 };
 
 struct MeshRenderData
@@ -174,4 +291,7 @@ struct MeshRenderData
 	MeshGPU mesh;
 	MaterialGPU material;
 	glm::mat4 model_matrix;
+	int lod;
+	int first_instance;	//Range of the renderer's instance matrices to draw with, n_instances is 0 for a regular draw
+	int n_instances;
 };
\ No newline at end of file
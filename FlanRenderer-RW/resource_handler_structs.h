@@ -19,6 +19,17 @@ struct Pixel32
 	uint8_t a = 255;
 };
 
+//GPU block compression formats. They all encode 4x4 pixel blocks to a fixed number of bytes
+enum class BlockFormat
+{
+	none,	//Uncompressed RGBA8
+	bc1,	//RGB, 8 bytes per block
+	bc3,	//RGBA, a BC4 block for alpha followed by a BC1 block for colour, 16 bytes per block
+	bc4,	//Red only, 8 bytes per block
+	bc5,	//Red and green as two BC4 blocks, 16 bytes per block
+	bc7,	//RGBA, 16 bytes per block
+};
+
 struct MemoryChunk
 {
 	std::string name;
@@ -1,10 +1,49 @@
 #include "resource_manager.h"
+#include <algorithm>
+#include <chrono>
 #include <fstream>
+#include <thread>
 
 #include "logger.h"
 
+//Loads that are still waiting are dropped and the ones in flight are finished, then the worker and I/O threads are shut down,
+//since their callbacks point back at this resource manager
+ResourceManager::~ResourceManager()
+{
+	std::unique_lock<std::mutex> lock(streaming_mutex);
+	is_shutting_down = true;
+	pending_reads.clear();
+	while (in_flight_io > 0 || in_flight_decode > 0)
+	{
+		lock.unlock();
+		if (job_system == nullptr || !job_system->try_run_job())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		lock.lock();
+	}
+	for (auto& request : pending_decodes)
+		dynamic_free(request.file_data);
+	pending_decodes.clear();
+	lock.unlock();
+
+	//The I/O threads go first, the last read callbacks can still schedule jobs
+	delete file_io;
+	file_io = nullptr;
+	delete job_system;
+	job_system = nullptr;
+}
+
 void ResourceManager::tick(float dt)
 {
+	//Re-prioritize pending loads, since the camera has probably moved, and start new ones where there's room
+	{
+		std::lock_guard<std::mutex> lock(streaming_mutex);
+		for (auto& request : pending_reads)
+			request.score = calculate_load_score(request.handle.hash);
+		for (auto& request : pending_decodes)
+			request.score = calculate_load_score(request.handle.hash);
+	}
+	dispatch_streaming_requests();
+
 	//Garbage collection
 	curr_timer += dt;
 	if (curr_timer > timer_length)
@@ -12,6 +51,7 @@ void ResourceManager::tick(float dt)
 		curr_timer -= timer_length;
 
 		//Unload resources that are scheduled for unload
+		std::lock_guard<std::mutex> lock(resources_mutex);
 		for (const auto& [hash, resource] : resources)
 		{
 			if (resource->scheduled_for_unload)
@@ -23,6 +63,7 @@ void ResourceManager::tick(float dt)
 					((TextureResource*)resource)->unload();
 					break;
 				}
+				load_states.erase(hash);
 				resources.erase(hash);
 				break;
 			}
@@ -30,9 +71,276 @@ void ResourceManager::tick(float dt)
 	}
 }
 
+void ResourceManager::add_dependency(const uint32_t parent_hash, const uint32_t dependency_hash)
+{
+	{
+		std::lock_guard<std::mutex> lock(resources_mutex);
+		dependencies[parent_hash].push_back(dependency_hash);
+	}
+
+	//A dependency is needed as soon as its parent is, so it inherits the parent's priority if that one is more urgent
+	std::lock_guard<std::mutex> lock(streaming_mutex);
+	const auto parent_priority = load_priorities.find(parent_hash);
+	if (parent_priority != load_priorities.end() && calculate_load_score(parent_hash) > calculate_load_score(dependency_hash))
+	{
+		apply_load_priority_locked(dependency_hash, parent_priority->second);
+	}
+}
+
+bool ResourceManager::is_resource_ready(const ResourceHandle handle)
+{
+	std::lock_guard<std::mutex> lock(resources_mutex);
+	return is_resource_ready_locked(handle.hash);
+}
+
+//Blocks until the resource and all of its dependencies are done loading. Failed loads count as done.
+//The calling thread runs queued jobs while it waits, so a job that waits for a load can't hold up the decode it's waiting for
+void ResourceManager::wait_for_resource(const ResourceHandle handle)
+{
+	std::unique_lock<std::mutex> lock(resources_mutex);
+	while (!is_resource_ready_locked(handle.hash))
+	{
+		lock.unlock();
+		const bool ran_job = get_job_system_instance()->try_run_job();
+		lock.lock();
+
+		//Nothing to help with means the load is still being read. finish_load wakes this up, the timeout catches decodes queued meanwhile
+		if (!ran_job && !is_resource_ready_locked(handle.hash))
+			load_finished.wait_for(lock, std::chrono::milliseconds(1));
+	}
+}
+
+bool ResourceManager::is_resource_ready_locked(const uint32_t hash)
+{
+	//Check the resource itself
+	const auto state = load_states.find(hash);
+	if (state != load_states.end() && (state->second == LoadState::queued || state->second == LoadState::loading))
+		return false;
+
+	//Then check everything it depends on
+	const auto dependency_list = dependencies.find(hash);
+	if (dependency_list == dependencies.end())
+		return true;
+	for (const uint32_t dependency_hash : dependency_list->second)
+	{
+		if (!is_resource_ready_locked(dependency_hash))
+			return false;
+	}
+	return true;
+}
+
+void ResourceManager::set_load_priority(const ResourceHandle handle, const LoadPriority priority)
+{
+	{
+		std::lock_guard<std::mutex> lock(streaming_mutex);
+		apply_load_priority_locked(handle.hash, priority);
+	}
+
+	//Pass it on to everything this resource depends on
+	std::vector<uint32_t> dependency_list;
+	{
+		std::lock_guard<std::mutex> lock(resources_mutex);
+		const auto dependency_entry = dependencies.find(handle.hash);
+		if (dependency_entry != dependencies.end())
+			dependency_list = dependency_entry->second;
+	}
+	for (const uint32_t dependency_hash : dependency_list)
+	{
+		set_load_priority({ dependency_hash, handle.type }, priority);
+	}
+}
+
+void ResourceManager::set_streaming_view(const TransformComponent& camera_transform, const CameraComponent& camera)
+{
+	std::lock_guard<std::mutex> lock(streaming_mutex);
+	streaming_camera_position = camera_transform.get_position();
+	streaming_projection_scale = 1.0f / tanf(camera.fov * 0.5f);
+	streaming_aspect_ratio = camera.aspect_ratio;
+}
+
+void ResourceManager::apply_load_priority_locked(const uint32_t hash, const LoadPriority& priority)
+{
+	load_priorities[hash] = priority;
+	for (auto& request : pending_reads)
+		if (request.handle.hash == hash)
+			request.score = calculate_load_score(hash);
+	for (auto& request : pending_decodes)
+		if (request.handle.hash == hash)
+			request.score = calculate_load_score(hash);
+}
+
+//Only pending requests still have a priority, anything else is already being decoded or done
+void ResourceManager::raise_load_priority(const uint32_t hash, const LoadPriority& priority)
+{
+	std::lock_guard<std::mutex> lock(streaming_mutex);
+	const auto existing_priority = load_priorities.find(hash);
+	if (existing_priority == load_priorities.end())
+		return;
+	const LoadPriority old_priority = existing_priority->second;
+	const float old_score = calculate_load_score(hash);
+	existing_priority->second = priority;
+	if (calculate_load_score(hash) > old_score)
+		apply_load_priority_locked(hash, priority);
+	else
+		existing_priority->second = old_priority;
+}
+
+float ResourceManager::calculate_load_score(const uint32_t hash)
+{
+	const auto priority_entry = load_priorities.find(hash);
+	if (priority_entry == load_priorities.end())
+		return 0.0f;
+	const LoadPriority& priority = priority_entry->second;
+
+	//Resources without a position only get their explicit priority
+	float score = priority_weight * priority.priority;
+	if (priority.radius <= 0.0f)
+		return score;
+
+	//Closer resources go first
+	const float distance = glm::max(glm::length(priority.position - streaming_camera_position) - priority.radius, 0.0f);
+	score += distance_weight / (1.0f + distance);
+
+	//So do resources that cover more of the screen. This is the area of the projected bounding sphere relative to the screen
+	float coverage = 1.0f;
+	if (distance > 0.0f)
+	{
+		const float projected_radius = priority.radius * streaming_projection_scale / (distance + priority.radius);
+		coverage = glm::min(3.14159265f * projected_radius * projected_radius / (4.0f * streaming_aspect_ratio), 1.0f);
+	}
+	score += coverage_weight * coverage;
+	return score;
+}
+
+void ResourceManager::schedule_request(StreamingRequest request)
+{
+	{
+		std::lock_guard<std::mutex> lock(streaming_mutex);
+		request.score = calculate_load_score(request.handle.hash);
+		request.sequence = next_request_sequence++;
+		pending_reads.push_back(std::move(request));
+	}
+	dispatch_streaming_requests();
+}
+
+//Starts as many pending reads and decodes as the in-flight limits allow, highest score first and oldest first between equal scores.
+//This is called whenever a request is added or finishes a stage, and every tick
+void ResourceManager::dispatch_streaming_requests()
+{
+	std::vector<FileReadRequest> reads;
+	{
+		std::lock_guard<std::mutex> lock(streaming_mutex);
+		if (is_shutting_down)
+			return;
+		const auto compare_score = [](const StreamingRequest& lhs, const StreamingRequest& rhs)
+		{
+			return lhs.score < rhs.score || (lhs.score == rhs.score && lhs.sequence > rhs.sequence);
+		};
+
+		//Read files. These are collected into one batch, so the I/O backend can have all of them in flight at once
+		while (in_flight_io < max_in_flight_io && !pending_reads.empty())
+		{
+			const auto best = std::max_element(pending_reads.begin(), pending_reads.end(), compare_score);
+			std::iter_swap(best, pending_reads.end() - 1);
+			StreamingRequest request = std::move(pending_reads.back());
+			pending_reads.pop_back();
+			in_flight_io++;
+
+			{
+				std::lock_guard<std::mutex> resources_lock(resources_mutex);
+				load_states[request.handle.hash] = LoadState::loading;
+			}
+
+			//Try the cache on a worker first, and only queue the actual read if it doesn't have the resource
+			if (request.load_cached)
+			{
+				get_job_system_instance()->schedule([this, request]() mutable
+				{
+					RawResource* resource = request.load_cached(request);
+					request.load_cached = nullptr;
+					{
+						std::lock_guard<std::mutex> lock(streaming_mutex);
+						in_flight_io--;
+						if (resource != nullptr)
+							load_priorities.erase(request.handle.hash);
+						else if (!is_shutting_down)
+							pending_reads.push_back(std::move(request));
+					}
+					if (resource != nullptr)
+						finish_load(request.handle.hash, resource);
+					dispatch_streaming_requests();
+				});
+				continue;
+			}
+
+			FileReadRequest read;
+			read.path = request.path;
+			read.on_complete = [this, request](char* data, const int size_bytes) mutable
+			{
+				request.file_data = data;
+				request.file_size = size_bytes;
+				{
+					std::lock_guard<std::mutex> lock(streaming_mutex);
+					in_flight_io--;
+					pending_decodes.push_back(std::move(request));
+				}
+				dispatch_streaming_requests();
+			};
+			reads.push_back(std::move(read));
+		}
+
+		//Decode files that have been read
+		while (in_flight_decode < max_in_flight_decode && !pending_decodes.empty())
+		{
+			const auto best = std::max_element(pending_decodes.begin(), pending_decodes.end(), compare_score);
+			std::iter_swap(best, pending_decodes.end() - 1);
+			StreamingRequest request = std::move(pending_decodes.back());
+			pending_decodes.pop_back();
+			in_flight_decode++;
+
+			get_job_system_instance()->schedule([this, request]() mutable
+			{
+				RawResource* resource = nullptr;
+				if (request.file_data != nullptr)
+					resource = request.decode(request);
+				dynamic_free(request.file_data);
+				{
+					std::lock_guard<std::mutex> lock(streaming_mutex);
+					in_flight_decode--;
+					load_priorities.erase(request.handle.hash);
+				}
+				finish_load(request.handle.hash, resource);
+				dispatch_streaming_requests();
+			});
+		}
+	}
+
+	//Submitted outside of the lock, since reads can complete (and call back into this function) right away
+	if (!reads.empty())
+		get_file_io_instance()->submit_reads(reads);
+}
+
+void ResourceManager::finish_load(const uint32_t hash, RawResource* resource)
+{
+	{
+		std::lock_guard<std::mutex> lock(resources_mutex);
+		if (resource != nullptr)
+		{
+			resources[hash] = resource;
+			load_states[hash] = LoadState::loaded;
+		}
+		else
+		{
+			load_states[hash] = LoadState::failed;
+		}
+	}
+	load_finished.notify_all();
+}
+
 std::vector<ResourceDebug> ResourceManager::debug_loaded_resources()
 {
 	std::vector<ResourceDebug> result;
+	std::lock_guard<std::mutex> lock(resources_mutex);
 	for (auto resource : resources)
 	{
 
@@ -68,6 +376,9 @@ std::vector<ResourceDebug> ResourceManager::debug_loaded_resources()
 //If the file can not be leaded, the size will be zero and the data pointer will be nullptr
 void ResourceManager::read_file(const std::string& path, int& size_bytes, char*& data, const bool silent)
 {
+	const uint32_t hash = generate_hash_from_string(path);
+	LoadTimer timer(hash, LoadPhase::file_io);
+
 	//Open file
 	std::ifstream file_stream(path, std::ios::binary);
 
@@ -93,20 +404,21 @@ void ResourceManager::read_file(const std::string& path, int& size_bytes, char*&
 	data = static_cast<char*>(get_allocator_instance()->allocate(static_cast<uint32_t>(size)));
 	get_allocator_instance()->curr_memory_chunk_label = "untitled";
 
-	//Load file data into that memory
+	//Load file data straight into that memory
 	file_stream.seekg(0, std::ifstream::beg);
-	std::vector<unsigned char> buffer(std::istreambuf_iterator<char>(file_stream), {});
+	file_stream.read(data, size);
 
-	//Is it actually open?
-	if (buffer.empty())
+	//Did we actually get all of it?
+	if (size_bytes <= 0 || file_stream.gcount() != size)
 	{
 		if (!silent)
 			printf("[ERROR] Failed to open file '%s'!\n", path.c_str());
+		get_allocator_instance()->release(data);
 		size_bytes = 0;
 		data = nullptr;
 		return;
 	}
-	memcpy(data, &buffer[0], size_bytes);
+	LoadTelemetry::add_bytes_read(hash, size_bytes);
 }
 
 DynamicAllocator* ResourceManager::get_allocator_instance()
@@ -120,6 +432,28 @@ DynamicAllocator* ResourceManager::get_allocator_instance()
 
 DynamicAllocator* ResourceManager::allocator = nullptr;
 
+JobSystem* ResourceManager::get_job_system_instance()
+{
+	if (job_system == nullptr)
+	{
+		job_system = new JobSystem();
+	}
+	return job_system;
+}
+
+JobSystem* ResourceManager::job_system = nullptr;
+
+AsyncFileIO* ResourceManager::get_file_io_instance()
+{
+	if (file_io == nullptr)
+	{
+		file_io = new AsyncFileIO();
+	}
+	return file_io;
+}
+
+AsyncFileIO* ResourceManager::file_io = nullptr;
+
 uint32_t ResourceManager::xorshift(const uint32_t input)
 {
 	uint32_t output = input;
@@ -1,13 +1,23 @@
 #pragma once
+#include <condition_variable>
 #include <cstdint>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
+#include <glm/vec3.hpp>
 
+#include "asset_cache.h"
+#include "async_file_io.h"
 #include "common_defines.h"
 #include "dynamic_allocator.h"
+#include "job_system.h"
+#include "load_telemetry.h"
 #include "resource_handler_structs.h"
 #include "resources.h"
 #include "logger.h"
+#include "transform.h"
 
 struct RawResource;
 struct ResourceDebug
@@ -16,34 +26,129 @@ struct ResourceDebug
 	std::string name;
 };
 
+enum class LoadState
+{
+	queued,
+	loading,
+	loaded,
+	failed,
+};
+
+//Hints used by the streaming scheduler to decide which pending loads go first
+struct LoadPriority
+{
+	float priority = 0.0f;		//Explicit priority, higher goes first
+	glm::vec3 position{ 0.0f };	//World space position of whatever uses this resource
+	float radius = 0.0f;		//World space bounding radius, 0 if the resource has no spatial extent
+};
+
+struct StreamingRequest
+{
+	ResourceHandle handle;
+	std::string path;
+	float score = 0.0f;
+	uint64_t sequence = 0;	//Order the requests came in, so requests with the same score go first come first served
+	char* file_data = nullptr;
+	int file_size = 0;
+	std::function<RawResource*(StreamingRequest&)> decode;
+	std::function<RawResource*(StreamingRequest&)> load_cached;	//Tried before the file gets read, so a cache hit never opens it. Empty if there's no cache
+};
+
 class ResourceManager
 {
 public:
 	ResourceManager() {}
+	~ResourceManager();
 	template <class T>
 	ResourceHandle load_resource_from_disk(std::string path);
 	template <class T>
+	ResourceHandle load_resource_async(std::string path, LoadPriority priority = {});
+	template <class T>
 	ResourceHandle load_resource_from_buffer(std::string name, T* buffer_data);
+	void add_dependency(uint32_t parent_hash, uint32_t dependency_hash);
+	bool is_resource_ready(ResourceHandle handle);
+	void wait_for_resource(ResourceHandle handle);
+	void set_load_priority(ResourceHandle handle, LoadPriority priority);
+	void set_streaming_view(const TransformComponent& camera_transform, const CameraComponent& camera);
 	void tick(float dt);
 	static void read_file(const std::string& path, int& size_bytes, char*& data, bool silent = false);
 	template <class T>
 	T* get_resource(ResourceHandle handle);
 	static DynamicAllocator* get_allocator_instance();
 	static DynamicAllocator* allocator;
+	static JobSystem* get_job_system_instance();
+	static JobSystem* job_system;
+	static AsyncFileIO* get_file_io_instance();
+	static AsyncFileIO* file_io;
 	static uint32_t generate_hash_from_string(const std::string& string);
 	std::vector<ResourceDebug> debug_loaded_resources();
 
+	//Streaming scheduler limits
+	int max_in_flight_io = 16;
+	int max_in_flight_decode = 4;
+	float priority_weight = 1.0f;
+	float distance_weight = 1.0f;
+	float coverage_weight = 4.0f;
+
 private:
 	int curr_resource_index = 0;
 	float curr_timer = -10.0f;
 	const float timer_length = 0.05f;
 	static uint32_t xorshift(uint32_t input);
+	bool is_resource_ready_locked(uint32_t hash);
+	void finish_load(uint32_t hash, RawResource* resource);
 	std::unordered_map<uint32_t, RawResource*> resources;
+
+	//Dependency graph; a resource is only ready once everything it depends on is ready too.
+	//Nodes without a load state (like a model's materials) are only there to group dependencies
+	std::unordered_map<uint32_t, LoadState> load_states;
+	std::unordered_map<uint32_t, std::vector<uint32_t>> dependencies;
+	std::mutex resources_mutex;
+	std::condition_variable load_finished;
+
+	//Streaming scheduler; requests wait in pending_reads until an I/O slot frees up, then in pending_decodes until a decode slot frees up.
+	//Both queues are drained highest score first, and scores are recalculated every tick
+	void schedule_request(StreamingRequest request);
+	void dispatch_streaming_requests();
+	float calculate_load_score(uint32_t hash);
+	void apply_load_priority_locked(uint32_t hash, const LoadPriority& priority);
+	void raise_load_priority(uint32_t hash, const LoadPriority& priority);
+	std::vector<StreamingRequest> pending_reads;
+	std::vector<StreamingRequest> pending_decodes;
+	std::unordered_map<uint32_t, LoadPriority> load_priorities;
+	int in_flight_io = 0;
+	int in_flight_decode = 0;
+	uint64_t next_request_sequence = 0;
+	bool is_shutting_down = false;	//No new reads or decodes get started once this is set
+	glm::vec3 streaming_camera_position{ 0.0f };
+	float streaming_projection_scale = 1.0f;
+	float streaming_aspect_ratio = 16.0f / 9.0f;
+	std::mutex streaming_mutex;
 };
 
 template <class T>
 ResourceHandle ResourceManager::load_resource_from_disk(std::string path)
 {
+	//If this resource is already being loaded asynchronously, wait for that instead
+	ResourceHandle handle;
+	handle.hash = generate_hash_from_string(path);
+	handle.type = T::type_enum();
+	{
+		std::unique_lock<std::mutex> lock(resources_mutex);
+		const auto state = load_states.find(handle.hash);
+		if (state != load_states.end() && (state->second == LoadState::queued || state->second == LoadState::loading))
+		{
+			lock.unlock();
+			LoadTelemetry::add_request_dedupe(handle.hash);
+			wait_for_resource(handle);
+			return handle;
+		}
+		load_states[handle.hash] = LoadState::loading;
+		dependencies.erase(handle.hash);
+	}
+
+	LoadTelemetry::set_name(handle.hash, path, T::name_string());
+
 	//Load resource
 	get_allocator_instance()->curr_memory_chunk_label = T::name_string() + " - " + path;
 	T* resource = static_cast<T*>(dynamic_allocate(sizeof(T), alignof(T)));
@@ -53,18 +158,89 @@ ResourceHandle ResourceManager::load_resource_from_disk(std::string path)
 	{
 		Logger::logf("error loading %s", path.c_str());
 		dynamic_free(resource);
+		finish_load(handle.hash, nullptr);
 		return { 0, ResourceType::invalid };
 	}
 
-	//Generate, set, and return handle
+	//Set and return handle
+	{
+		std::lock_guard<std::mutex> lock(resources_mutex);
+		if (resources.find(handle.hash) != resources.end())
+		{
+			((T*)resources[handle.hash])->unload();
+		}
+	}
+	finish_load(handle.hash, (RawResource*)resource);
+
+	//Anything this resource depends on was scheduled during load, so wait for it to finish
+	wait_for_resource(handle);
+	return handle;
+}
+
+//Returns a handle right away, and queues the resource for loading on a worker thread. Use is_resource_ready() or
+//wait_for_resource() before accessing it. Requesting a resource that is already loaded or in flight
+//returns the existing handle, and makes it more urgent if it's still waiting and the new priority is higher
+template <class T>
+ResourceHandle ResourceManager::load_resource_async(std::string path, LoadPriority priority)
+{
 	ResourceHandle handle;
 	handle.hash = generate_hash_from_string(path);
-	handle.type = resource->resource_type;
-	if (resources.find(handle.hash) != resources.end())
+	handle.type = T::type_enum();
+	bool is_requested = false;
+	{
+		std::lock_guard<std::mutex> lock(resources_mutex);
+		if (load_states.find(handle.hash) != load_states.end())
+			is_requested = true;
+		else
+			load_states[handle.hash] = LoadState::queued;
+	}
+	if (is_requested)
+	{
+		LoadTelemetry::add_request_dedupe(handle.hash);
+		raise_load_priority(handle.hash, priority);
+		return handle;
+	}
+	LoadTelemetry::set_name(handle.hash, path, T::name_string());
+
+	StreamingRequest request;
+	request.handle = handle;
+	request.path = path;
+	request.decode = [this](StreamingRequest& request_to_decode) -> RawResource*
+	{
+		get_allocator_instance()->curr_memory_chunk_label = T::name_string() + " - " + request_to_decode.path;
+		T* resource = static_cast<T*>(dynamic_allocate(sizeof(T), alignof(T)));
+		get_allocator_instance()->curr_memory_chunk_label = "unknown";
+		if (resource->load_from_memory(request_to_decode.path, request_to_decode.file_data, request_to_decode.file_size, this) == false)
+		{
+			Logger::logf("error loading %s", request_to_decode.path.c_str());
+			dynamic_free(resource);
+			return nullptr;
+		}
+		return (RawResource*)resource;
+	};
+
+	//Textures keep their decoded pixels in the asset cache
+	if constexpr (std::is_same_v<T, TextureResource>)
 	{
-		((T*)resources[handle.hash])->unload();
+		request.load_cached = [](StreamingRequest& request_to_load) -> RawResource*
+		{
+			get_allocator_instance()->curr_memory_chunk_label = T::name_string() + " - " + request_to_load.path;
+			T* resource = static_cast<T*>(dynamic_allocate(sizeof(T), alignof(T)));
+			get_allocator_instance()->curr_memory_chunk_label = "unknown";
+			if (resource->load_from_cache(request_to_load.path, AssetCache::get_file_stamp(request_to_load.path)) == false)
+			{
+				dynamic_free(resource);
+				return nullptr;
+			}
+			return (RawResource*)resource;
+		};
 	}
-	resources[handle.hash] = (RawResource*)resource;
+
+	{
+		std::lock_guard<std::mutex> lock(streaming_mutex);
+		load_priorities[handle.hash] = priority;
+	}
+	schedule_request(std::move(request));
 	return handle;
 }
 
@@ -75,7 +251,7 @@ ResourceHandle ResourceManager::load_resource_from_buffer(std::string name, T* b
 	ResourceHandle handle;
 	handle.hash = generate_hash_from_string(name);
 	handle.type = buffer_data->resource_type;
-	resources[handle.hash] = (RawResource*)buffer_data;
+	finish_load(handle.hash, (RawResource*)buffer_data);
 	return handle;
 }
 
@@ -84,5 +260,9 @@ T* ResourceManager::get_resource(const ResourceHandle handle)
 {
 	if (handle.hash == 0 || handle.type == ResourceType::invalid)
 		return nullptr;
-	return (T*)(resources[handle.hash]);
+	std::lock_guard<std::mutex> lock(resources_mutex);
+	const auto resource = resources.find(handle.hash);
+	if (resource == resources.end())
+		return nullptr;
+	return (T*)(resource->second);
 }
@@ -10,27 +10,119 @@
 #define TINYGLTF_NOEXCEPTION
 #define JSON_NOEXCEPTION
 
+#include <cfloat>
 #include <glm/vec2.hpp>
 #include <glm/vec3.hpp>
 
+#include "asset_cache.h"
+#include "bounds.h"
 #include "common_defines.h"
 #include "dynamic_allocator.h"
+#include "gltf_accessor.h"
+#include "load_telemetry.h"
 #include "logger.h"
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "meshlets.h"
+#include "mip_generator.h"
 #include "renderer_structs.h"
 #include "resource_handler_structs.h"
+#include "texture_compression.h"
 #include "tinygltf/tiny_gltf.h"
+#include "vertex_transform.h"
 
 bool TextureResource::load(const std::string path, ResourceManager const* resource_manager, bool silent)
 {
-	//Get name
-	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - name - " + path;
+	//Cached pixels mean the image file doesn't have to be read at all
+	const uint64_t stamp = AssetCache::get_file_stamp(path);
+	if (load_from_cache(path, stamp))
+		return true;
+
+	//Read image file
+	int file_size;
+	char* file_data;
+	ResourceManager::read_file(path, file_size, file_data, silent);
+
+	//Decode it
+	const bool success = load_from_memory(path, file_data, file_size, resource_manager, silent, stamp);
+	dynamic_free(file_data);
+	return success;
+}
 
-	//Load image file
-	int channels;
-	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - data - " + path;
-	uint8_t* u8_data = stbi_load(path.c_str(), &width, &height, &channels, 4);
-	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
-		
+//Decoded pixels are cached, keyed by a stamp of the source (see AssetCache::get_file_stamp), so each image only has to be decoded once.
+//Cache entries store the pixels followed by the width and height, so the pixels can be used in place
+static std::string get_pixel_cache_key(const std::string& path)
+{
+	return "texture - " + path;
+}
+
+//Loads the decoded pixels from the asset cache, if it has them for this version of the source. Never touches the source itself
+bool TextureResource::load_from_cache(const std::string& path, const uint64_t stamp)
+{
+	if (stamp == 0 || !AssetCache::enabled)
+		return false;
+
+	const uint32_t hash = ResourceManager::generate_hash_from_string(path);
+	uint8_t* u8_data = nullptr;
+	{
+		LoadTimer timer(hash, LoadPhase::decode);
+		uint32_t cached_size = 0;
+		char* cached_data = AssetCache::load(get_pixel_cache_key(path), stamp, cached_size);
+		int cached_size_2d[2]{};
+		if (cached_data != nullptr && cached_size >= sizeof(cached_size_2d))
+			memcpy(cached_size_2d, cached_data + cached_size - sizeof(cached_size_2d), sizeof(cached_size_2d));
+		if (cached_data != nullptr && static_cast<uint64_t>(cached_size_2d[0]) * cached_size_2d[1] * sizeof(Pixel32) + sizeof(cached_size_2d) == cached_size)
+		{
+			width = cached_size_2d[0];
+			height = cached_size_2d[1];
+			u8_data = reinterpret_cast<uint8_t*>(cached_data);
+		}
+		else
+		{
+			dynamic_free(cached_data);
+		}
+	}
+	LoadTelemetry::add_asset_cache_result(hash, u8_data != nullptr);
+	if (u8_data == nullptr)
+		return false;
+
+	source_version = stamp;
+	return set_pixels(path, u8_data, 4, true);
+}
+
+//The stamp identifies this version of the source for the cache. 0 takes it from the file at path, which won't exist for embedded images
+bool TextureResource::load_from_memory(const std::string& path, const char* file_data, int file_size, ResourceManager const* resource_manager, bool silent, const uint64_t stamp)
+{
+	const uint32_t hash = ResourceManager::generate_hash_from_string(path);
+	source_version = stamp != 0 ? stamp : AssetCache::get_file_stamp(path);
+	int channels = 4;
+	uint8_t* u8_data = nullptr;
+	if (file_data != nullptr)
+	{
+		LoadTimer timer(hash, LoadPhase::decode);
+
+		//Decode image file
+		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - data - " + path;
+		u8_data = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(file_data), file_size, &width, &height, &channels, 4);
+		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+
+		//Leave room for the size at the end, so the cache entry can be written straight from the pixel data
+		if (u8_data != nullptr && AssetCache::enabled && source_version != 0)
+		{
+			const uint32_t pixel_size = static_cast<uint32_t>(width) * height * sizeof(Pixel32);
+			const int size_2d[2]{ width, height };
+			u8_data = static_cast<uint8_t*>(ResourceManager::get_allocator_instance()->reallocate(u8_data, pixel_size + sizeof(size_2d), 16));
+			memcpy(u8_data + pixel_size, size_2d, sizeof(size_2d));
+			AssetCache::store(get_pixel_cache_key(path), source_version, reinterpret_cast<const char*>(u8_data), pixel_size + sizeof(size_2d));
+		}
+	}
+	return set_pixels(path, u8_data, channels, silent);
+}
+
+//Takes ownership of decoded RGBA pixels, and fills in everything else
+bool TextureResource::set_pixels(const std::string& path, uint8_t* u8_data, const int channels, const bool silent)
+{
 	//Error checking
 	if (u8_data == nullptr)
 	{
@@ -53,6 +145,10 @@ bool TextureResource::load(const std::string path, ResourceManager const* resour
 
 	//Set data
 	data = reinterpret_cast<Pixel32*>(u8_data);
+	n_mips = 1;
+	mip_chain = nullptr;
+	block_format = BlockFormat::none;
+	compressed_data = nullptr;
 
 	//Return
 	resource_type = ResourceType::texture;
@@ -78,6 +174,11 @@ bool TextureResource::load(tinygltf::Image image, ResourceManager const* resourc
 	memcpy(data, image.image.data(), image.image.size());
 	height = image.height;
 	width = image.width;
+	n_mips = 1;
+	mip_chain = nullptr;
+	block_format = BlockFormat::none;
+	compressed_data = nullptr;
+	source_version = AssetCache::hash_data(reinterpret_cast<const char*>(image.image.data()), image.image.size());
 	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - name - " + image.name;
 	name = (char*)dynamic_allocate(image.uri.size() + 1);
 	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
@@ -87,14 +188,366 @@ bool TextureResource::load(tinygltf::Image image, ResourceManager const* resourc
 	return result;
 }
 
+//Packs one channel of each source into the red, green and blue channels of a new texture, with alpha at 255. The result has the size
+//of the largest source, smaller ones are resampled with nearest filtering. Missing sources fill their channel with the fallback value
+bool TextureResource::load_packed(const std::string& path, TextureResource* const (&sources)[3], const int (&source_channels)[3], const uint8_t (&fallbacks)[3])
+{
+	//The packed texture can only be cached if every source it came from can be
+	width = 1;
+	height = 1;
+	uint64_t versions[6]{};
+	bool is_cacheable = true;
+	for (int i = 0; i < 3; i++)
+	{
+		if (sources[i] == nullptr || sources[i]->data == nullptr)
+			continue;
+		width = glm::max(width, sources[i]->width);
+		height = glm::max(height, sources[i]->height);
+		versions[i] = sources[i]->source_version;
+		versions[i + 3] = source_channels[i];
+		is_cacheable &= sources[i]->source_version != 0;
+	}
+
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - data - " + path;
+	data = static_cast<Pixel32*>(dynamic_allocate(static_cast<size_t>(width) * height * sizeof(Pixel32)));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TexRes - name - " + path;
+	name = static_cast<char*>(dynamic_allocate(path.size() + 1));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	strcpy(name, path.c_str());
+
+	ResourceManager::get_job_system_instance()->parallel_for(height, [&](const int y)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			Pixel32 pixel;
+			uint8_t* channels = reinterpret_cast<uint8_t*>(&pixel);
+			for (int i = 0; i < 3; i++)
+			{
+				const TextureResource* source = sources[i];
+				if (source == nullptr || source->data == nullptr)
+				{
+					channels[i] = fallbacks[i];
+					continue;
+				}
+				const int source_x = x * source->width / width;
+				const int source_y = y * source->height / height;
+				channels[i] = reinterpret_cast<const uint8_t*>(&source->data[source_x + source_y * source->width])[source_channels[i]];
+			}
+			pixel.a = 255;
+			data[x + y * width] = pixel;
+		}
+	});
+
+	n_mips = 1;
+	mip_chain = nullptr;
+	block_format = BlockFormat::none;
+	compressed_data = nullptr;
+	source_version = is_cacheable ? AssetCache::hash_data(reinterpret_cast<const char*>(versions), sizeof(versions)) : 0;
+	resource_type = ResourceType::texture;
+	scheduled_for_unload = false;
+	return true;
+}
+
 void TextureResource::unload()
 {
 	dynamic_free(data);
+	dynamic_free(mip_chain);
+	dynamic_free(compressed_data);
 	dynamic_free(name);
 	dynamic_free(this);
 }
 
+//Generates the full mip chain down to 1x1. Textures loaded from a file or glTF image keep their mip chain in the asset cache,
+//keyed by the source data and the settings that change the result
+void TextureResource::generate_mips(const bool is_srgb)
+{
+	//Count mip levels and the memory needed for them
+	n_mips = 1;
+	uint32_t chain_size = 0;
+	while (get_mip_width(n_mips - 1) > 1 || get_mip_height(n_mips - 1) > 1)
+	{
+		chain_size += get_mip_width(n_mips) * get_mip_height(n_mips) * sizeof(Pixel32);
+		n_mips++;
+	}
+	if (n_mips == 1)
+		return;
+
+	dynamic_free(mip_chain);
+	mip_chain = nullptr;
+
+	//Try the cache first
+	const std::string cache_key = std::string("texture mips - ") + name;
+	uint32_t alpha_cutoff_bits;
+	memcpy(&alpha_cutoff_bits, &MipGenerator::alpha_cutoff, sizeof(alpha_cutoff_bits));
+	const uint64_t settings[4]{ source_version, is_srgb, MipGenerator::preserve_alpha_coverage, alpha_cutoff_bits };
+	const uint64_t cache_version = AssetCache::hash_data(reinterpret_cast<const char*>(settings), sizeof(settings));
+	if (source_version != 0)
+	{
+		uint32_t cached_size = 0;
+		char* cached_data = AssetCache::load(cache_key, cache_version, cached_size);
+		if (cached_data != nullptr && cached_size == chain_size)
+		{
+			mip_chain = reinterpret_cast<Pixel32*>(cached_data);
+			return;
+		}
+		dynamic_free(cached_data);
+	}
+
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = std::string("TexRes - mips - ") + name;
+	mip_chain = static_cast<Pixel32*>(dynamic_allocate(chain_size));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	MipGenerator::generate_mip_chain(data, width, height, mip_chain, n_mips, is_srgb);
+
+	if (source_version != 0)
+		AssetCache::store(cache_key, cache_version, reinterpret_cast<const char*>(mip_chain), chain_size);
+}
+
+//Block compresses every mip level, generating the mips first if needed. Like the mips, the result is kept in the asset cache
+void TextureResource::compress(const BlockFormat format, const bool is_srgb)
+{
+	if (n_mips == 1)
+		generate_mips(is_srgb);
+
+	dynamic_free(compressed_data);
+	compressed_data = nullptr;
+	block_format = format;
+	if (format == BlockFormat::none)
+		return;
+
+	uint32_t compressed_size = 0;
+	for (int level = 0; level < n_mips; level++)
+	{
+		compressed_size += get_compressed_mip_size(level);
+	}
+
+	//Try the cache first
+	const std::string cache_key = std::string("texture blocks - ") + name;
+	uint32_t alpha_cutoff_bits;
+	memcpy(&alpha_cutoff_bits, &MipGenerator::alpha_cutoff, sizeof(alpha_cutoff_bits));
+	const uint64_t settings[5]{ source_version, is_srgb, MipGenerator::preserve_alpha_coverage, alpha_cutoff_bits, static_cast<uint64_t>(format) };
+	const uint64_t cache_version = AssetCache::hash_data(reinterpret_cast<const char*>(settings), sizeof(settings));
+	if (source_version != 0)
+	{
+		uint32_t cached_size = 0;
+		char* cached_data = AssetCache::load(cache_key, cache_version, cached_size);
+		if (cached_data != nullptr && cached_size == compressed_size)
+		{
+			compressed_data = reinterpret_cast<uint8_t*>(cached_data);
+			return;
+		}
+		dynamic_free(cached_data);
+	}
+
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = std::string("TexRes - blocks - ") + name;
+	compressed_data = static_cast<uint8_t*>(dynamic_allocate(compressed_size));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	for (int level = 0; level < n_mips; level++)
+	{
+		TextureCompression::compress_image(get_mip_data(level), get_mip_width(level), get_mip_height(level), format, get_compressed_mip_data(level));
+	}
+
+	if (source_version != 0)
+		AssetCache::store(cache_key, cache_version, reinterpret_cast<const char*>(compressed_data), compressed_size);
+}
+
+uint32_t TextureResource::get_compressed_mip_size(const int level) const
+{
+	return TextureCompression::get_compressed_size(block_format, get_mip_width(level), get_mip_height(level));
+}
+
+uint8_t* TextureResource::get_compressed_mip_data(const int level)
+{
+	//Skip past the levels before this one
+	uint8_t* mip_data = compressed_data;
+	for (int i = 0; i < level; i++)
+	{
+		mip_data += get_compressed_mip_size(i);
+	}
+	return mip_data;
+}
+
+Pixel32* TextureResource::get_mip_data(const int level)
+{
+	if (level == 0)
+		return data;
+
+	//Skip past the levels before this one
+	Pixel32* mip_data = mip_chain;
+	for (int i = 1; i < level; i++)
+	{
+		mip_data += get_mip_width(i) * get_mip_height(i);
+	}
+	return mip_data;
+}
+
 bool ModelResource::load(std::string path, ResourceManager* resource_manager)
+{
+	//Read GLTF file
+	int file_size;
+	char* file_data;
+	//Map the file instead of reading it, which saves reading the whole file into a heap buffer first. tinygltf still copies a .glb's
+	//binary chunk into its own buffer while parsing, and that copy is what the accessors and embedded images read from
+	{
+		const MappedFile mapped_file(path);
+		if (mapped_file.is_open())
+			return load_from_memory(path, mapped_file.get_data(), static_cast<int>(mapped_file.get_size()), resource_manager);
+	}
+
+	ResourceManager::read_file(path, file_size, file_data);
+	if (file_data == nullptr)
+		return false;
+
+	//Parse it
+	const bool success = load_from_memory(path, file_data, file_size, resource_manager);
+	dynamic_free(file_data);
+	return success;
+}
+
+//Images are decoded by TextureResource, so tinygltf shouldn't decode them into its own buffers too
+static bool skip_image_decode(tinygltf::Image*, const int, std::string*, std::string*, int, int, const unsigned char*, int, void*)
+{
+	return true;
+}
+
+//Decodes an image embedded in the model's buffers (like the ones in .glb files), straight from the buffer without copying the encoded bytes out first
+static ResourceHandle load_embedded_texture(const tinygltf::Model& model, const int texture_index, const std::string& model_path, ResourceManager* resource_manager, std::unordered_map<int, ResourceHandle>& loaded_images)
+{
+	if (texture_index < 0 || texture_index >= static_cast<int>(model.textures.size()))
+		return { 0, ResourceType::invalid };
+	const int image_index = model.textures[texture_index].source;
+	if (image_index < 0 || image_index >= static_cast<int>(model.images.size()) || model.images[image_index].bufferView < 0)
+		return { 0, ResourceType::invalid };
+	if (loaded_images.find(image_index) != loaded_images.end())
+		return loaded_images[image_index];
+
+	//Find the encoded image
+	const tinygltf::BufferView& buffer_view = model.bufferViews[model.images[image_index].bufferView];
+	const std::vector<unsigned char>& buffer = model.buffers[buffer_view.buffer].data;
+	if (buffer_view.byteOffset + buffer_view.byteLength > buffer.size())
+	{
+		Logger::logf("[ERROR] Image %i in model '%s' reads outside of its buffer!\n", image_index, model_path.c_str());
+		return { 0, ResourceType::invalid };
+	}
+	const char* image_data = reinterpret_cast<const char*>(buffer.data() + buffer_view.byteOffset);
+
+	//Decode it, unless the cache has it already. The image can only have changed if the model file did, so the model's stamp stands in for it
+	const std::string name = model_path + " - image " + std::to_string(image_index);
+	const uint64_t stamp = AssetCache::get_file_stamp(model_path);
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "TextureResource - " + name;
+	TextureResource* texture = static_cast<TextureResource*>(dynamic_allocate(sizeof(TextureResource), alignof(TextureResource)));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	LoadTelemetry::set_name(ResourceManager::generate_hash_from_string(name), name, TextureResource::name_string());
+	if (!texture->load_from_cache(name, stamp) && !texture->load_from_memory(name, image_data, static_cast<int>(buffer_view.byteLength), resource_manager, false, stamp))
+	{
+		dynamic_free(texture);
+		loaded_images[image_index] = { 0, ResourceType::invalid };
+		return loaded_images[image_index];
+	}
+	loaded_images[image_index] = resource_manager->load_resource_from_buffer<TextureResource>(name, texture);
+	return loaded_images[image_index];
+}
+
+//Combines meshes that share a material and instances into one mesh, so they take one draw call. The index buffer holds every part's
+//LOD 0, then every part's LOD 1 and so on, which keeps each LOD one contiguous range. Parts with fewer LODs repeat their last one.
+//The parts' buffers are freed, or taken over if there's only one part
+static MeshBufferData merge_mesh_buffers(const std::vector<MeshBufferData*>& parts)
+{
+	MeshBufferData merged{};
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - sub ranges";
+	merged.sub_ranges = static_cast<DrawRange*>(dynamic_allocate(static_cast<uint32_t>(sizeof(DrawRange) * parts.size())));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	merged.n_sub_ranges = static_cast<int>(parts.size());
+	if (parts.size() == 1)
+	{
+		DrawRange* sub_ranges = merged.sub_ranges;
+		merged = *parts[0];
+		merged.sub_ranges = sub_ranges;
+		merged.n_sub_ranges = 1;
+		merged.sub_ranges[0] = { merged.lods[0].index_offset, merged.lods[0].index_count };
+		return merged;
+	}
+
+	//Count everything first, so each buffer is allocated once
+	const auto get_part_lod = [](const MeshBufferData* part, const int lod) -> const MeshLod& { return part->lods[glm::min(lod, part->n_lods - 1)]; };
+	uint32_t n_indices = 0;
+	uint32_t n_meshlets = 0;
+	for (const MeshBufferData* part : parts)
+	{
+		merged.n_verts += part->n_verts;
+		merged.n_lods = glm::max(merged.n_lods, part->n_lods);
+	}
+	for (int lod = 0; lod < merged.n_lods; lod++)
+	{
+		for (const MeshBufferData* part : parts)
+		{
+			n_indices += get_part_lod(part, lod).index_count;
+			n_meshlets += get_part_lod(part, lod).meshlet_count;
+		}
+	}
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - vertex buffers";
+	merged.verts = static_cast<Vertex*>(dynamic_allocate(static_cast<uint32_t>(sizeof(Vertex) * merged.n_verts)));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - index buffers";
+	merged.indices = static_cast<uint32_t*>(dynamic_allocate(static_cast<uint32_t>(sizeof(uint32_t) * n_indices)));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - meshlets";
+	merged.meshlets = static_cast<Meshlet*>(dynamic_allocate(static_cast<uint32_t>(sizeof(Meshlet) * glm::max(n_meshlets, 1u))));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	merged.n_indices = static_cast<int>(n_indices);
+	merged.n_meshlets = static_cast<int>(n_meshlets);
+
+	//Vertices just follow each other, the indices get offset to match
+	int vertex_offset = 0;
+	for (const MeshBufferData* part : parts)
+	{
+		memcpy(merged.verts + vertex_offset, part->verts, sizeof(Vertex) * part->n_verts);
+		vertex_offset += part->n_verts;
+	}
+	uint32_t index_offset = 0;
+	uint32_t meshlet_offset = 0;
+	for (int lod = 0; lod < merged.n_lods; lod++)
+	{
+		MeshLod& merged_lod = merged.lods[lod];
+		merged_lod = { index_offset, 0, meshlet_offset, 0, 0.0f };
+		vertex_offset = 0;
+		for (size_t i = 0; i < parts.size(); i++)
+		{
+			const MeshBufferData* part = parts[i];
+			const MeshLod& part_lod = get_part_lod(part, lod);
+			if (lod == 0)
+				merged.sub_ranges[i] = { index_offset, part_lod.index_count };
+			for (uint32_t index = 0; index < part_lod.index_count; index++)
+				merged.indices[index_offset + index] = part->indices[part_lod.index_offset + index] + vertex_offset;
+			for (uint32_t meshlet = 0; meshlet < part_lod.meshlet_count; meshlet++)
+			{
+				Meshlet& merged_meshlet = merged.meshlets[meshlet_offset + meshlet];
+				merged_meshlet = part->meshlets[part_lod.meshlet_offset + meshlet];
+				merged_meshlet.index_offset = merged_meshlet.index_offset - part_lod.index_offset + index_offset;
+			}
+			index_offset += part_lod.index_count;
+			meshlet_offset += part_lod.meshlet_count;
+			merged_lod.error = glm::max(merged_lod.error, part_lod.error);
+			vertex_offset += part->n_verts;
+		}
+		merged_lod.index_count = index_offset - merged_lod.index_offset;
+		merged_lod.meshlet_count = meshlet_offset - merged_lod.meshlet_offset;
+	}
+
+	merged.bounds = BoundingVolumes::compute_bounds(merged.verts, merged.n_verts);
+
+	//All parts have the same instances, so keep the first part's
+	merged.instances = parts[0]->instances;
+	merged.n_instances = parts[0]->n_instances;
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		dynamic_free(parts[i]->verts);
+		dynamic_free(parts[i]->indices);
+		dynamic_free(parts[i]->meshlets);
+		if (i > 0)
+			dynamic_free(parts[i]->instances);
+	}
+	return merged;
+}
+
+bool ModelResource::load_from_memory(const std::string& path, const char* file_data, int file_size, ResourceManager* resource_manager)
 {
 	//Load GLTF file
 	tinygltf::TinyGLTF loader;
@@ -102,15 +555,71 @@ bool ModelResource::load(std::string path, ResourceManager* resource_manager)
 	std::string error;
 	std::string warning;
 
-	loader.LoadASCIIFromFile(&model, &error, &warning, path);
-
 	std::string path_to_model_folder = path.substr(0, path.find_last_of('/')) + "/";
+	const uint32_t model_hash = ResourceManager::generate_hash_from_string(path);
+
+	//Binary glTF is recognized by its magic rather than the file extension
+	bool parsed;
+	{
+		LoadTimer timer(model_hash, LoadPhase::gltf_parse);
+		loader.SetImageLoader(skip_image_decode, nullptr);
+		if (file_size >= 12 && memcmp(file_data, "glTF", 4) == 0)
+			parsed = loader.LoadBinaryFromMemory(&model, &error, &warning, reinterpret_cast<const unsigned char*>(file_data), static_cast<unsigned int>(file_size), path_to_model_folder);
+		else
+			parsed = loader.LoadASCIIFromString(&model, &error, &warning, file_data, static_cast<unsigned int>(file_size), path_to_model_folder);
+	}
+	if (!parsed)
+	{
+		Logger::logf("[ERROR] Model '%s' could not be parsed: %s\n", path.c_str(), error.c_str());
+		return false;
+	}
+
+	//Go through each node and add it to the primitive vector
+	std::vector<GltfPrimitiveInstance> primitive_instances;
+	{
+		//Get nodes
+		if (model.scenes.empty())
+		{
+			Logger::logf("[ERROR] Model '%s' has no scenes!\n", path.c_str());
+			return false;
+		}
+		auto& scene = model.scenes[model.defaultScene >= 0 ? model.defaultScene : 0];
+		traverse_nodes(scene.nodes, model, glm::mat4(1.0f), primitive_instances);
+	}
+
+	//Find out where each material is used, so the streaming scheduler can load the textures of nearby materials first.
+	//glTF requires the min and max of position accessors, so this works before any vertices are processed
+	std::vector<Bounds> material_bounds(model.materials.size());
+	for (const auto& instance : primitive_instances)
+	{
+		const auto position = instance.primitive->attributes.find("POSITION");
+		const int material_id = instance.primitive->material;
+		if (material_id < 0 || material_id >= static_cast<int>(model.materials.size()) || position == instance.primitive->attributes.end() ||
+			position->second < 0 || position->second >= static_cast<int>(model.accessors.size()))
+			continue;
+		const tinygltf::Accessor& accessor = model.accessors[position->second];
+		if (accessor.minValues.size() < 3 || accessor.maxValues.size() < 3)
+			continue;
+		Bounds primitive_bounds{};
+		primitive_bounds.min = glm::vec3(accessor.minValues[0], accessor.minValues[1], accessor.minValues[2]);
+		primitive_bounds.max = glm::vec3(accessor.maxValues[0], accessor.maxValues[1], accessor.maxValues[2]);
+		primitive_bounds.center = (primitive_bounds.min + primitive_bounds.max) * 0.5f;
+		primitive_bounds.radius = glm::length(primitive_bounds.max - primitive_bounds.min) * 0.5f;
+		material_bounds[material_id] = BoundingVolumes::merge_bounds(material_bounds[material_id], BoundingVolumes::transform_bounds(primitive_bounds, instance.transform));
+	}
+
+	//Textures are loaded on worker threads. The model depends on each material, and each material depends on its textures,
+	//so the model only counts as loaded once all of its textures are done
 
 	//Parse materials
 	std::vector<MaterialResource> materials_vector;
+	std::unordered_map<int, ResourceHandle> embedded_images;
 	{
 		for (auto& model_material : model.materials)
 		{
+			const uint32_t material_hash = ResourceManager::generate_hash_from_string(path + " - material " + std::to_string(materials_vector.size()));
+			resource_manager->add_dependency(model_hash, material_hash);
+
 			//Create material
 			MaterialResource pbr_material;
 
@@ -122,13 +631,29 @@ bool ModelResource::load(std::string path, ResourceManager* resource_manager)
 				model_material.pbrMetallicRoughness.baseColorFactor[3]
 				);
 
-			//Find base colour texture
-			int index_texture_colour = model_material.pbrMetallicRoughness.baseColorTexture.index;
-			if (index_texture_colour != -1)
+			//Find base colour texture. Texture and image indices come from the file, so ones outside the model count as no texture
+			const int index_texture_colour = model_material.pbrMetallicRoughness.baseColorTexture.index;
+			int index_image_colour = -1;
+			if (index_texture_colour >= 0 && index_texture_colour < static_cast<int>(model.textures.size()))
+				index_image_colour = model.textures[index_texture_colour].source;
+			if (index_image_colour >= static_cast<int>(model.images.size()))
+				index_image_colour = -1;
+			if (index_image_colour >= 0 && model.images[index_image_colour].bufferView != -1)
+			{
+				//Images embedded in the model are decoded right here. glTF already packs metallic and roughness in one texture,
+				//the renderer repacks them with occlusion when the material gets uploaded
+				pbr_material.tex_col = load_embedded_texture(model, index_texture_colour, path, resource_manager, embedded_images);
+				pbr_material.tex_nrm = load_embedded_texture(model, model_material.normalTexture.index, path, resource_manager, embedded_images);
+				pbr_material.tex_occ = load_embedded_texture(model, model_material.occlusionTexture.index, path, resource_manager, embedded_images);
+				pbr_material.tex_rgh = load_embedded_texture(model, model_material.pbrMetallicRoughness.metallicRoughnessTexture.index, path, resource_manager, embedded_images);
+				pbr_material.tex_mtl = pbr_material.tex_rgh;
+				pbr_material.rgh_channel = 1;
+				pbr_material.mtl_channel = 2;
+			}
+			else if (index_image_colour >= 0)
 			{
 				//Find file path parts
-				int index_image_colour = model.textures[index_texture_colour].source;
-				auto image = model.images[index_image_colour];
+				const auto& image = model.images[index_image_colour];
 				std::string file_path_from_model = image.uri;
 				std::string path_from_model_folder_to_texture_folder = file_path_from_model.substr(0, file_path_from_model.find_last_of('/')) + "/";
 				std::string file_extension = file_path_from_model.substr(file_path_from_model.find_last_of('.'));
@@ -138,10 +663,18 @@ bool ModelResource::load(std::string path, ResourceManager* resource_manager)
 				//Create textures - TODO: reassess whether this is scuffed or not
 				ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - TexRes's - " + path;
 
-				ResourceHandle handle_texture_alb = resource_manager->load_resource_from_disk<TextureResource>(path_without_extension + "alb" + file_extension);
-				ResourceHandle handle_texture_nrm = resource_manager->load_resource_from_disk<TextureResource>(path_without_extension + "nrm" + file_extension);
-				ResourceHandle handle_texture_mtl = resource_manager->load_resource_from_disk<TextureResource>(path_without_extension + "mtl" + file_extension);
-				ResourceHandle handle_texture_rgh = resource_manager->load_resource_from_disk<TextureResource>(path_without_extension + "rgh" + file_extension);
+				//The bounds are in model space, which is where the model ends up until it gets placed somewhere else. Colour stands out the most
+				//while it's missing, then the normals
+				const Bounds& bounds = material_bounds[materials_vector.size()];
+				const auto get_priority = [&bounds](const float priority) { return LoadPriority{ priority, bounds.center, glm::max(bounds.radius, 0.0f) }; };
+				ResourceHandle handle_texture_alb = resource_manager->load_resource_async<TextureResource>(path_without_extension + "alb" + file_extension, get_priority(2.0f));
+				ResourceHandle handle_texture_nrm = resource_manager->load_resource_async<TextureResource>(path_without_extension + "nrm" + file_extension, get_priority(1.0f));
+				ResourceHandle handle_texture_mtl = resource_manager->load_resource_async<TextureResource>(path_without_extension + "mtl" + file_extension, get_priority(0.0f));
+				ResourceHandle handle_texture_rgh = resource_manager->load_resource_async<TextureResource>(path_without_extension + "rgh" + file_extension, get_priority(0.0f));
+				resource_manager->add_dependency(material_hash, handle_texture_alb.hash);
+				resource_manager->add_dependency(material_hash, handle_texture_nrm.hash);
+				resource_manager->add_dependency(material_hash, handle_texture_mtl.hash);
+				resource_manager->add_dependency(material_hash, handle_texture_rgh.hash);
 
 				pbr_material.tex_col = handle_texture_alb;
 				pbr_material.tex_nrm = handle_texture_nrm;
@@ -152,30 +685,88 @@ bool ModelResource::load(std::string path, ResourceManager* resource_manager)
 		}
 	}
 
-	//Go through each node and add it to the primitive vector
-	std::unordered_map<int, MeshBufferData> primitives;
+	LoadTimer vertex_timer(model_hash, LoadPhase::vertex_processing);
+
+	//Primitives used by several nodes are only built once, and keep the node transforms as instances. Primitives used once get the
+	//transform baked into their vertices instead
+	std::vector<const tinygltf::Primitive*> unique_primitives;
+	std::vector<std::vector<glm::mat4>> primitive_transforms;
 	{
-		//Get nodes
-		auto& scene = model.scenes[model.defaultScene];
-		traverse_nodes(scene.nodes, model, glm::mat4(1.0f), primitives);
+		std::unordered_map<const tinygltf::Primitive*, size_t> primitive_slots;
+		for (const auto& instance : primitive_instances)
+		{
+			const auto [entry, inserted] = primitive_slots.emplace(instance.primitive, unique_primitives.size());
+			if (inserted)
+			{
+				unique_primitives.push_back(instance.primitive);
+				primitive_transforms.emplace_back();
+			}
+			primitive_transforms[entry->second].push_back(instance.transform);
+		}
+	}
+
+	//Build the vertex arrays, one primitive per job
+	std::vector<MeshBufferData> mesh_buffers(unique_primitives.size());
+	ResourceManager::get_job_system_instance()->parallel_for(static_cast<int>(unique_primitives.size()), [&](const int i)
+	{
+		std::vector<glm::mat4>& transforms = primitive_transforms[i];
+		const bool is_instanced = transforms.size() > 1;
+		mesh_buffers[i] = {};
+		create_vertex_array(mesh_buffers[i], *unique_primitives[i], model, is_instanced ? glm::mat4(1.0f) : transforms[0]);
+		if (!is_instanced)
+			transforms[0] = glm::mat4(1.0f);
+
+		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - instances";
+		mesh_buffers[i].instances = static_cast<glm::mat4*>(dynamic_allocate(static_cast<uint32_t>(sizeof(glm::mat4) * transforms.size())));
+		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+		mesh_buffers[i].n_instances = static_cast<int>(transforms.size());
+		memcpy(mesh_buffers[i].instances, transforms.data(), sizeof(glm::mat4) * transforms.size());
+	});
+
+	//Primitives with the same material and the same instances get batched into one mesh, so each material is a single draw
+	std::vector<std::vector<MeshBufferData*>> batches;
+	std::vector<size_t> batch_first_primitives;
+	for (size_t i = 0; i < unique_primitives.size(); i++)
+	{
+		size_t batch = 0;
+		while (batch < batches.size() &&
+			(unique_primitives[batch_first_primitives[batch]]->material != unique_primitives[i]->material ||
+			primitive_transforms[batch_first_primitives[batch]] != primitive_transforms[i]))
+		{
+			batch++;
+		}
+		if (batch == batches.size())
+		{
+			batches.emplace_back();
+			batch_first_primitives.push_back(i);
+		}
+		batches[batch].push_back(&mesh_buffers[i]);
 	}
 
 	//Populate resource
 	{
 		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Mesh - " + path;
-		meshes = (MeshBufferData*)dynamic_allocate(sizeof(MeshBufferData) * primitives.size());
+		meshes = (MeshBufferData*)dynamic_allocate(sizeof(MeshBufferData) * batches.size());
 		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "MdlRes - Material - " + path;
-		materials = (MaterialResource*)dynamic_allocate(sizeof(MaterialResource) * primitives.size());
-		n_meshes = 0;
-		n_materials = 0;
+		materials = (MaterialResource*)dynamic_allocate(sizeof(MaterialResource) * batches.size());
+		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+		n_meshes = static_cast<int>(batches.size());
+		n_materials = static_cast<int>(batches.size());
 
-		int i = 0;
-		for (auto& [material_id, mesh] : primitives)
+		for (size_t i = 0; i < batches.size(); i++)
 		{
-			meshes[n_meshes] = mesh;
-			materials[n_materials] = materials_vector[material_id];
-			n_meshes++;
-			n_materials++;
+			//Primitives without a material get the default one
+			const int material_id = unique_primitives[batch_first_primitives[i]]->material;
+			meshes[i] = merge_mesh_buffers(batches[i]);
+			materials[i] = material_id >= 0 && material_id < static_cast<int>(materials_vector.size()) ? materials_vector[material_id] : MaterialResource{};
+		}
+
+		//The model's bounds contain every instance of every mesh
+		bounds = Bounds{};
+		for (int i = 0; i < n_meshes; i++)
+		{
+			for (int instance = 0; instance < meshes[i].n_instances; instance++)
+				bounds = BoundingVolumes::merge_bounds(bounds, BoundingVolumes::transform_bounds(meshes[i].bounds, meshes[i].instances[instance]));
 		}
 	}
 
@@ -184,7 +775,7 @@ bool ModelResource::load(std::string path, ResourceManager* resource_manager)
 	return true;
 }
 
-void ModelResource::traverse_nodes(std::vector<int>& node_indices, tinygltf::Model& model, glm::mat4 local_transform, std::unordered_map<int, MeshBufferData>& primitives_processed)
+void ModelResource::traverse_nodes(const std::vector<int>& node_indices, const tinygltf::Model& model, const glm::mat4& local_transform, std::vector<GltfPrimitiveInstance>& primitives_found)
 {
 	//Loop over all nodes
 	for (auto& node_index : node_indices)
@@ -207,17 +798,14 @@ void ModelResource::traverse_nodes(std::vector<int>& node_indices, tinygltf::Mod
 			for (auto& primitive : primitives)
 			{
 				printf("Creating vertex array for mesh '%s'\n", node.name.c_str());
-				//primitive.material
-				MeshBufferData mesh_buffer_data{};
-				create_vertex_array(mesh_buffer_data, primitive, model, local_matrix);
-				primitives_processed[primitive.material] = mesh_buffer_data;
+				primitives_found.push_back({ &primitive, local_matrix });
 			}
 		}
 
 		//If it has children, process those
 		if (!node.children.empty())
 		{
-			traverse_nodes(node.children, model, local_matrix, primitives_processed);
+			traverse_nodes(node.children, model, local_matrix, primitives_found);
 		}
 	}
 }
@@ -229,104 +817,144 @@ void ModelResource::unload()
 	//dynamic_free(this);
 }
 
-void ModelResource::create_vertex_array(MeshBufferData& mesh_out, tinygltf::Primitive primitive_in, tinygltf::Model model, glm::mat4 trans_mat)
+void ModelResource::create_vertex_array(MeshBufferData& mesh_out, const tinygltf::Primitive& primitive_in, const tinygltf::Model& model, const glm::mat4& trans_mat)
 {
-	glm::vec3* position_pointer = nullptr;
-	glm::vec3* normal_pointer = nullptr;
-	glm::vec3* tangent_pointer = nullptr;
-	glm::vec3* colour_pointer = nullptr;
-	glm::vec2* texcoord_pointer = nullptr;
-	std::vector<int> indices;
-
-	for (auto& attrib : primitive_in.attributes)
+	//Find the attributes we use. The views read from the model's buffers in place, whatever their layout is
+	GltfAccessorView positions;
+	GltfAccessorView normals;
+	GltfAccessorView tangents;
+	GltfAccessorView colours;
+	GltfAccessorView texcoords;
+	for (const auto& [name, accessor_index] : primitive_in.attributes)
 	{
-		//Structure binding type beat but I'm too lazy to switch to C++17 lmao
-		auto& name = attrib.first;
-		auto& accessor_index = attrib.second;
-
-		//Get accessor
-		auto& accessor = model.accessors[accessor_index];
-
-		//Get bufferview
-		auto& bufferview_index = accessor.bufferView;
-		auto& bufferview = model.bufferViews[bufferview_index];
-
-		//Find location in buffer
-		auto& buffer_base = model.buffers[bufferview.buffer].data;
-		void* buffer_pointer = &buffer_base[bufferview.byteOffset];
-		assert(bufferview.byteStride == 0 && "byte_stride is not zero!");
+		if (name == "POSITION")
+			positions = GltfAccessorView(model, accessor_index);
+		else if (name == "NORMAL")
+			normals = GltfAccessorView(model, accessor_index);
+		else if (name == "TANGENT")
+			tangents = GltfAccessorView(model, accessor_index);
+		else if (name == "TEXCOORD_0")
+			texcoords = GltfAccessorView(model, accessor_index);
+		else if (name == "COLOR_0")
+			colours = GltfAccessorView(model, accessor_index);
+	}
+	const int n_vertices = positions.is_valid() ? positions.size() : 0;
 
-		if (name._Equal("POSITION"))
-		{
-			position_pointer = static_cast<glm::vec3*>(buffer_pointer);
-		}
-		else if (name._Equal("NORMAL"))
-		{
-			normal_pointer = static_cast<glm::vec3*>(buffer_pointer);
-		}
-		else if (name._Equal("TANGENT"))
+	//Read every attribute straight into the vertices. Attributes the primitive doesn't have keep their defaults
+	std::vector<Vertex> vertices(n_vertices);
+	const auto read_attribute = [&](const GltfAccessorView& view, float* first_value, const int n_components)
+	{
+		if (!view.is_valid() || n_vertices == 0)
+			return false;
+		if (view.size() != n_vertices)
 		{
-			tangent_pointer = static_cast<glm::vec3*>(buffer_pointer);
+			Logger::logf("[ERROR] Mesh attribute has %i values, but the mesh has %i vertices!\n", view.size(), n_vertices);
+			return false;
 		}
-		else if (name._Equal("TEXCOORD_0"))
+		view.read_floats(first_value, sizeof(Vertex), n_components);
+		return true;
+	};
+	read_attribute(positions, n_vertices > 0 ? &vertices[0].position.x : nullptr, 3);
+	const bool has_normals = read_attribute(normals, n_vertices > 0 ? &vertices[0].normal.x : nullptr, 3);
+	const bool has_tangents = read_attribute(tangents, n_vertices > 0 ? &vertices[0].tangent.x : nullptr, 3);
+	read_attribute(colours, n_vertices > 0 ? &vertices[0].colour.x : nullptr, 3);
+	read_attribute(texcoords, n_vertices > 0 ? &vertices[0].texcoord.x : nullptr, 2);
+
+	//Find indices. Primitives without them just use every vertex in order
+	std::vector<uint32_t> indices;
+	if (primitive_in.indices == -1)
+	{
+		indices.resize(n_vertices);
+		for (int i = 0; i < n_vertices; i++)
 		{
-			texcoord_pointer = static_cast<glm::vec2*>(buffer_pointer);
+			indices[i] = i;
 		}
-		else if (name._Equal("COLOR_0"))
+	}
+	else
+	{
+		const GltfAccessorView index_view(model, primitive_in.indices);
+		if (index_view.is_valid())
 		{
-			colour_pointer = static_cast<glm::vec3*>(buffer_pointer);
+			indices.resize(index_view.size());
+			index_view.read_indices(indices.data());
 		}
 	}
 
-	//Find indices
+	//Transform every vertex once. Big meshes are split into ranges that get transformed on worker threads
+	constexpr int transform_range_size = 16384;
+	const int n_ranges = (n_vertices + transform_range_size - 1) / transform_range_size;
+	ResourceManager::get_job_system_instance()->parallel_for(n_ranges, [&](const int range)
 	{
-		//Get accessor
-		auto& accessor = model.accessors[primitive_in.indices];
-
-		//Get bufferview
-		auto& bufferview_index = accessor.bufferView;
-		auto& bufferview = model.bufferViews[bufferview_index];
+		const int first_vertex = range * transform_range_size;
+		VertexTransform::transform_vertices(vertices.data() + first_vertex, glm::min(transform_range_size, n_vertices - first_vertex), trans_mat, has_normals, has_tangents);
+	});
+
+	//Some exporters split vertices that are actually identical, so weld those back together
+	const auto hash_vertex = [](const Vertex& vertex) { return static_cast<size_t>(AssetCache::hash_data(reinterpret_cast<const char*>(&vertex), sizeof(Vertex))); };
+	const auto compare_vertex = [](const Vertex& lhs, const Vertex& rhs) { return memcmp(&lhs, &rhs, sizeof(Vertex)) == 0; };
+	std::unordered_map<Vertex, uint32_t, decltype(hash_vertex), decltype(compare_vertex)> unique_vertices(vertices.size(), hash_vertex, compare_vertex);
+	std::vector<uint32_t> remap(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++)
+	{
+		const auto [entry, inserted] = unique_vertices.emplace(vertices[i], static_cast<uint32_t>(unique_vertices.size()));
+		remap[i] = entry->second;
+	}
 
-		//Find location in buffer
-		auto& buffer_base = model.buffers[bufferview.buffer].data;
-		void* buffer_pointer = &buffer_base[bufferview.byteOffset];
-		int buffer_length = accessor.count;
-		indices.reserve(buffer_length);
-		assert(bufferview.byteStride == 0 && "byte_stride is not zero!");
+	//Create vertex and index arrays
+	{
+		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - vertex buffers";
+		mesh_out.verts = static_cast<Vertex*>(dynamic_allocate(static_cast<uint32_t>(sizeof(Vertex) * unique_vertices.size())));
+		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - index buffers";
+		mesh_out.indices = static_cast<uint32_t*>(dynamic_allocate(static_cast<uint32_t>(sizeof(uint32_t) * indices.size())));
+		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+		mesh_out.n_verts = static_cast<int>(unique_vertices.size());
+		mesh_out.n_indices = static_cast<int>(indices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			mesh_out.verts[remap[i]] = vertices[i];
+		}
 
-		if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT)
+		bool out_of_range = false;
+		for (size_t i = 0; i < indices.size(); i++)
 		{
-			auto* indices_raw = static_cast<uint16_t*>(buffer_pointer);
-			for (int i = 0; i < buffer_length; i++)
+			if (indices[i] >= remap.size())
 			{
-				indices.push_back(indices_raw[i]);
+				out_of_range = true;
+				mesh_out.indices[i] = 0;
+				continue;
 			}
+			mesh_out.indices[i] = remap[indices[i]];
 		}
-		if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT)
+		if (out_of_range)
 		{
-			auto* indices_raw = static_cast<uint32_t*>(buffer_pointer);
-			for (int i = 0; i < buffer_length; i++)
-			{
-				indices.push_back(indices_raw[i]);
-			}
+			Logger::logf("[ERROR] Mesh has indices that are out of range!\n");
 		}
 	}
 
-	//Create vertex array
+	//Reorder triangles and vertices so the mesh is cheaper to draw
+	MeshOptimizer::optimize_mesh(mesh_out);
+
+	//Generate lower detail versions, these get appended to the index buffer
+	MeshSimplifier::generate_lods(mesh_out);
+
+	//Bounds, used for culling and to pick a LOD
+	mesh_out.bounds = BoundingVolumes::compute_bounds(mesh_out.verts, mesh_out.n_verts);
+
+	//Split each LOD into meshlets for culling. This has to come last, since meshlets are ranges of the final index buffer
+	std::vector<Meshlet> meshlets;
+	for (int lod = 0; lod < mesh_out.n_lods; lod++)
 	{
-		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - vertex buffers" ;
-		mesh_out.verts = static_cast<Vertex*>(dynamic_allocate(sizeof(Vertex) * indices.size()));
-		ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
-		mesh_out.n_verts = 0;
-		for (int index : indices)
-		{
-			Vertex vertex;
-			if (position_pointer != nullptr) { vertex.position = trans_mat * glm::vec4(position_pointer[index], 1.0f); }
-			if (normal_pointer   != nullptr) { vertex.normal   = glm::mat3(trans_mat) * normal_pointer[index]; }
-			if (tangent_pointer  != nullptr) { vertex.tangent  = glm::mat3(trans_mat) * tangent_pointer[index]; }
-			if (colour_pointer   != nullptr) { vertex.colour   = colour_pointer  [index]; }
-			if (texcoord_pointer != nullptr) { vertex.texcoord = texcoord_pointer[index]; }
-			mesh_out.verts[mesh_out.n_verts++] = vertex;
-		}
+		MeshLod& mesh_lod = mesh_out.lods[lod];
+		std::vector<Meshlet> lod_meshlets = Meshlets::build_meshlets(mesh_out.indices + mesh_lod.index_offset, static_cast<int>(mesh_lod.index_count), mesh_out.verts, mesh_out.n_verts);
+		for (auto& meshlet : lod_meshlets)
+			meshlet.index_offset += mesh_lod.index_offset;
+		mesh_lod.meshlet_offset = static_cast<uint32_t>(meshlets.size());
+		mesh_lod.meshlet_count = static_cast<uint32_t>(lod_meshlets.size());
+		meshlets.insert(meshlets.end(), lod_meshlets.begin(), lod_meshlets.end());
 	}
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "mesh loading - meshlets";
+	mesh_out.meshlets = static_cast<Meshlet*>(dynamic_allocate(static_cast<uint32_t>(sizeof(Meshlet) * glm::max(meshlets.size(), size_t(1)))));
+	ResourceManager::get_allocator_instance()->curr_memory_chunk_label = "unknown";
+	mesh_out.n_meshlets = static_cast<int>(meshlets.size());
+	memcpy(mesh_out.meshlets, meshlets.data(), sizeof(Meshlet) * meshlets.size());
 }
@@ -28,15 +28,32 @@ struct alignas(16) RawResource
 struct TextureResource
 {
 	static std::string name_string() { return "TextureResource"; }
+	static ResourceType type_enum() { return ResourceType::texture; }
 	ResourceType resource_type = ResourceType::texture;
 	bool scheduled_for_unload = false;
 	int width = 0;
 	int height = 0;
 	Pixel32* data = nullptr;
 	char* name = nullptr;
+	int n_mips = 1;
+	Pixel32* mip_chain = nullptr; //Mip levels 1 and up, stored back to back
+	uint64_t source_version = 0; //Hash or file stamp of the source data, used to cache the mip chain. 0 if the texture wasn't loaded from anything
+	BlockFormat block_format = BlockFormat::none;
+	uint8_t* compressed_data = nullptr; //Every mip level in block_format, stored back to back
 	bool load(std::string path, ResourceManager const* resource_manager, bool silent = false);
+	bool load_from_cache(const std::string& path, uint64_t stamp);
+	bool load_from_memory(const std::string& path, const char* file_data, int file_size, ResourceManager const* resource_manager, bool silent = false, uint64_t stamp = 0);
+	bool set_pixels(const std::string& path, uint8_t* u8_data, int channels, bool silent);
 	bool load(tinygltf::Image image, ResourceManager const* resource_manager);
+	bool load_packed(const std::string& path, TextureResource* const (&sources)[3], const int (&source_channels)[3], const uint8_t (&fallbacks)[3]);
 	void unload();
+	void generate_mips(bool is_srgb);
+	void compress(BlockFormat format, bool is_srgb);
+	uint32_t get_compressed_mip_size(int level) const;
+	uint8_t* get_compressed_mip_data(int level);
+	int get_mip_width(int level) const { return width >> level > 0 ? width >> level : 1; }
+	int get_mip_height(int level) const { return height >> level > 0 ? height >> level : 1; }
+	Pixel32* get_mip_data(int level);
 	TextureResource(int width_, int height_, Pixel32* data_, char* name_)
 	{
 		scheduled_for_unload = false;
@@ -45,6 +62,10 @@ struct TextureResource
 		height = height_;
 		data = data_;
 		name = name_;
+		n_mips = 1;
+		mip_chain = nullptr;
+		block_format = BlockFormat::none;
+		compressed_data = nullptr;
 	};
 	void schedule_unload()
 	{
@@ -60,25 +81,38 @@ struct MaterialResource
 	ResourceHandle tex_rgh{0, ResourceType::invalid};
 	ResourceHandle tex_mtl{0, ResourceType::invalid};
 	ResourceHandle tex_emm{0, ResourceType::invalid};
+	ResourceHandle tex_occ{0, ResourceType::invalid};
 	glm::vec4 mul_col{1.0f, 1.0f, 1.0f, 1.0f};
 	glm::vec3 mul_emm{1.0f, 1.0f, 1.0f};
 	glm::vec2 mul_tex{1.0f, 1.0f};
 	float mul_nrm = 1.0f;
 	float mul_rgh = 1.0f;
 	float mul_mtl = 1.0f;
+	int rgh_channel = 0;	//Channel of tex_rgh and tex_mtl that holds the value. glTF stores both in one texture, roughness in green and metallic in blue
+	int mtl_channel = 0;
+};
+
+//A primitive in the glTF scene, with the transform of the node it's in
+struct GltfPrimitiveInstance
+{
+	const tinygltf::Primitive* primitive;
+	glm::mat4 transform;
 };
 
 struct ModelResource
 {
 	static std::string name_string() { return "ModelResource"; }
+	static ResourceType type_enum() { return ResourceType::model; }
 	ResourceType resource_type;
 	bool scheduled_for_unload;
 	MeshBufferData* meshes;
 	MaterialResource* materials;
 	int n_meshes;
 	int n_materials;
+	Bounds bounds;
 	bool load(std::string path, ResourceManager* resource_manager);
+	bool load_from_memory(const std::string& path, const char* file_data, int file_size, ResourceManager* resource_manager);
 	void unload();
-	void traverse_nodes(std::vector<int>& node_indices, tinygltf::Model& model, glm::mat4 local_transform, std::unordered_map<int, MeshBufferData>& primitives_processed);
-	void create_vertex_array(MeshBufferData& mesh_out, tinygltf::Primitive primitive_in, tinygltf::Model model, glm::mat4 trans_mat);
+	void traverse_nodes(const std::vector<int>& node_indices, const tinygltf::Model& model, const glm::mat4& local_transform, std::vector<GltfPrimitiveInstance>& primitives_found);
+	void create_vertex_array(MeshBufferData& mesh_out, const tinygltf::Primitive& primitive_in, const tinygltf::Model& model, const glm::mat4& trans_mat);
 };
@@ -0,0 +1,484 @@
+#include "texture_compression.h"
+
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include <utility>
+#include <glm/common.hpp>
+
+#include "job_system.h"
+#include "resource_handler_structs.h"
+#include "resource_manager.h"
+
+//A block's pixels with each channel stored separately, so 4 pixels fit in one register
+struct BlockChannels
+{
+	alignas(16) float values[4][16];
+};
+
+static void load_block_channels(const Pixel32 (&block)[16], BlockChannels& channels)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		channels.values[0][i] = block[i].r;
+		channels.values[1][i] = block[i].g;
+		channels.values[2][i] = block[i].b;
+		channels.values[3][i] = block[i].a;
+	}
+}
+
+//Finds the line through the block's colours that fits them best, and returns the ends of it that contain every colour.
+//The direction is the largest eigenvector of the covariance matrix, found with a few rounds of power iteration
+static void find_principal_endpoints(const BlockChannels& channels, const int n_channels, float (&endpoint_0)[4], float (&endpoint_1)[4])
+{
+	float mean[4]{};
+	float min_value[4]{};
+	float max_value[4]{};
+	for (int c = 0; c < n_channels; c++)
+	{
+		min_value[c] = FLT_MAX;
+		max_value[c] = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			mean[c] += channels.values[c][i];
+			min_value[c] = glm::min(min_value[c], channels.values[c][i]);
+			max_value[c] = glm::max(max_value[c], channels.values[c][i]);
+		}
+		mean[c] /= 16.0f;
+	}
+
+	float covariance[4][4]{};
+	for (int i = 0; i < 16; i++)
+		for (int c0 = 0; c0 < n_channels; c0++)
+			for (int c1 = 0; c1 < n_channels; c1++)
+				covariance[c0][c1] += (channels.values[c0][i] - mean[c0]) * (channels.values[c1][i] - mean[c1]);
+
+	float axis[4]{};
+	for (int c = 0; c < n_channels; c++)
+		axis[c] = max_value[c] - min_value[c];
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float new_axis[4]{};
+		float largest = 0.0f;
+		for (int c0 = 0; c0 < n_channels; c0++)
+		{
+			for (int c1 = 0; c1 < n_channels; c1++)
+				new_axis[c0] += covariance[c0][c1] * axis[c1];
+			largest = glm::max(largest, std::abs(new_axis[c0]));
+		}
+		if (largest <= 0.0f)
+			break;
+		for (int c = 0; c < n_channels; c++)
+			axis[c] = new_axis[c] / largest;
+	}
+
+	float length_squared = 0.0f;
+	for (int c = 0; c < n_channels; c++)
+		length_squared += axis[c] * axis[c];
+
+	//Every pixel is the same colour, or close enough
+	if (length_squared <= 0.0f)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			endpoint_0[c] = mean[c];
+			endpoint_1[c] = mean[c];
+		}
+		return;
+	}
+
+	float min_t = FLT_MAX;
+	float max_t = -FLT_MAX;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0.0f;
+		for (int c = 0; c < n_channels; c++)
+			t += (channels.values[c][i] - mean[c]) * axis[c];
+		min_t = glm::min(min_t, t);
+		max_t = glm::max(max_t, t);
+	}
+	for (int c = 0; c < 4; c++)
+	{
+		endpoint_0[c] = glm::clamp(mean[c] + axis[c] * max_t / length_squared, 0.0f, 255.0f);
+		endpoint_1[c] = glm::clamp(mean[c] + axis[c] * min_t / length_squared, 0.0f, 255.0f);
+	}
+}
+
+//Picks the closest palette entry for every pixel, 4 pixels at a time, and returns the total squared error
+static float select_indices(const BlockChannels& channels, const int n_channels, const float (*palette)[4], const int n_entries, int (&indices)[16])
+{
+	float total_error = 0.0f;
+	for (int group = 0; group < 4; group++)
+	{
+		__m128 best_error = _mm_set1_ps(FLT_MAX);
+		__m128i best_index = _mm_setzero_si128();
+		for (int entry = 0; entry < n_entries; entry++)
+		{
+			__m128 error = _mm_setzero_ps();
+			for (int c = 0; c < n_channels; c++)
+			{
+				const __m128 difference = _mm_sub_ps(_mm_load_ps(&channels.values[c][group * 4]), _mm_set1_ps(palette[entry][c]));
+				error = _mm_add_ps(error, _mm_mul_ps(difference, difference));
+			}
+			const __m128i is_better = _mm_castps_si128(_mm_cmplt_ps(error, best_error));
+			best_error = _mm_min_ps(error, best_error);
+			best_index = _mm_or_si128(_mm_and_si128(is_better, _mm_set1_epi32(entry)), _mm_andnot_si128(is_better, best_index));
+		}
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(&indices[group * 4]), best_index);
+
+		alignas(16) float errors[4];
+		_mm_store_ps(errors, best_error);
+		total_error += (errors[0] + errors[1]) + (errors[2] + errors[3]);
+	}
+	return total_error;
+}
+
+//Solves for the two endpoints that best reproduce the pixels, given how far along the line between them each pixel is.
+//Returns false if every pixel has the same weight, since the endpoints can't be told apart then
+static bool refit_endpoints(const BlockChannels& channels, const int n_channels, const float (&weights)[16], float (&endpoint_0)[4], float (&endpoint_1)[4])
+{
+	float a = 0.0f, b = 0.0f, c = 0.0f;
+	float x[4]{};
+	float y[4]{};
+	for (int i = 0; i < 16; i++)
+	{
+		const float w1 = weights[i];
+		const float w0 = 1.0f - w1;
+		a += w0 * w0;
+		b += w0 * w1;
+		c += w1 * w1;
+		for (int channel = 0; channel < n_channels; channel++)
+		{
+			x[channel] += w0 * channels.values[channel][i];
+			y[channel] += w1 * channels.values[channel][i];
+		}
+	}
+
+	const float determinant = a * c - b * b;
+	if (std::abs(determinant) < 1e-6f)
+		return false;
+	for (int channel = 0; channel < n_channels; channel++)
+	{
+		endpoint_0[channel] = glm::clamp((c * x[channel] - b * y[channel]) / determinant, 0.0f, 255.0f);
+		endpoint_1[channel] = glm::clamp((a * y[channel] - b * x[channel]) / determinant, 0.0f, 255.0f);
+	}
+	return true;
+}
+
+//Writes fields to a 128-bit block, starting at the lowest bit
+struct BlockBitWriter
+{
+	uint8_t* output;
+	int bit = 0;
+
+	void write(uint32_t value, const int n_bits)
+	{
+		for (int i = 0; i < n_bits; i++, bit++, value >>= 1)
+			output[bit / 8] |= static_cast<uint8_t>((value & 1) << (bit % 8));
+	}
+};
+
+static uint16_t quantize_565(const float (&colour)[4])
+{
+	const int r = glm::clamp(static_cast<int>(colour[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+	const int g = glm::clamp(static_cast<int>(colour[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+	const int b = glm::clamp(static_cast<int>(colour[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+	return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+}
+
+static void expand_565(const uint16_t colour, float (&expanded)[4])
+{
+	const int r = (colour >> 11) & 31;
+	const int g = (colour >> 5) & 63;
+	const int b = colour & 31;
+	expanded[0] = static_cast<float>((r << 3) | (r >> 2));
+	expanded[1] = static_cast<float>((g << 2) | (g >> 4));
+	expanded[2] = static_cast<float>((b << 3) | (b >> 2));
+	expanded[3] = 255.0f;
+}
+
+//Quantizes the endpoints and picks indices for them, always in the 4 colour mode. Returns the error
+static float build_bc1_block(const BlockChannels& channels, const float (&endpoint_0)[4], const float (&endpoint_1)[4], uint16_t& colour_0, uint16_t& colour_1, int (&indices)[16])
+{
+	colour_0 = quantize_565(endpoint_0);
+	colour_1 = quantize_565(endpoint_1);
+	if (colour_0 < colour_1)
+		std::swap(colour_0, colour_1);
+
+	float palette[4][4];
+	expand_565(colour_0, palette[0]);
+	expand_565(colour_1, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		const int value_0 = static_cast<int>(palette[0][c]);
+		const int value_1 = static_cast<int>(palette[1][c]);
+		palette[2][c] = static_cast<float>((2 * value_0 + value_1) / 3);
+		palette[3][c] = static_cast<float>((value_0 + 2 * value_1) / 3);
+	}
+	return select_indices(channels, 3, palette, colour_0 == colour_1 ? 1 : 4, indices);
+}
+
+void TextureCompression::encode_bc1(const Pixel32 (&block)[16], uint8_t* output)
+{
+	BlockChannels channels;
+	load_block_channels(block, channels);
+
+	float endpoint_0[4], endpoint_1[4];
+	find_principal_endpoints(channels, 3, endpoint_0, endpoint_1);
+	uint16_t colour_0, colour_1;
+	int indices[16];
+	float error = build_bc1_block(channels, endpoint_0, endpoint_1, colour_0, colour_1, indices);
+
+	//Palette entries 0 to 3 sit at 0, 1, 1/3 and 2/3 of the way from colour 0 to colour 1
+	static constexpr float index_weights[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = index_weights[indices[i]];
+	if (refit_endpoints(channels, 3, weights, endpoint_0, endpoint_1))
+	{
+		uint16_t refit_colour_0, refit_colour_1;
+		int refit_indices[16];
+		const float refit_error = build_bc1_block(channels, endpoint_0, endpoint_1, refit_colour_0, refit_colour_1, refit_indices);
+		if (refit_error < error)
+		{
+			colour_0 = refit_colour_0;
+			colour_1 = refit_colour_1;
+			memcpy(indices, refit_indices, sizeof(indices));
+		}
+	}
+
+	uint32_t index_bits = 0;
+	for (int i = 0; i < 16; i++)
+		index_bits |= static_cast<uint32_t>(indices[i]) << (i * 2);
+	memcpy(output + 0, &colour_0, sizeof(colour_0));
+	memcpy(output + 2, &colour_1, sizeof(colour_1));
+	memcpy(output + 4, &index_bits, sizeof(index_bits));
+}
+
+//Uses the 8 value mode with the block's minimum and maximum as endpoints. All 16 values are compared against each palette entry at once
+void TextureCompression::encode_bc4(const uint8_t (&values)[16], uint8_t* output)
+{
+	uint8_t min_value = 255;
+	uint8_t max_value = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		min_value = glm::min(min_value, values[i]);
+		max_value = glm::max(max_value, values[i]);
+	}
+
+	memset(output, 0, 8);
+	output[0] = max_value;
+	output[1] = min_value;
+	if (min_value == max_value)
+		return;
+
+	uint8_t palette[8];
+	palette[0] = max_value;
+	palette[1] = min_value;
+	for (int i = 2; i < 8; i++)
+		palette[i] = static_cast<uint8_t>(((8 - i) * max_value + (i - 1) * min_value + 3) / 7);
+
+	const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values));
+	__m128i best_error = _mm_set1_epi8(-1);
+	__m128i best_index = _mm_setzero_si128();
+	for (int entry = 0; entry < 8; entry++)
+	{
+		const __m128i value = _mm_set1_epi8(static_cast<char>(palette[entry]));
+		const __m128i error = _mm_sub_epi8(_mm_max_epu8(pixels, value), _mm_min_epu8(pixels, value));
+		const __m128i is_better = _mm_andnot_si128(_mm_cmpeq_epi8(error, best_error), _mm_cmpeq_epi8(_mm_min_epu8(error, best_error), error));
+		best_error = _mm_min_epu8(error, best_error);
+		best_index = _mm_or_si128(_mm_and_si128(is_better, _mm_set1_epi8(static_cast<char>(entry))), _mm_andnot_si128(is_better, best_index));
+	}
+
+	alignas(16) uint8_t indices[16];
+	_mm_store_si128(reinterpret_cast<__m128i*>(indices), best_index);
+	uint64_t index_bits = 0;
+	for (int i = 0; i < 16; i++)
+		index_bits |= static_cast<uint64_t>(indices[i]) << (i * 3);
+	memcpy(output + 2, &index_bits, 6);
+}
+
+static constexpr int bc7_weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+//Picks the p-bit and 7-bit values that get closest to the endpoint, then returns the endpoint as the decoder will see it
+static void quantize_bc7_endpoint(const float (&endpoint)[4], int (&quantized)[4], int& p_bit, float (&expanded)[4])
+{
+	float best_error = FLT_MAX;
+	for (int p = 0; p < 2; p++)
+	{
+		int candidate[4];
+		float error = 0.0f;
+		for (int c = 0; c < 4; c++)
+		{
+			candidate[c] = glm::clamp(static_cast<int>((endpoint[c] - static_cast<float>(p)) * 0.5f + 0.5f), 0, 127);
+			const float difference = static_cast<float>((candidate[c] << 1) | p) - endpoint[c];
+			error += difference * difference;
+		}
+		if (error < best_error)
+		{
+			best_error = error;
+			p_bit = p;
+			memcpy(quantized, candidate, sizeof(candidate));
+		}
+	}
+	for (int c = 0; c < 4; c++)
+		expanded[c] = static_cast<float>((quantized[c] << 1) | p_bit);
+}
+
+struct Bc7Mode6Block
+{
+	int endpoints[2][4];
+	int p_bits[2];
+	int indices[16];
+};
+
+static float build_bc7_block(const BlockChannels& channels, const float (&endpoint_0)[4], const float (&endpoint_1)[4], Bc7Mode6Block& block)
+{
+	float expanded[2][4];
+	quantize_bc7_endpoint(endpoint_0, block.endpoints[0], block.p_bits[0], expanded[0]);
+	quantize_bc7_endpoint(endpoint_1, block.endpoints[1], block.p_bits[1], expanded[1]);
+
+	float palette[16][4];
+	for (int entry = 0; entry < 16; entry++)
+	{
+		for (int c = 0; c < 4; c++)
+		{
+			const int value_0 = static_cast<int>(expanded[0][c]);
+			const int value_1 = static_cast<int>(expanded[1][c]);
+			palette[entry][c] = static_cast<float>(((64 - bc7_weights[entry]) * value_0 + bc7_weights[entry] * value_1 + 32) >> 6);
+		}
+	}
+	return select_indices(channels, 4, palette, 16, block.indices);
+}
+
+void TextureCompression::encode_bc7(const Pixel32 (&block)[16], uint8_t* output)
+{
+	BlockChannels channels;
+	load_block_channels(block, channels);
+
+	float endpoint_0[4], endpoint_1[4];
+	find_principal_endpoints(channels, 4, endpoint_0, endpoint_1);
+	Bc7Mode6Block mode_6;
+	const float error = build_bc7_block(channels, endpoint_0, endpoint_1, mode_6);
+
+	float weights[16];
+	for (int i = 0; i < 16; i++)
+		weights[i] = static_cast<float>(bc7_weights[mode_6.indices[i]]) / 64.0f;
+	if (refit_endpoints(channels, 4, weights, endpoint_0, endpoint_1))
+	{
+		Bc7Mode6Block refit_mode_6;
+		if (build_bc7_block(channels, endpoint_0, endpoint_1, refit_mode_6) < error)
+			mode_6 = refit_mode_6;
+	}
+
+	//The first index is stored with one bit less, so its top bit has to be 0. Swapping the endpoints mirrors the indices to make sure of that
+	if (mode_6.indices[0] >= 8)
+	{
+		std::swap(mode_6.endpoints[0], mode_6.endpoints[1]);
+		std::swap(mode_6.p_bits[0], mode_6.p_bits[1]);
+		for (int i = 0; i < 16; i++)
+			mode_6.indices[i] = 15 - mode_6.indices[i];
+	}
+
+	memset(output, 0, 16);
+	BlockBitWriter writer{ output };
+	writer.write(1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		writer.write(mode_6.endpoints[0][c], 7);
+		writer.write(mode_6.endpoints[1][c], 7);
+	}
+	writer.write(mode_6.p_bits[0], 1);
+	writer.write(mode_6.p_bits[1], 1);
+	writer.write(mode_6.indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		writer.write(mode_6.indices[i], 4);
+}
+
+int TextureCompression::get_block_size(const BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::bc1:
+	case BlockFormat::bc4:
+		return 8;
+	case BlockFormat::bc3:
+	case BlockFormat::bc5:
+	case BlockFormat::bc7:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+//Also gives the size of uncompressed RGBA8 data for BlockFormat::none, so callers don't need to treat that separately
+uint32_t TextureCompression::get_compressed_size(const BlockFormat format, const int width, const int height)
+{
+	if (format == BlockFormat::none)
+		return static_cast<uint32_t>(width) * height * sizeof(Pixel32);
+	return static_cast<uint32_t>((width + 3) / 4) * ((height + 3) / 4) * get_block_size(format);
+}
+
+void TextureCompression::compress_block(const Pixel32 (&block)[16], const BlockFormat format, uint8_t* output)
+{
+	uint8_t values[16];
+	switch (format)
+	{
+	case BlockFormat::bc1:
+		encode_bc1(block, output);
+		break;
+	case BlockFormat::bc3:
+		for (int i = 0; i < 16; i++)
+			values[i] = block[i].a;
+		encode_bc4(values, output);
+		encode_bc1(block, output + 8);
+		break;
+	case BlockFormat::bc4:
+		for (int i = 0; i < 16; i++)
+			values[i] = block[i].r;
+		encode_bc4(values, output);
+		break;
+	case BlockFormat::bc5:
+		for (int i = 0; i < 16; i++)
+			values[i] = block[i].r;
+		encode_bc4(values, output);
+		for (int i = 0; i < 16; i++)
+			values[i] = block[i].g;
+		encode_bc4(values, output + 8);
+		break;
+	case BlockFormat::bc7:
+		encode_bc7(block, output);
+		break;
+	default:
+		break;
+	}
+}
+
+//Output has to hold get_compressed_size bytes. Blocks that go past the edge of the image repeat the last row and column
+void TextureCompression::compress_image(const Pixel32* pixels, const int width, const int height, const BlockFormat format, uint8_t* output)
+{
+	const int n_blocks_x = (width + 3) / 4;
+	const int n_blocks_y = (height + 3) / 4;
+	const int block_size = get_block_size(format);
+	if (block_size == 0)
+		return;
+
+	ResourceManager::get_job_system_instance()->parallel_for(n_blocks_y, [&](const int block_y)
+	{
+		for (int block_x = 0; block_x < n_blocks_x; block_x++)
+		{
+			Pixel32 block[16];
+			for (int y = 0; y < 4; y++)
+			{
+				const int source_y = glm::min(block_y * 4 + y, height - 1);
+				for (int x = 0; x < 4; x++)
+				{
+					const int source_x = glm::min(block_x * 4 + x, width - 1);
+					block[y * 4 + x] = pixels[source_y * width + source_x];
+				}
+			}
+			compress_block(block, format, output + (static_cast<size_t>(block_y) * n_blocks_x + block_x) * block_size);
+		}
+	});
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstdint>
+
+struct Pixel32;
+enum class BlockFormat;
+
+//Encodes RGBA8 images to the BC formats GPUs can sample from directly. Blocks don't depend on each other, so rows of blocks are spread
+//across the job system. Endpoints start out along the principal axis of a block's colours, then get refit to the chosen indices with least squares.
+//BC7 only uses mode 6 (one subset, 7-bit RGBA endpoints with a p-bit, 16 weights), which handles colour and alpha together
+class TextureCompression
+{
+public:
+	static int get_block_size(BlockFormat format);
+	static uint32_t get_compressed_size(BlockFormat format, int width, int height);
+	static void compress_image(const Pixel32* pixels, int width, int height, BlockFormat format, uint8_t* output);
+	static void compress_block(const Pixel32 (&block)[16], BlockFormat format, uint8_t* output);
+
+private:
+	static void encode_bc1(const Pixel32 (&block)[16], uint8_t* output);
+	static void encode_bc4(const uint8_t (&values)[16], uint8_t* output);
+	static void encode_bc7(const Pixel32 (&block)[16], uint8_t* output);
+};
@@ -0,0 +1,184 @@
+#include "texture_packer.h"
+
+#include <algorithm>
+#include <map>
+#include <tuple>
+
+#include "resource_handler_structs.h"
+
+static int round_up(const int value, const int multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+int TexturePacker::add_texture(const int width, const int height, const int n_mips, const BlockFormat block_format, const bool is_srgb, const bool can_be_in_atlas)
+{
+	entries.push_back({ width, height, n_mips, block_format, is_srgb, can_be_in_atlas });
+	return static_cast<int>(entries.size()) - 1;
+}
+
+void TexturePacker::clear()
+{
+	entries.clear();
+	placements.clear();
+	pages.clear();
+}
+
+void TexturePacker::pack()
+{
+	placements.assign(entries.size(), TexturePlacement{});
+	pages.clear();
+
+	//Small textures go into atlases if they start on a whole block and don't repeat, the rest are candidates for arrays
+	const int padding = round_up(atlas_padding, atlas_alignment);
+	std::vector<int> atlas_ids;
+	std::vector<int> array_ids;
+	for (int i = 0; i < static_cast<int>(entries.size()); i++)
+	{
+		const Entry& entry = entries[i];
+		const bool is_small = entry.width <= atlas_max_texture_size && entry.height <= atlas_max_texture_size && entry.width + padding * 2 <= atlas_size && entry.height + padding * 2 <= atlas_size;
+		if (is_small && entry.can_be_in_atlas && is_level_aligned(entry, 0))
+			atlas_ids.push_back(i);
+		else
+			array_ids.push_back(i);
+	}
+	pack_atlases(atlas_ids);
+	pack_arrays(array_ids);
+}
+
+void TexturePacker::pack_arrays(const std::vector<int>& texture_ids)
+{
+	//Layers of an array have to match in everything but their contents
+	std::map<std::tuple<int, int, int, int, bool>, std::vector<int>> groups;
+	for (const int id : texture_ids)
+	{
+		const Entry& entry = entries[id];
+		groups[{ entry.width, entry.height, entry.n_mips, static_cast<int>(entry.block_format), entry.is_srgb }].push_back(id);
+	}
+
+	for (const auto& [key, ids] : groups)
+	{
+		if (static_cast<int>(ids.size()) < min_array_layers)
+			continue;
+
+		const Entry& first = entries[ids[0]];
+		for (size_t start = 0; start < ids.size(); start += max_array_layers)
+		{
+			const int n_layers = static_cast<int>(std::min(ids.size() - start, static_cast<size_t>(max_array_layers)));
+			if (n_layers < min_array_layers)
+				break;
+			const int page = static_cast<int>(pages.size());
+			pages.push_back({ TexturePageType::array, first.width, first.height, n_layers, first.n_mips, first.block_format, first.is_srgb });
+			for (int layer = 0; layer < n_layers; layer++)
+			{
+				TexturePlacement& placement = placements[ids[start + layer]];
+				placement.page = page;
+				placement.layer = layer;
+			}
+		}
+	}
+}
+
+void TexturePacker::pack_atlases(const std::vector<int>& texture_ids)
+{
+	//Only textures with the same format can share a page, the size doesn't matter
+	const int padding = round_up(atlas_padding, atlas_alignment);
+	std::map<std::pair<int, bool>, std::vector<int>> groups;
+	for (const int id : texture_ids)
+	{
+		groups[{ static_cast<int>(entries[id].block_format), entries[id].is_srgb }].push_back(id);
+	}
+
+	for (auto& [key, ids] : groups)
+	{
+		//Shelf packing: tallest first, filling rows left to right, and starting a new page once a row doesn't fit anymore
+		std::sort(ids.begin(), ids.end(), [this](const int a, const int b)
+		{
+			if (entries[a].height != entries[b].height)
+				return entries[a].height > entries[b].height;
+			if (entries[a].width != entries[b].width)
+				return entries[a].width > entries[b].width;
+			return a < b;
+		});
+
+		std::vector<int> page_ids;
+		int shelf_x = 0;
+		int shelf_y = 0;
+		int shelf_height = 0;
+		int used_width = 0;
+		int used_height = 0;
+		for (const int id : ids)
+		{
+			const int width = round_up(entries[id].width, atlas_alignment) + padding * 2;
+			const int height = round_up(entries[id].height, atlas_alignment) + padding * 2;
+			if (shelf_x + width > atlas_size)
+			{
+				shelf_y += shelf_height;
+				shelf_x = 0;
+				shelf_height = 0;
+			}
+			if (shelf_y + height > atlas_size)
+			{
+				add_atlas_page(page_ids, used_width, used_height);
+				page_ids.clear();
+				shelf_y = 0;
+				used_width = 0;
+				used_height = 0;
+			}
+
+			placements[id].x = shelf_x + padding;
+			placements[id].y = shelf_y + padding;
+			placements[id].padding = padding;
+			page_ids.push_back(id);
+			shelf_x += width;
+			shelf_height = std::max(shelf_height, height);
+			used_width = std::max(used_width, shelf_x);
+			used_height = std::max(used_height, shelf_y + height);
+		}
+		add_atlas_page(page_ids, used_width, used_height);
+	}
+}
+
+void TexturePacker::add_atlas_page(const std::vector<int>& texture_ids, const int width, const int height)
+{
+	//A page with only one texture on it wouldn't save any binds
+	if (texture_ids.size() < 2)
+		return;
+
+	//Stop at the first level where an entry doesn't start on a whole block anymore, or runs out of mips of its own
+	int n_mips = 1;
+	for (;; n_mips++)
+	{
+		const bool is_level_usable = std::all_of(texture_ids.begin(), texture_ids.end(), [this, n_mips](const int id)
+		{
+			return entries[id].n_mips > n_mips && is_level_aligned(entries[id], n_mips);
+		});
+		const int block_size = entries[texture_ids[0]].block_format == BlockFormat::none ? 1 : 4;
+		if (!is_level_usable || atlas_alignment % (block_size << n_mips) != 0)
+			break;
+	}
+
+	const Entry& first = entries[texture_ids[0]];
+	const int page = static_cast<int>(pages.size());
+	pages.push_back({ TexturePageType::atlas, width, height, 1, n_mips, first.block_format, first.is_srgb });
+	for (const int id : texture_ids)
+	{
+		TexturePlacement& placement = placements[id];
+		placement.page = page;
+		placement.layer = 0;
+		placement.uv_rect = {
+			static_cast<float>(placement.x) / static_cast<float>(width),
+			static_cast<float>(placement.y) / static_cast<float>(height),
+			static_cast<float>(entries[id].width) / static_cast<float>(width),
+			static_cast<float>(entries[id].height) / static_cast<float>(height),
+		};
+	}
+}
+
+bool TexturePacker::is_level_aligned(const Entry& entry, const int level) const
+{
+	//Level n of an entry has to be exactly its level 0 size shifted down, in whole blocks, or it wouldn't line up with the page's own level n
+	const int block_size = entry.block_format == BlockFormat::none ? 1 : 4;
+	const int unit = block_size << level;
+	return entry.width % unit == 0 && entry.height % unit == 0;
+}
@@ -0,0 +1,76 @@
+#pragma once
+#include <vector>
+#include <glm/vec4.hpp>
+
+enum class BlockFormat;
+
+enum class TexturePageType
+{
+	array,
+	atlas,
+};
+
+//One GPU texture that several textures get packed into
+struct TexturePage
+{
+	TexturePageType type;
+	int width;
+	int height;
+	int n_layers;	//1 for atlases
+	int n_mips;
+	BlockFormat block_format;
+	bool is_srgb;
+};
+
+//Where a texture ended up. Textures that didn't fit anywhere have page -1 and stay separate textures
+struct TexturePlacement
+{
+	int page = -1;
+	int layer = 0;
+	int x = 0;	//Texel offset in an atlas page, 0 for arrays
+	int y = 0;
+	int padding = 0;	//Texels around an atlas entry that repeat its edges, so filtering near the edge doesn't pick up the neighbours
+	glm::vec4 uv_rect{ 0.0f, 0.0f, 1.0f, 1.0f };	//UV offset in xy and scale in zw, which maps a texture's own UVs into its page
+};
+
+//Groups textures so fewer of them need to be bound. Textures with the same size, format and mip count become layers of one 2D texture array,
+//and small textures get shelf packed into atlas pages. Atlas entries start on multiples of atlas_alignment texels, so a page only gets the mips
+//where every entry still starts on a whole block, and are surrounded by atlas_padding texels for the caller to fill with their edges.
+//Textures that have to repeat can't be atlas entries, since wrapping around would leave the entry. Everything that doesn't fit either way is left alone
+class TexturePacker
+{
+public:
+	int add_texture(int width, int height, int n_mips, BlockFormat block_format, bool is_srgb, bool can_be_in_atlas = true);
+	void pack();
+	void clear();
+
+	const std::vector<TexturePage>& get_pages() const { return pages; }
+	const TexturePlacement& get_placement(int texture_id) const { return placements[texture_id]; }
+
+	inline static int atlas_size = 2048;
+	inline static int atlas_max_texture_size = 256;	//Textures up to this size on both axes go into atlases instead of arrays
+	inline static int atlas_alignment = 16;
+	inline static int atlas_padding = 16;		//Rounded up to atlas_alignment
+	inline static int min_array_layers = 2;		//Fewer matching textures than this aren't worth an array
+	inline static int max_array_layers = 256;	//Well under the 2048 layers GL 4.5 guarantees, so one page never gets huge
+
+private:
+	struct Entry
+	{
+		int width;
+		int height;
+		int n_mips;
+		BlockFormat block_format;
+		bool is_srgb;
+		bool can_be_in_atlas;
+	};
+
+	void pack_arrays(const std::vector<int>& texture_ids);
+	void pack_atlases(const std::vector<int>& texture_ids);
+	void add_atlas_page(const std::vector<int>& texture_ids, int width, int height);
+	bool is_level_aligned(const Entry& entry, int level) const;
+
+	std::vector<Entry> entries;
+	std::vector<TexturePlacement> placements;
+	std::vector<TexturePage> pages;
+};
@@ -9,6 +9,11 @@ glm::mat4 TransformComponent::get_view_matrix()
 		get_up_vector()));
 }
 
+glm::mat4 TransformComponent::get_model_matrix() const
+{
+	return glm::translate(glm::mat4(1.0f), position) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+}
+
 void TransformComponent::set_position(const glm::vec3 new_position)
 {
 	position = new_position;
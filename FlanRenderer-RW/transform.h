@@ -12,6 +12,7 @@ public:
 	glm::quat get_rotation() const { return rotation; }
 	glm::vec3 get_scale() const { return scale; }
 	glm::mat4 get_view_matrix();
+	glm::mat4 get_model_matrix() const;
 	
 	void set_position(glm::vec3 new_position);
 	void add_position(glm::vec3 new_position);
@@ -0,0 +1,265 @@
+#include "vertex_transform.h"
+
+#include <cstddef>
+#include <cstring>
+#include <immintrin.h>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "logger.h"
+#include "renderer_structs.h"
+
+//MSVC lets any function use AVX intrinsics, GCC and Clang need to be told which functions may
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#else
+#define AVX2_FUNCTION
+#endif
+
+//The SIMD paths load the first 12 floats of each vertex as 3 groups of 4, so these have to stay together at the start of Vertex
+static_assert(offsetof(Vertex, position) == 0 && offsetof(Vertex, normal) == 12 && offsetof(Vertex, tangent) == 24 && offsetof(Vertex, colour) == 36, "Vertex layout changed");
+
+//Loads 4 vertices and transposes them to one register per component: position xyz, normal xyz, tangent xyz and colour rgb.
+//The colour is only carried along, so storing the batch writes it back unchanged
+static inline void load_batch_sse(const Vertex* batch, __m128 (&components)[12])
+{
+	for (int group = 0; group < 3; group++)
+	{
+		__m128 row0 = _mm_loadu_ps(reinterpret_cast<const float*>(batch + 0) + group * 4);
+		__m128 row1 = _mm_loadu_ps(reinterpret_cast<const float*>(batch + 1) + group * 4);
+		__m128 row2 = _mm_loadu_ps(reinterpret_cast<const float*>(batch + 2) + group * 4);
+		__m128 row3 = _mm_loadu_ps(reinterpret_cast<const float*>(batch + 3) + group * 4);
+		_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+		components[group * 4 + 0] = row0;
+		components[group * 4 + 1] = row1;
+		components[group * 4 + 2] = row2;
+		components[group * 4 + 3] = row3;
+	}
+}
+
+static inline void store_batch_sse(Vertex* batch, const __m128 (&components)[12])
+{
+	for (int group = 0; group < 3; group++)
+	{
+		__m128 row0 = components[group * 4 + 0];
+		__m128 row1 = components[group * 4 + 1];
+		__m128 row2 = components[group * 4 + 2];
+		__m128 row3 = components[group * 4 + 3];
+		_MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+		_mm_storeu_ps(reinterpret_cast<float*>(batch + 0) + group * 4, row0);
+		_mm_storeu_ps(reinterpret_cast<float*>(batch + 1) + group * 4, row1);
+		_mm_storeu_ps(reinterpret_cast<float*>(batch + 2) + group * 4, row2);
+		_mm_storeu_ps(reinterpret_cast<float*>(batch + 3) + group * 4, row3);
+	}
+}
+
+//Transforms the xyz registers starting at first. The order of operations matches glm's matrix-vector multiply:
+//(m0 * x + m1 * y) + (m2 * z + m3) for positions, and (m0 * x + m1 * y) + m2 * z for directions
+static inline void transform_components_sse(__m128* first, const __m128 (&columns)[4][3], const bool is_position)
+{
+	const __m128 x = first[0];
+	const __m128 y = first[1];
+	const __m128 z = first[2];
+	for (int row = 0; row < 3; row++)
+	{
+		const __m128 xy = _mm_add_ps(_mm_mul_ps(columns[0][row], x), _mm_mul_ps(columns[1][row], y));
+		first[row] = is_position ? _mm_add_ps(xy, _mm_add_ps(_mm_mul_ps(columns[2][row], z), columns[3][row])) : _mm_add_ps(xy, _mm_mul_ps(columns[2][row], z));
+	}
+}
+
+//Same as transform_components_sse, for 8 vertices. No FMA, since fusing the multiply and add would round differently from the scalar path
+AVX2_FUNCTION static inline void transform_components_avx2(__m256* first, const __m256 (&columns)[4][3], const bool is_position)
+{
+	const __m256 x = first[0];
+	const __m256 y = first[1];
+	const __m256 z = first[2];
+	for (int row = 0; row < 3; row++)
+	{
+		const __m256 xy = _mm256_add_ps(_mm256_mul_ps(columns[0][row], x), _mm256_mul_ps(columns[1][row], y));
+		first[row] = is_position ? _mm256_add_ps(xy, _mm256_add_ps(_mm256_mul_ps(columns[2][row], z), columns[3][row])) : _mm256_add_ps(xy, _mm256_mul_ps(columns[2][row], z));
+	}
+}
+
+//Transforms positions as points, and normals and tangents (if asked) as directions, by the upper 3x3 of the matrix
+void VertexTransform::transform_vertices(Vertex* vertices, const int n_vertices, const glm::mat4& matrix, const bool transform_normals, const bool transform_tangents)
+{
+#ifdef _DEBUG
+	//Debug builds check once that the SIMD paths still match the scalar one, and stop using them if they don't
+	static const bool is_simd_verified = verify_simd_paths();
+	(void)is_simd_verified;
+#endif
+
+	int n_done = 0;
+	if (use_simd)
+	{
+		static const bool has_avx2 = is_avx2_supported();
+		if (has_avx2)
+			n_done = transform_vertices_avx2(vertices, n_vertices, matrix, transform_normals, transform_tangents);
+		else
+			n_done = transform_vertices_sse(vertices, n_vertices, matrix, transform_normals, transform_tangents);
+	}
+
+	//Whatever doesn't fill a whole batch
+	transform_vertices_scalar(vertices + n_done, n_vertices - n_done, matrix, transform_normals, transform_tangents);
+}
+
+//Reference path, also used for the vertices left over after the SIMD batches
+void VertexTransform::transform_vertices_scalar(Vertex* vertices, const int n_vertices, const glm::mat4& matrix, const bool transform_normals, const bool transform_tangents)
+{
+	const glm::mat3 direction_matrix = glm::mat3(matrix);
+	for (int i = 0; i < n_vertices; i++)
+	{
+		vertices[i].position = matrix * glm::vec4(vertices[i].position, 1.0f);
+		if (transform_normals)  { vertices[i].normal  = direction_matrix * vertices[i].normal; }
+		if (transform_tangents) { vertices[i].tangent = direction_matrix * vertices[i].tangent; }
+	}
+}
+
+//Returns how many vertices were transformed, always a multiple of 4
+int VertexTransform::transform_vertices_sse(Vertex* vertices, const int n_vertices, const glm::mat4& matrix, const bool transform_normals, const bool transform_tangents)
+{
+	__m128 columns[4][3];
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 3; row++)
+			columns[column][row] = _mm_set1_ps(matrix[column][row]);
+
+	const int n_batched = n_vertices & ~3;
+	for (int i = 0; i < n_batched; i += 4)
+	{
+		__m128 components[12];
+		load_batch_sse(vertices + i, components);
+		transform_components_sse(&components[0], columns, true);
+		if (transform_normals)
+			transform_components_sse(&components[3], columns, false);
+		if (transform_tangents)
+			transform_components_sse(&components[6], columns, false);
+		store_batch_sse(vertices + i, components);
+	}
+	return n_batched;
+}
+
+//Returns how many vertices were transformed, always a multiple of 8
+AVX2_FUNCTION int VertexTransform::transform_vertices_avx2(Vertex* vertices, const int n_vertices, const glm::mat4& matrix, const bool transform_normals, const bool transform_tangents)
+{
+	__m256 columns[4][3];
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 3; row++)
+			columns[column][row] = _mm256_set1_ps(matrix[column][row]);
+
+	//Transposing is done 4 vertices at a time, then the two halves are combined
+	const int n_batched = n_vertices & ~7;
+	for (int i = 0; i < n_batched; i += 8)
+	{
+		__m128 low[12];
+		__m128 high[12];
+		load_batch_sse(vertices + i, low);
+		load_batch_sse(vertices + i + 4, high);
+		__m256 components[12];
+		for (int component = 0; component < 12; component++)
+			components[component] = _mm256_insertf128_ps(_mm256_castps128_ps256(low[component]), high[component], 1);
+
+		transform_components_avx2(&components[0], columns, true);
+		if (transform_normals)
+			transform_components_avx2(&components[3], columns, false);
+		if (transform_tangents)
+			transform_components_avx2(&components[6], columns, false);
+
+		for (int component = 0; component < 12; component++)
+		{
+			low[component] = _mm256_castps256_ps128(components[component]);
+			high[component] = _mm256_extractf128_ps(components[component], 1);
+		}
+		store_batch_sse(vertices + i, low);
+		store_batch_sse(vertices + i + 4, high);
+	}
+	return n_batched;
+}
+
+#ifdef _DEBUG
+//Runs every SIMD path the CPU has against the scalar path and compares the results bit for bit. The counts cover every tail length
+//for batches of 4 and 8, and the batches start at different offsets into the allocation, so loads and stores aren't always aligned
+bool VertexTransform::verify_simd_paths()
+{
+	constexpr int max_vertices = 35;
+	constexpr int max_first_vertex = 3;
+
+	//A matrix without zeros, so every element ends up in the result
+	glm::mat4 matrix;
+	for (int column = 0; column < 4; column++)
+		for (int row = 0; row < 4; row++)
+			matrix[column][row] = 0.37f * static_cast<float>(column * 4 + row) - 2.1f;
+
+	uint32_t random_state = 0x12345678;
+	const auto random_float = [&random_state]()
+	{
+		random_state = random_state * 1664525u + 1013904223u;
+		return static_cast<float>(random_state >> 8) / 16777216.0f * 200.0f - 100.0f;
+	};
+	std::vector<Vertex> source(max_vertices + max_first_vertex);
+	for (Vertex& vertex : source)
+	{
+		vertex.position = { random_float(), random_float(), random_float() };
+		vertex.normal = { random_float(), random_float(), random_float() };
+		vertex.tangent = { random_float(), random_float(), random_float() };
+		vertex.colour = { random_float(), random_float(), random_float() };
+		vertex.texcoord = { random_float(), random_float() };
+	}
+
+	const bool has_avx2 = is_avx2_supported();
+	std::vector<Vertex> expected(source.size());
+	std::vector<Vertex> actual(source.size());
+	for (int path = 0; path < (has_avx2 ? 2 : 1); path++)
+	{
+		for (int flags = 0; flags < 4; flags++)
+		{
+			const bool transform_normals = (flags & 1) != 0;
+			const bool transform_tangents = (flags & 2) != 0;
+			for (int first_vertex = 0; first_vertex <= max_first_vertex; first_vertex++)
+			{
+				for (int n_vertices = 0; n_vertices <= max_vertices; n_vertices++)
+				{
+					expected = source;
+					actual = source;
+					transform_vertices_scalar(expected.data() + first_vertex, n_vertices, matrix, transform_normals, transform_tangents);
+					const int n_done = path == 0
+						? transform_vertices_sse(actual.data() + first_vertex, n_vertices, matrix, transform_normals, transform_tangents)
+						: transform_vertices_avx2(actual.data() + first_vertex, n_vertices, matrix, transform_normals, transform_tangents);
+					transform_vertices_scalar(actual.data() + first_vertex + n_done, n_vertices - n_done, matrix, transform_normals, transform_tangents);
+					if (memcmp(expected.data(), actual.data(), sizeof(Vertex) * source.size()) != 0)
+					{
+						Logger::logf("[ERROR] VertexTransform's %s path doesn't match the scalar path for %i vertices from vertex %i, using the scalar path instead\n",
+							path == 0 ? "SSE" : "AVX2", n_vertices, first_vertex);
+						use_simd = false;
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+#endif
+
+bool VertexTransform::is_avx2_supported()
+{
+#if defined(_MSC_VER)
+	//AVX needs OS support for saving the wider registers, on top of the CPU having it
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	const bool has_osxsave = (info[2] & (1 << 27)) != 0;
+	const bool has_avx = (info[2] & (1 << 28)) != 0;
+	if (!has_osxsave || !has_avx || (_xgetbv(0) & 0x6) != 0x6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(__GNUC__)
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
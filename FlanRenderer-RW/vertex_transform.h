@@ -0,0 +1,22 @@
+#pragma once
+#include <glm/mat4x4.hpp>
+
+struct Vertex;
+
+//Transforms vertex attributes by a matrix during import. The SIMD paths work on batches of vertices split into separate x, y and z
+//registers, and do the same multiplies and adds in the same order as glm, so every path gives bitwise identical results
+class VertexTransform
+{
+public:
+	static void transform_vertices(Vertex* vertices, int n_vertices, const glm::mat4& matrix, bool transform_normals, bool transform_tangents);
+	static void transform_vertices_scalar(Vertex* vertices, int n_vertices, const glm::mat4& matrix, bool transform_normals, bool transform_tangents);
+	static bool is_avx2_supported();
+	inline static bool use_simd = true;
+
+private:
+	static int transform_vertices_sse(Vertex* vertices, int n_vertices, const glm::mat4& matrix, bool transform_normals, bool transform_tangents);
+	static int transform_vertices_avx2(Vertex* vertices, int n_vertices, const glm::mat4& matrix, bool transform_normals, bool transform_tangents);
+#ifdef _DEBUG
+	static bool verify_simd_paths();
+#endif
+};